@@ -0,0 +1,234 @@
+/**
+ * @file ai.h
+ * @author Gnik Droy
+ * @brief File containing function declarations for the expectimax solver.
+ *
+ * The solver searches the game tree on packed bitboards. Max nodes try
+ * every direction, chance nodes average over every empty cell that
+ * add_random() could fill. Leaves are scored with a row heuristic.
+ */
+#pragma once
+#include "bitboard.h"
+
+/** @struct AIConfig
+ *  @brief The search settings of the solver.
+ *
+ *  @var AIConfig::depth
+ *  The number of moves searched ahead
+ *  @var AIConfig::prob_cutoff
+ *  Chance branches less likely than this are scored without searching
+ *  @var AIConfig::table_bits
+ *  The transposition table holds 2^table_bits entries
+ *  @var AIConfig::canonical
+ *  Store chance nodes under their canonical board, see symmetry.h. The
+ *  heuristic scores the 8 symmetric boards the same, so they share one
+ *  entry. Off by default: within one search symmetric boards are rare,
+ *  so it costs more time than it saves.
+ */
+typedef struct
+{
+    unsigned int depth;
+    double prob_cutoff;
+    unsigned int table_bits;
+    bool canonical;
+} AIConfig;
+
+/** @struct AIStats
+ *  @brief Counters collected while searching.
+ *
+ *  @var AIStats::nodes
+ *  The number of max and chance nodes visited
+ *  @var AIStats::table_hits
+ *  The number of chance nodes answered by the transposition table
+ */
+typedef struct
+{
+    unsigned long long nodes;
+    unsigned long long table_hits;
+} AIStats;
+
+/** @def AI_MAX_DEPTH
+ * The deepest search counted by AITimeStats.
+ */
+#define AI_MAX_DEPTH 15
+
+/** @def AI_LATENCY_STEPS
+ * The number of latency buckets per power of two of AITimeStats.
+ */
+#define AI_LATENCY_STEPS 4
+
+/** @def AI_LATENCY_BUCKETS
+ * The number of latency buckets of AITimeStats. Bucket 0 counts moves
+ * that took less than 1 microsecond, the others split every power of
+ * two of microseconds into AI_LATENCY_STEPS equal parts, up to about 16
+ * seconds. The last bucket counts everything slower.
+ */
+#define AI_LATENCY_BUCKETS (1 + 24 * AI_LATENCY_STEPS)
+
+/** @struct AITimeStats
+ *  @brief Histograms of moves decided by ai_best_move_timed().
+ *
+ *  @var AITimeStats::moves
+ *  The number of moves decided
+ *  @var AITimeStats::depths
+ *  The number of moves by the deepest finished search, the last entry
+ *  also counts deeper ones
+ *  @var AITimeStats::latency
+ *  The number of moves by their time, see AI_LATENCY_BUCKETS
+ *  @var AITimeStats::max_us
+ *  The slowest move in microseconds
+ */
+typedef struct
+{
+    unsigned long long moves;
+    unsigned long long depths[AI_MAX_DEPTH + 1];
+    unsigned long long latency[AI_LATENCY_BUCKETS];
+    double max_us;
+} AITimeStats;
+
+/** An opaque handle to a solver and its transposition table */
+typedef struct AI AI;
+
+/**
+ * @brief Asks if a running search should stop.
+ *
+ * @param arg The argument given to ai_set_abort().
+ * @return True to stop the search
+ */
+typedef bool (*AIAbort)(void *arg);
+
+/** @def AI_ABORT_INTERVAL
+ * The number of nodes searched between two calls of the AIAbort function.
+ * A power of two.
+ */
+#define AI_ABORT_INTERVAL 1024
+
+/**
+ * @brief Told about every finished depth of ai_best_move_timed().
+ *
+ * @param arg The argument given to ai_set_progress().
+ * @param best The best direction found by the depth.
+ * @param depth The depth.
+ */
+typedef void (*AIProgress)(void *arg, Direction best, unsigned int depth);
+
+/**
+ * @brief Fills in the default search settings.
+ *
+ * @param config The settings that are written to.
+ */
+void ai_default_config(AIConfig *config);
+
+/**
+ * @brief Creates a solver.
+ *
+ * It also builds the bitboard tables with bitboard_init() and the
+ * heuristic table shared by every solver. Solvers can be created from
+ * several threads at once.
+ *
+ * @param config The search settings. NULL uses the defaults.
+ * @return The new solver or NULL if allocation failed.
+ */
+AI *ai_create(const AIConfig *config);
+
+/**
+ * @brief Destroyes a solver created by ai_create().
+ *
+ * @param ai The solver. May be NULL.
+ */
+void ai_destroy(AI *ai);
+
+/**
+ * @brief Changes the search depth.
+ *
+ * @param ai The solver.
+ * @param depth The number of moves searched ahead, at least 1.
+ */
+void ai_set_depth(AI *ai, unsigned int depth);
+
+/**
+ * @brief Lets a search be stopped from outside.
+ *
+ * The function is called every AI_ABORT_INTERVAL nodes, on the thread
+ * running the search. Once it returns true the search unwinds at once
+ * and returns false, see ai_aborted().
+ *
+ * @param ai The solver.
+ * @param abort The function, or NULL to never stop.
+ * @param arg The argument passed to the function.
+ */
+void ai_set_abort(AI *ai, AIAbort abort, void *arg);
+
+/**
+ * @brief Lets ai_best_move_timed() report each finished depth.
+ *
+ * The function is called on the thread running the search.
+ *
+ * @param ai The solver.
+ * @param progress The function, or NULL.
+ * @param arg The argument passed to the function.
+ */
+void ai_set_progress(AI *ai, AIProgress progress, void *arg);
+
+/**
+ * @brief Checks if the last search was stopped.
+ *
+ * @param ai The solver.
+ * @return If the last search was stopped by the AIAbort function
+ */
+bool ai_aborted(const AI *ai);
+
+/**
+ * @brief Searches for the best direction to move the board in.
+ *
+ * @param ai The solver.
+ * @param board The game board.
+ * @param best The best direction is written here.
+ * @param stats The search counters are added here. May be NULL.
+ * @return If any direction changes the board and the search was not
+ * stopped
+ */
+bool ai_best_move(AI *ai, const Board board, Direction *best, AIStats *stats);
+
+/**
+ * @brief Searches for the best direction to move the bitboard in.
+ *
+ * Same as ai_best_move(), without converting the board.
+ *
+ * @param ai The solver.
+ * @param bitboard The packed board.
+ * @param best The best direction is written here.
+ * @param stats The search counters are added here. May be NULL.
+ * @return If any direction changes the board
+ */
+bool ai_best_move_bitboard(AI *ai, BitBoard bitboard, Direction *best, AIStats *stats);
+
+/**
+ * @brief Searches one move deeper at a time until the time runs out.
+ *
+ * Depth 1, 2 and so on up to AIConfig::depth are searched, sharing the
+ * transposition table. The search checks the time every
+ * AI_ABORT_INTERVAL nodes and stops the unfinished depth once the budget
+ * is spent; the move of the last finished depth is returned. Depth 1
+ * always finishes, it takes microseconds, so there is a move whatever
+ * the budget. The AIAbort function stops every depth as usual.
+ *
+ * @param ai The solver.
+ * @param bitboard The packed board.
+ * @param budget_ms The time budget in milliseconds.
+ * @param best The best direction is written here.
+ * @param stats The time and depth of the move are added here. May be NULL.
+ * @return If any direction changes the board and depth 1 was not
+ * stopped by the AIAbort function
+ */
+bool ai_best_move_timed(AI *ai, BitBoard bitboard, double budget_ms, Direction *best, AITimeStats *stats);
+
+/**
+ * @brief Estimates a latency percentile from the histogram.
+ *
+ * @param stats The histograms.
+ * @param fraction The percentile as a fraction, e.g. 0.99.
+ * @return The upper bound in microseconds of the bucket holding the
+ * percentile, or the slowest move for the last bucket.
+ */
+double ai_latency_percentile(const AITimeStats *stats, double fraction);
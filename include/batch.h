@@ -0,0 +1,148 @@
+/**
+ * @file batch.h
+ * @author Gnik Droy
+ * @brief File containing the API for stepping many games at once.
+ *
+ * A batch stores N boards in a structure of arrays layout: one byte
+ * plane per cell, holding that cell of every game. Plane (x * SIZE + y)
+ * starts at batch_cells() + (x * SIZE + y) * batch_stride(), so the
+ * same cell of neighbouring games is contiguous and one vector
+ * instruction works on 16 or 32 games.
+ *
+ * The SIMD kernels are picked at runtime, on the first call. AVX2 is
+ * used when the CPU supports it, else SSE4.1, else the scalar code.
+ * Both kernels are built on any x86 target, no -march flag is needed.
+ * The scalar functions are always available and use the core.c
+ * functions, so the kernels can be checked against them.
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "core.h"
+
+/** An opaque handle to a batch of games */
+typedef struct Batch Batch;
+
+/**
+ * @brief Creates a batch of games.
+ *
+ * Every game is started as by batch_reset(), game i with seed + i.
+ *
+ * @param count The number of games.
+ * @param seed The seed of the first game.
+ * @return The new batch or NULL if allocation failed.
+ */
+Batch *batch_create(size_t count, uint64_t seed);
+
+/**
+ * @brief Destroyes a batch created by batch_create().
+ *
+ * @param batch The batch. May be NULL.
+ */
+void batch_destroy(Batch *batch);
+
+/**
+ * @brief Returns the number of games in the batch.
+ *
+ * @param batch The batch.
+ * @return The number of games.
+ */
+size_t batch_count(const Batch *batch);
+
+/**
+ * @brief Returns the distance between two cell planes.
+ *
+ * @param batch The batch.
+ * @return The number of bytes in a plane, at least batch_count().
+ */
+size_t batch_stride(const Batch *batch);
+
+/**
+ * @brief Returns the cell planes of the batch.
+ *
+ * The bytes past batch_count() in every plane are padding.
+ *
+ * @param batch The batch.
+ * @return The first plane, aligned to 32 bytes.
+ */
+const unsigned char *batch_cells(const Batch *batch);
+
+/**
+ * @brief Starts a game of the batch over.
+ *
+ * The board is cleared and a random tile is added, like game_reset().
+ *
+ * @param batch The batch.
+ * @param game The index of the game.
+ * @param seed The new seed for the random number generator of the game.
+ */
+void batch_reset(Batch *batch, size_t game, uint64_t seed);
+
+/**
+ * @brief Copies a board out of the batch.
+ *
+ * @param batch The batch.
+ * @param game The index of the game.
+ * @param board The game board that is written to.
+ */
+void batch_get_board(const Batch *batch, size_t game, Board board);
+
+/**
+ * @brief Copies a board into the batch.
+ *
+ * @param batch The batch.
+ * @param game The index of the game.
+ * @param board The game board.
+ */
+void batch_set_board(Batch *batch, size_t game, const Board board);
+
+/**
+ * @brief Moves every game of the batch in its own direction.
+ *
+ * Games that changed get a random tile, exactly as move_with_spawn()
+ * would add it with the same generator state.
+ *
+ * @param batch The batch.
+ * @param dirs The Direction of every game, one byte each.
+ * @param moved If the board of each game changed, either 0 or 1. May be NULL.
+ * @param merged The merge score gained by each game, see Score::merged.
+ * May be NULL.
+ * @return The number of games that changed
+ */
+size_t batch_step(Batch *batch, const unsigned char *dirs, unsigned char *moved, uint32_t *merged);
+
+/**
+ * @brief Same as batch_step(), one game at a time with move_with_spawn().
+ *
+ * @param batch The batch.
+ * @param dirs The Direction of every game, one byte each.
+ * @param moved If the board of each game changed. May be NULL.
+ * @param merged The merge score gained by each game. May be NULL.
+ * @return The number of games that changed
+ */
+size_t batch_step_scalar(Batch *batch, const unsigned char *dirs, unsigned char *moved, uint32_t *merged);
+
+/**
+ * @brief Checks which games of the batch are over.
+ *
+ * @param batch The batch.
+ * @param over If each game is over, either 0 or 1.
+ * @return The number of games that are over
+ */
+size_t batch_game_over(const Batch *batch, unsigned char *over);
+
+/**
+ * @brief Same as batch_game_over(), one game at a time with is_game_over().
+ *
+ * @param batch The batch.
+ * @param over If each game is over, either 0 or 1.
+ * @return The number of games that are over
+ */
+size_t batch_game_over_scalar(const Batch *batch, unsigned char *over);
+
+/**
+ * @brief Returns the name of the kernels batch_step() uses.
+ *
+ * @return "avx2", "sse4.1" or "scalar"
+ */
+const char *batch_kernel(void);
@@ -0,0 +1,152 @@
+/**
+ * @file bitboard.h
+ * @author Gnik Droy
+ * @brief File containing function declarations for the packed bitboard engine.
+ *
+ * The whole 4x4 board is packed into one 64 bit integer with a 4 bit
+ * exponent per cell. Cell board[x][y] lives in nibble (x * SIZE + y), so
+ * every row is a 16 bit word with column 0 in the lowest nibble.
+ *
+ * Left and right moves are looked up row by row in precomputed tables,
+ * up and down moves transpose the board and reuse the row tables.
+ */
+#pragma once
+#include <stdint.h>
+#include "core.h"
+
+#if SIZE != 4
+#error "The bitboard engine only supports a board SIZE of 4"
+#endif
+
+/** The packed game board type */
+typedef uint64_t BitBoard;
+
+/** @def BITBOARD_MAX_TILE
+ * The largest exponent that fits in a nibble.
+ * Two tiles holding this value are never merged.
+ */
+#define BITBOARD_MAX_TILE 15
+
+/**
+ * @brief Builds the row lookup tables.
+ *
+ * The tables hold the result of moving each of the 65536 possible rows.
+ * It is safe to call this more than once and from several threads at
+ * once. The tables are built by the first call, the others return once
+ * they are ready.
+ */
+void bitboard_init(void);
+
+/**
+ * @brief Packs a game board into a bitboard.
+ *
+ * Exponents larger than BITBOARD_MAX_TILE are clamped.
+ *
+ * @param board The game board.
+ * @return The packed board.
+ */
+BitBoard board_to_bitboard(const Board board);
+
+/**
+ * @brief Unpacks a bitboard into a game board.
+ *
+ * @param bitboard The packed board.
+ * @param board The game board that is written to.
+ */
+void bitboard_to_board(BitBoard bitboard, Board board);
+
+/**
+ * @brief Transposes the bitboard.
+ *
+ * Swaps board[x][y] with board[y][x] for every cell.
+ *
+ * @param bitboard The packed board.
+ * @return The transposed board.
+ */
+BitBoard bitboard_transpose(BitBoard bitboard);
+
+/**
+ * @brief Returns a mask of the empty cells of the bitboard.
+ *
+ * The lowest bit of every empty nibble is set, all other bits are 0.
+ *
+ * @param bitboard The packed board.
+ * @return The mask of empty cells.
+ */
+BitBoard bitboard_empty_mask(BitBoard bitboard);
+
+/**
+ * @brief Counts the empty cells of the bitboard.
+ *
+ * @param bitboard The packed board.
+ * @return The number of cells holding 0.
+ */
+unsigned int bitboard_count_empty(BitBoard bitboard);
+
+/**
+ * @brief Adds a value of 1 to a random empty cell of the bitboard.
+ *
+ * This is the equivalent of add_random(). The cell is picked from
+ * bitboard_empty_mask() with a popcount and a bit select.
+ * Nothing is added if the board is full.
+ *
+ * @param bitboard The packed board.
+ * @param rng The random number generator of the game.
+ * @return The board with the new tile.
+ */
+BitBoard bitboard_add_random(BitBoard bitboard, Rng *rng);
+
+/**
+ * @brief Moves the bitboard in X direction.
+ *
+ * This is the equivalent of shift_x() followed by merge_x().
+ * No random tile is added.
+ *
+ * @param bitboard The packed board.
+ * @param opp The direction of the move. 0 is left, anything else is right.
+ * @return The moved board. It equals the input if nothing moved.
+ */
+BitBoard bitboard_move_x(BitBoard bitboard, bool opp);
+
+/**
+ * @brief Moves the bitboard in Y direction.
+ *
+ * This is the equivalent of shift_y() followed by merge_y().
+ * No random tile is added.
+ *
+ * @param bitboard The packed board.
+ * @param opp The direction of the move. 0 is top, anything else is bottom.
+ * @return The moved board. It equals the input if nothing moved.
+ */
+BitBoard bitboard_move_y(BitBoard bitboard, bool opp);
+
+/**
+ * @brief Moves the bitboard in the given direction.
+ *
+ * Calls bitboard_move_x() or bitboard_move_y() with the matching opp flag.
+ *
+ * @param bitboard The packed board.
+ * @param dir The direction of the move.
+ * @return The moved board.
+ */
+BitBoard bitboard_move_direction(BitBoard bitboard, Direction dir);
+
+/**
+ * @brief Adds the merges of a move to the score.
+ *
+ * The merges in a row do not depend on the direction it moves in, so
+ * they are looked up in one more row table.
+ *
+ * @param bitboard The packed board before the move.
+ * @param dir The direction of the move.
+ * @param score The score of the game.
+ */
+void bitboard_update_score(BitBoard bitboard, Direction dir, Score *score);
+
+/**
+ * @brief Checks if there are possible moves left on the bitboard.
+ *
+ * @param bitboard The packed board.
+ * @return Either 0 or 1
+ */
+bool bitboard_is_game_over(BitBoard bitboard);
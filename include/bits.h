@@ -0,0 +1,85 @@
+/**
+ * @file bits.h
+ * @author Gnik Droy
+ * @brief File containing bit manipulation helpers used by the engines.
+ *
+ * The helpers use compiler builtins and BMI2 when they are available
+ * and fall back to portable code otherwise.
+ */
+#pragma once
+#include <stdint.h>
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Counts the set bits.
+ *
+ * @param x The value.
+ * @return The number of set bits.
+ */
+static inline unsigned int bits_popcount(uint64_t x)
+{
+//On x86 without POPCNT the builtin is a library call, the SWAR code is faster
+#if defined(__GNUC__) && (defined(__POPCNT__) || !(defined(__x86_64__) || defined(__i386__)))
+    return (unsigned int)__builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (unsigned int)((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+/**
+ * @brief Returns the index of the lowest set bit.
+ *
+ * @param x The value. Must not be 0.
+ * @return The index of the lowest set bit.
+ */
+static inline unsigned int bits_ctz(uint64_t x)
+{
+#if defined(__GNUC__)
+    return (unsigned int)__builtin_ctzll(x);
+#else
+    return bits_popcount((x & (0 - x)) - 1);
+#endif
+}
+
+/**
+ * @brief Returns the index of the n-th set bit.
+ *
+ * With BMI2 this is a pdep and a tzcnt. Otherwise a broadword select
+ * is used, which has no branches and no table lookups.
+ *
+ * @param mask The value. Must have more than n set bits.
+ * @param n The rank of the wanted bit, counting from 0.
+ * @return The index of the bit.
+ */
+static inline unsigned int bits_select(uint64_t mask, unsigned int n)
+{
+#if defined(__BMI2__)
+    return bits_ctz(_pdep_u64((uint64_t)1 << n, mask));
+#else
+    //Broadword select: find the byte holding the bit from the running
+    //byte counts, then halve that byte three times.
+    const uint64_t ones = 0x0101010101010101ULL, highs = 0x8080808080808080ULL;
+    uint64_t counts = mask - ((mask >> 1) & 0x5555555555555555ULL);
+    counts = (counts & 0x3333333333333333ULL) + ((counts >> 2) & 0x3333333333333333ULL);
+    counts = ((counts + (counts >> 4)) & 0x0F0F0F0F0F0F0F0FULL) * ones;
+    uint64_t below = (((n * ones) | highs) - counts) & highs;
+    unsigned int pos = (unsigned int)(((below >> 7) * ones) >> 56) * 8;
+    n -= (unsigned int)(((counts << 8) >> pos) & 0xFF);
+    unsigned int byte = (unsigned int)(mask >> pos) & 0xFF;
+    for (unsigned int width = 4; width >= 1; width /= 2)
+    {
+        //Popcounts of the nibbles 0 to 15, packed four bits each
+        unsigned int low = (unsigned int)(0x4332322132212110ULL >> ((byte & ((1u << width) - 1)) * 4)) & 0xF;
+        unsigned int upper = 0u - (unsigned int)(n >= low);
+        n -= low & upper;
+        byte >>= width & upper;
+        pos += width & upper;
+    }
+    return pos;
+#endif
+}
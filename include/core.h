@@ -7,9 +7,10 @@
 #pragma once
 #include <stdio.h>
 #include <stdbool.h>
+#include "rng.h"
 
 /** @def SIZE
- * The size of the board
+ * The size of the board. At most 8, so every cell fits in a 64 bit mask.
  */
 #define SIZE 4
 
@@ -18,9 +19,24 @@
  */
 #define BASE 2
 
+#if SIZE > 8
+#error "SIZE must be at most 8"
+#endif
+
 /** The game board type */
 typedef unsigned char Board[][SIZE];
 
+/** The directions the game board can be moved in.
+ *  The lowest bit is the opp flag used by move_x() and move_y().
+ */
+typedef enum
+{
+    DIRECTION_UP,
+    DIRECTION_DOWN,
+    DIRECTION_LEFT,
+    DIRECTION_RIGHT
+} Direction;
+
 /**
  * @brief Unsigned integer exponentiation.
  * 
@@ -66,6 +82,17 @@ bool is_game_over(const Board board);
  */
 void clear_board(Board board);
 
+/**
+ * @brief Returns a mask of the empty cells of the board.
+ *
+ * Bit (x * SIZE + y) is set when board[x][y] is 0.
+ * Eight cells are tested at once with a few word operations.
+ * 
+ * @param board The game board.
+ * @return The mask of empty cells
+ */
+uint64_t empty_mask(const Board board);
+
 /**
  * @brief Adds a value of 1 to random place to the board.
  *
@@ -74,11 +101,64 @@ void clear_board(Board board);
  * 1 is kept since you can use raise it with BASE to get required value.
  * Also it keeps the size of board to a low value.
  * 
- * NOTE: It has no checks if there are any empty places for keeping 
- * the random value.
- * If no empty place is found a floating point exception will occur.
+ * The empty cell is picked from empty_mask() with a popcount and a bit
+ * select, so there is no loop over the cells.
+ * Nothing is added if the board is full.
+ * 
+ * @param board The game board.
+ * @param rng The random number generator of the game.
+ * @return The index (x * SIZE + y) of the filled cell, or SIZE * SIZE
+ * if the board is full.
+ */
+unsigned int add_random(Board board, Rng *rng);
+
+/** @struct Score
+ *  @brief The score of a game, kept up to date as tiles merge.
+ *
+ *  @var Score::sum
+ *  The sum of all tile values, the same as calculate_score()
+ *  @var Score::merged
+ *  The sum of the values of all tiles created by merges, the standard
+ *  2048 score. It can not be derived from the board alone.
+ *  @var Score::max_tile
+ *  The largest exponent on the board
+ */
+typedef struct
+{
+    unsigned long sum;
+    unsigned long merged;
+    unsigned char max_tile;
+} Score;
+
+/**
+ * @brief Sets the score to match a new game board.
+ *
+ * The merge score is set to 0, since the history of the board is unknown.
+ * 
+ * @param score The score that is written to.
+ * @param board The game board.
+ */
+void score_reset(Score *score, const Board board);
+
+/**
+ * @brief Adds the merges of a move to the score.
+ *
+ * Every engine keeps the score up to date with this.
+ *
+ * @param score The score of the game. May be NULL.
+ * @param merged The sum of the values of the tiles created by the merges.
+ * @param max_tile The largest exponent created by the merges.
  */
-void add_random(Board board);
+static inline void score_add_merges(Score *score, unsigned long merged, unsigned char max_tile)
+{
+    if (score == NULL)
+        return;
+    //Every merged tile of value v replaced two tiles of value v / BASE
+    score->sum += merged - 2 * (merged / BASE);
+    score->merged += merged;
+    if (max_tile > score->max_tile)
+        score->max_tile = max_tile;
+}
 
 /**
  * @brief Calculates the score of a game board
@@ -86,6 +166,7 @@ void add_random(Board board);
  * It scores the board in a simple way.
  * Each element in the board is used as exponents of the BASE. And the 
  * sum of all BASE^element is returned.
+ * This walks the whole board, prefer a Score that is kept up to date.
  * 
  * @return An integer that represents the current score
  */
@@ -111,13 +192,15 @@ bool shift_x(Board board, bool opp);
  * It merges consecutive successive elements of the game board in the X direction.
  * If the direction is given as 0, it merges the game board to the left
  * direction. Any other non zero value merges it to the right direction.
+ * Every merge is added to the score.
  * 
  * @param board The game board.
  * @param opp The direction of the shift.
+ * @param score The score of the game. May be NULL.
  * 
  * @return If the merge was successful
  */
-bool merge_x(Board board, bool opp);
+bool merge_x(Board board, bool opp, Score *score);
 
 /**
  * @brief Moves the elements in X direction.
@@ -127,9 +210,11 @@ bool merge_x(Board board, bool opp);
  * 
  * @param board The game board.
  * @param opp The direction of the move.
+ * @param rng The random number generator of the game.
  * 
+ * @return If the board changed
  */
-void move_x(Board board, bool opp);
+bool move_x(Board board, bool opp, Rng *rng);
 
 /**
  * @brief Shifts the game board in Y direction.
@@ -151,13 +236,15 @@ bool shift_y(Board board, bool opp);
  * It merges consecutive successive elements of the game board in the Y direction.
  * If the direction is given as 0, it merges the game board to the top
  * direction. Any other non zero value merges it to the bottom.
+ * Every merge is added to the score.
  * 
  * @param board The game board.
  * @param opp The direction of the shift.
+ * @param score The score of the game. May be NULL.
  * 
  * @return If the merge was successful
  */
-bool merge_y(Board board, bool opp);
+bool merge_y(Board board, bool opp, Score *score);
 
 /**
  * @brief Moves the elements in Y direction.
@@ -167,6 +254,52 @@ bool merge_y(Board board, bool opp);
  * 
  * @param board The game board.
  * @param opp The direction of the move.
+ * @param rng The random number generator of the game.
+ * 
+ * @return If the board changed
+ */
+bool move_y(Board board, bool opp, Rng *rng);
+
+/**
+ * @brief Moves the elements in the given direction.
+ *
+ * It calls move_x() or move_y() with the matching opp flag.
+ * 
+ * @param board The game board.
+ * @param dir The direction of the move.
+ * @param rng The random number generator of the game.
+ * 
+ * @return If the board changed
+ */
+bool move_direction(Board board, Direction dir, Rng *rng);
+
+/**
+ * @brief Moves the elements in the given direction without adding a tile.
+ *
+ * It performs shift_x() and merge_x() or shift_y() and merge_y(), e.g.
+ * to replay a game whose new tiles are known.
+ * 
+ * @param board The game board.
+ * @param dir The direction of the move.
+ * @param score The score of the game. May be NULL.
+ * 
+ * @return If the board changed
+ */
+bool move_tiles(Board board, Direction dir, Score *score);
+
+/**
+ * @brief Moves the elements in the given direction and reports the new tile.
+ *
+ * Same as move_direction(), but returns where add_random() placed the
+ * new tile, e.g. for animations or recording. The merges and the new
+ * tile are added to the score.
+ * 
+ * @param board The game board.
+ * @param dir The direction of the move.
+ * @param rng The random number generator of the game.
+ * @param score The score of the game. May be NULL.
  * 
+ * @return The index (x * SIZE + y) of the added tile, or -1 if the 
+ * board did not change
  */
-void move_y(Board board, bool opp);
+int move_with_spawn(Board board, Direction dir, Rng *rng, Score *score);
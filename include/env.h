@@ -0,0 +1,125 @@
+/**
+ * @file env.h
+ * @author Gnik Droy
+ * @brief File containing the vectorized environment for reinforcement learning.
+ *
+ * An environment steps N games per call on the batch engine, see
+ * batch.h, so a training loop crosses its FFI boundary once per step
+ * instead of once per game. The observations, rewards and done flags are
+ * written straight into buffers owned by the caller, e.g. the memory of
+ * a NumPy array or a tensor, in the layout such frameworks use: the
+ * observation of game i starts at obs_out + i * env_observation_size().
+ *
+ * The functions only take fixed width types and opaque handles, so the
+ * ABI stays stable; check env_abi_version() when loading the library
+ * dynamically.
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @def ENV_ABI_VERSION
+ * Bumped whenever a function or the observation layout changes.
+ */
+#define ENV_ABI_VERSION 1
+
+/** @def ENV_PLANES
+ * The number of one-hot planes, one per exponent from 0 (empty) to 15.
+ * Larger exponents are set in the last plane.
+ */
+#define ENV_PLANES 16
+
+/** An opaque handle to a vectorized environment */
+typedef struct Env Env;
+
+/** The layout of the observation of one game */
+typedef enum
+{
+    /** SIZE * SIZE floats, the exponent of cell (x, y) at x * SIZE + y */
+    ENV_OBS_EXPONENTS,
+    /** ENV_PLANES * SIZE * SIZE floats, 1 at plane e for a cell of exponent e, capped at ENV_PLANES - 1 */
+    ENV_OBS_ONEHOT
+} EnvObservation;
+
+/**
+ * @brief Returns the ABI version of the library.
+ *
+ * @return ENV_ABI_VERSION of the library
+ */
+uint32_t env_abi_version(void);
+
+/**
+ * @brief Creates an environment.
+ *
+ * The games are started as by env_reset() with the seed.
+ *
+ * @param n The number of games.
+ * @param seed The seed of the first game.
+ * @param observation The layout of the observations.
+ * @return The new environment or NULL if allocation failed.
+ */
+Env *env_create(size_t n, uint64_t seed, EnvObservation observation);
+
+/**
+ * @brief Destroyes an environment created by env_create().
+ *
+ * @param env The environment. May be NULL.
+ */
+void env_destroy(Env *env);
+
+/**
+ * @brief Returns the number of games of the environment.
+ *
+ * @param env The environment.
+ * @return The number of games
+ */
+size_t env_count(const Env *env);
+
+/**
+ * @brief Returns the number of floats in the observation of one game.
+ *
+ * @param env The environment.
+ * @return SIZE * SIZE, or ENV_PLANES * SIZE * SIZE for one-hot observations
+ */
+size_t env_observation_size(const Env *env);
+
+/**
+ * @brief Starts every game over.
+ *
+ * Game i is seeded with seed + i, the games started by the auto-reset
+ * of env_step() continue from seed + n on.
+ *
+ * @param env The environment.
+ * @param seed The seed of the first game.
+ * @param obs_out The observations are written here, n *
+ * env_observation_size() floats. May be NULL.
+ */
+void env_reset(Env *env, uint64_t seed, float *obs_out);
+
+/**
+ * @brief Moves every game and starts the finished ones over.
+ *
+ * A move that doesn't change the board is rewarded 0 and leaves the game
+ * as it is. A game that is over after its move is flagged done and
+ * started over at once, so its observation is the first of the next
+ * game. The result only depends on the seed and the actions.
+ *
+ * @param env The environment.
+ * @param actions The Direction of every game, one byte each from 0 to 3.
+ * Only the low 2 bits are used.
+ * @param obs_out The observations are written here, n *
+ * env_observation_size() floats.
+ * @param reward_out The merge score gained by each game, see
+ * Score::merged. May be NULL.
+ * @param done_out If each game ended, either 0 or 1. May be NULL.
+ * @return The number of games that ended
+ */
+size_t env_step(Env *env, const uint8_t *actions, float *obs_out, float *reward_out, uint8_t *done_out);
+
+#ifdef __cplusplus
+}
+#endif
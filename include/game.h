@@ -37,12 +37,9 @@ void closeSDL(SDL_Window **window);
 /**
  * @brief Draws text centered inside the rect. 
  *
- * When two pointers to the pointer of window and renderer are provided,
- * the function initializes both values with the values of created window
- * and renderer. 
- * 
- * If initialization is failed it may display error to stderr but
- * does not exit.
+ * The text is rasterized once and then reused from the text cache,
+ * see get_text_texture(). Texts too long for the cache are rasterized
+ * every time.
  * 
  * @param renderer The renderer for the game
  * @param font The font for the text
@@ -52,6 +49,54 @@ void closeSDL(SDL_Window **window);
  */
 void draw_text(SDL_Renderer *renderer, TTF_Font *font, const char *text, SDL_Rect rect, SDL_Color color);
 
+/**
+ * @brief Returns the texture of a text, rasterizing it only once.
+ *
+ * Textures are cached by font, text and color. A TTF_Font is opened 
+ * at a single size, so the font also stands for the size.
+ * The least recently used entry is replaced when the cache is full.
+ * The texture is owned by the cache and must not be destroyed.
+ * 
+ * @param renderer The renderer for the game
+ * @param font The font for the text
+ * @param text The text to rasterize
+ * @param color The color of the text
+ * @param w The width of the texture is written here
+ * @param h The height of the texture is written here
+ * @return The texture, or NULL if the text is too long to be cached
+ */
+SDL_Texture *get_text_texture(SDL_Renderer *renderer, TTF_Font *font, const char *text, SDL_Color color, int *w, int *h);
+
+/**
+ * @brief Removes every cached texture of a font.
+ *
+ * Must be called before the font is closed, since a new font may be
+ * opened at the same address.
+ * 
+ * @param font The font.
+ */
+void forget_font(TTF_Font *font);
+
+/**
+ * @brief Destroyes every cached texture.
+ */
+void clear_text_cache(void);
+
+/**
+ * @brief Draws text centered inside the rect, one cached glyph at a time. 
+ *
+ * Every character is rasterized once and reused for any string, which
+ * suits text that changes often, like the score. It is meant for 
+ * monospaced fonts, since no kerning is applied.
+ * 
+ * @param renderer The renderer for the game
+ * @param font The font for the text
+ * @param text The text to write
+ * @param rect The SDL_Rect object inside which text is written
+ * @param color The color of the text
+ */
+void draw_glyphs(SDL_Renderer *renderer, TTF_Font *font, const char *text, SDL_Rect rect, SDL_Color color);
+
 /**
  * @brief Draws white text centered inside a rect. 
  *
@@ -76,16 +121,51 @@ void clear_screen(SDL_Renderer *renderer);
 /**
  * @brief Draws black text centered inside the window. 
  *
+ * The screen is cleared first. Nothing is presented, so it can be 
+ * drawn as part of a frame.
+ * 
  * @param renderer The renderer for the game
- * @param size The size for the text
  * @param text The text to write
+ * @param font The font for the text
+ */
+void display_text(SDL_Renderer *renderer, const char *text, TTF_Font *font);
+
+/**
+ * @brief Shows a text over the whole window for a while. 
+ *
+ * The text replaces the game in render_game() until the time is over 
+ * or a key is pressed. The font is passed by address, since it may 
+ * still be loading.
+ * 
+ * @param text The text to show
+ * @param font The address of the font for the text
+ * @param duration The time in milliseconds to show the text for
+ */
+void show_overlay(const char *text, TTF_Font **font, Uint32 duration);
+
+/**
+ * @brief Loads the fonts and the audio files. 
+ *
+ * Meant to run on its own thread while the window is already shown. 
+ * The fonts are opened first, at every size the game uses. Once they 
+ * are, and once the audio is loaded, an event of the type returned by 
+ * SDL_RegisterEvents() and passed in data is pushed. The event code is 
+ * ASSETS_FONTS or ASSETS_AUDIO, negated if loading failed.
+ * 
+ * No TTF functions may be called on other threads until the fonts are 
+ * loaded, since SDL_ttf shares one FreeType library between all fonts.
+ * 
+ * @param data Pointer to the Uint32 event type
+ * @return 0 if everything was loaded
  */
-void display_text(SDL_Renderer *renderer, const char *text, int size);
+int load_assets(void *data);
 
 /**
  * @brief Draws the game tiles. 
  *
- * It draws the SIZE*SIZE game tiles to the window.
+ * Only the tiles that changed since they were last drawn are drawn, 
+ * on top of the parts drawn by draw_static(). The rects are filled 
+ * with one draw call per color.
  * 
  * @param renderer The renderer for the game
  * @param font The font for the tiles
@@ -93,6 +173,28 @@ void display_text(SDL_Renderer *renderer, const char *text, int size);
  */
 void draw_board(SDL_Renderer *renderer, const Board board, TTF_Font *font);
 
+/**
+ * @brief Draws the parts of the game that don't change. 
+ *
+ * Clears the screen and draws the empty cells, the score panel and the
+ * new game button. Every tile that isn't empty is drawn again by the
+ * next draw_board().
+ * 
+ * @param renderer The renderer for the game
+ * @param font The font for the button
+ */
+void draw_static(SDL_Renderer *renderer, TTF_Font *font);
+
+/**
+ * @brief Draws the static parts to the board layer again on the next frame.
+ *
+ * The board layer keeps the board between frames, so only the tiles
+ * that changed are drawn, see render_game().
+ * 
+ * @param lost If the texture itself is lost and has to be created again
+ */
+void reset_board_layer(bool lost);
+
 /**
  * @brief Draws the new game button. 
  *
@@ -103,6 +205,17 @@ void draw_board(SDL_Renderer *renderer, const Board board, TTF_Font *font);
  */
 void draw_button(SDL_Renderer *renderer, TTF_Font *font);
 
+/**
+ * @brief Starts a new game. 
+ *
+ * The generator is seeded with a new seed drawn from it, the board is 
+ * reset and a random tile is added. When recording, the previous game 
+ * is ended and the new one begun.
+ * 
+ * @param board The game board.
+ */
+void new_game(Board board);
+
 /**
  * @brief Handles the action of New Game button. 
  *
@@ -112,13 +225,15 @@ void draw_button(SDL_Renderer *renderer, TTF_Font *font);
  * 
  * @param e The mouse event
  * @param board The game board.
+ * @return If the game board was reset
  */
-void button_handler(SDL_Event e, Board board);
+bool button_handler(SDL_Event e, Board board);
 
 /**
  * @brief Draws the current game score
  *
- * It draws the current game score to the window
+ * It draws the current game score to the window. The score is kept up 
+ * to date by the moves, so the board is not walked.
  * 
  * @param renderer The renderer for the game
  * @param font The font for the tiles
@@ -129,8 +244,10 @@ void draw_score(SDL_Renderer *renderer, Board board, TTF_Font *font);
 /**
  * @brief Draws everything for the game and renders it to screen. 
  *
- * It calls clear_screen(),draw_board(),draw_score() and draw_button()
- * and also renders it to screem.
+ * The static parts and the tiles are kept in a target texture, so a 
+ * frame draws only the tiles that changed to it, copies it to the 
+ * screen and adds the hint and the score. Without render targets, 
+ * draw_static() and draw_board() draw everything every frame.
  * 
  * @param renderer The renderer for the game
  * @param font The font for the tiles
@@ -138,9 +255,20 @@ void draw_score(SDL_Renderer *renderer, Board board, TTF_Font *font);
  */
 void render_game(SDL_Renderer *renderer, Board board, TTF_Font *font);
 
+/**
+ * @brief Checks if an animation is running.
+ * 
+ * @return If the game has to be redrawn every frame
+ */
+bool is_animating(void);
+
 /**
  * @brief This is the main game loop that handles all events and drawing 
  * 
+ * The loop blocks in SDL_WaitEvent() while nothing is animating and 
+ * only redraws when the game changed. While an animation runs, frames 
+ * are paced at FRAME_RATE and input is handled between them.
+ * 
  * @param renderer The renderer for the game
  * @param board The game board.
  */
@@ -156,5 +284,106 @@ void game_loop(Board board, SDL_Renderer *renderer);
  * @param renderer The renderer for the game
  * @param e A Keyup event.
  * @param board The game board.
+ * @return If the game board changed
+ */
+bool handle_move(SDL_Event e, Board board, SDL_Renderer *renderer);
+
+/**
+ * @brief Starts the hint worker.
+ *
+ * The worker searches the board for the best move while the player 
+ * thinks, see hint_worker(). If it can't be started the game runs 
+ * without hints.
+ * 
+ * @param board The game board.
+ * @return If the worker was started
+ */
+bool start_hints(const Board board);
+
+/**
+ * @brief Cancels the search and stops the hint worker.
+ */
+void stop_hints(void);
+
+/**
+ * @brief Hands a board to the hint worker.
+ *
+ * Never blocks: the board is published and the search of the previous 
+ * board is cancelled at once. Called whenever the board changes.
+ * 
+ * @param board The game board.
+ */
+void request_hint(const Board board);
+
+/**
+ * @brief Turns the hints on or off.
+ * 
+ * @param board The game board, searched when the hints are turned on.
+ */
+void toggle_hints(const Board board);
+
+/**
+ * @brief Searches the requested boards for hints.
+ *
+ * Runs on its own thread. Every board is searched with 
+ * ai_best_move_timed() for HINT_BUDGET_MS, up to HINT_MAX_DEPTH moves 
+ * deep, and the move of every finished depth is published and announced with an 
+ * event of the type g_hint_event.
+ * 
+ * @param data The solver, see ai_create(). It is destroyed on exit.
+ * @return 0
+ */
+int hint_worker(void *data);
+
+/**
+ * @brief Draws an arrow in the direction of the current hint. 
+ *
+ * Nothing is drawn while the hints are off or the worker has no move 
+ * for the current board yet.
+ * 
+ * @param renderer The renderer for the game
+ */
+void draw_hint(SDL_Renderer *renderer);
+
+/** The timed sections of the game, each has its own histogram.*/
+typedef enum
+{
+    PROFILE_RENDER,
+    PROFILE_DRAW_BOARD,
+    PROFILE_DRAW_TEXT,
+    PROFILE_RASTERIZE,
+    PROFILE_UPLOAD,
+    PROFILE_PRESENT,
+    PROFILE_HANDLE_MOVE,
+    PROFILE_COUNT
+} ProfileSection;
+
+/**
+ * @brief Records the time since start in the histogram of a section.
+ *
+ * The histograms are updated with atomics only, so any thread may
+ * record to them.
+ * 
+ * @param section The timed section
+ * @param start The SDL_GetPerformanceCounter() value when it started
+ * @return The time in microseconds
+ */
+Uint32 profile_end(ProfileSection section, Uint64 start);
+
+/**
+ * @brief Writes the histograms and counters as JSON.
+ * 
+ * @param stream The stream written to
+ */
+void write_profile(FILE *stream);
+
+/**
+ * @brief Draws the frame statistics over the top of the board. 
+ *
+ * Shows the time and texture uploads of the last frame and the frames 
+ * presented per second. Nothing is drawn while they are off, F1 turns 
+ * them on.
+ * 
+ * @param renderer The renderer for the game
  */
-void handle_move(SDL_Event e, Board board, SDL_Renderer *renderer);
+void draw_hud(SDL_Renderer *renderer);
@@ -0,0 +1,105 @@
+/**
+ * @file lib2048.h
+ * @author Gnik Droy
+ * @brief File containing the public API of the headless core library.
+ *
+ * The library wraps a game board and its state behind an opaque handle,
+ * so it can be driven without SDL, e.g. for simulations and benchmarks.
+ */
+#pragma once
+#include "core.h"
+
+/** An opaque handle to a single running game */
+typedef struct Game Game;
+
+/**
+ * @brief Creates a new game.
+ *
+ * The board is cleared and a random tile is added.
+ * Games created with the same seed and stepped with the same directions
+ * are identical.
+ *
+ * @param seed The seed for the random number generator of the game.
+ * @return The new game or NULL if allocation failed.
+ */
+Game *game_create(uint64_t seed);
+
+/**
+ * @brief Destroyes a game created by game_create().
+ *
+ * @param game The game. May be NULL.
+ */
+void game_destroy(Game *game);
+
+/**
+ * @brief Starts the game over.
+ *
+ * The board is cleared and a random tile is added.
+ *
+ * @param game The game.
+ * @param seed The new seed for the random number generator of the game.
+ */
+void game_reset(Game *game, uint64_t seed);
+
+/**
+ * @brief Moves the game board in a direction.
+ *
+ * A random tile is added if the board changed.
+ *
+ * @param game The game.
+ * @param dir The direction of the move.
+ * @return If the board changed
+ */
+bool game_step(Game *game, Direction dir);
+
+/**
+ * @brief Returns where the last new tile was added.
+ *
+ * @param game The game.
+ * @return The index (x * SIZE + y) of the cell filled by the last
+ * game_step() that changed the board, or by game_reset().
+ */
+unsigned int game_last_spawn(const Game *game);
+
+/**
+ * @brief Returns the current score of the game.
+ *
+ * The score is kept up to date by game_step(), so this does not walk
+ * the board.
+ *
+ * @param game The game.
+ * @return The score, as calculated by calculate_score()
+ */
+unsigned long game_score(const Game *game);
+
+/**
+ * @brief Returns the standard 2048 score of the game.
+ *
+ * @param game The game.
+ * @return The sum of the values of all tiles created by merges
+ */
+unsigned long game_merge_score(const Game *game);
+
+/**
+ * @brief Returns the largest tile of the game.
+ *
+ * @param game The game.
+ * @return The largest exponent on the board
+ */
+unsigned char game_max_tile(const Game *game);
+
+/**
+ * @brief Checks if there are possible moves left in the game.
+ *
+ * @param game The game.
+ * @return Either 0 or 1
+ */
+bool game_is_over(const Game *game);
+
+/**
+ * @brief Copies the game board out of the game.
+ *
+ * @param game The game.
+ * @param board The game board that is written to.
+ */
+void game_get_board(const Game *game, Board board);
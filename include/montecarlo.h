@@ -0,0 +1,96 @@
+/**
+ * @file montecarlo.h
+ * @author Gnik Droy
+ * @brief File containing function declarations for the Monte Carlo player.
+ *
+ * For every direction that changes the board, the player plays a number
+ * of random games to the end and picks the direction with the best mean
+ * merge score. The rollouts are split into chunks that run on a
+ * work-stealing thread pool.
+ */
+#pragma once
+#include "bitboard.h"
+#include "threadpool.h"
+
+/** @struct MCConfig
+ *  @brief The settings of the Monte Carlo player.
+ *
+ *  @var MCConfig::rollouts
+ *  The number of random games played per direction
+ *  @var MCConfig::chunk
+ *  The number of random games played by a single task
+ *  @var MCConfig::seed
+ *  The seed the rollouts are drawn from. The same seed, board and
+ *  settings always pick the same direction, whatever the thread count.
+ */
+typedef struct
+{
+    unsigned int rollouts;
+    unsigned int chunk;
+    uint64_t seed;
+} MCConfig;
+
+/** @struct MCStats
+ *  @brief Counters collected while playing rollouts.
+ *
+ *  @var MCStats::rollouts
+ *  The number of random games played
+ *  @var MCStats::moves
+ *  The number of moves made in the random games
+ */
+typedef struct
+{
+    unsigned long long rollouts;
+    unsigned long long moves;
+} MCStats;
+
+/** An opaque handle to a Monte Carlo player */
+typedef struct MonteCarlo MonteCarlo;
+
+/**
+ * @brief Fills in the default settings.
+ *
+ * @param config The settings that are written to.
+ */
+void mc_default_config(MCConfig *config);
+
+/**
+ * @brief Creates a Monte Carlo player.
+ *
+ * It also builds the bitboard tables with bitboard_init().
+ *
+ * @param config The settings. NULL uses the defaults.
+ * @param pool The pool the rollouts run on. NULL creates a pool with a
+ * worker per core, owned by the player.
+ * @return The new player or NULL if it couldn't be created.
+ */
+MonteCarlo *mc_create(const MCConfig *config, ThreadPool *pool);
+
+/**
+ * @brief Destroyes a player created by mc_create().
+ *
+ * @param mc The player. May be NULL.
+ */
+void mc_destroy(MonteCarlo *mc);
+
+/**
+ * @brief Picks the direction with the best mean rollout score.
+ *
+ * @param mc The player.
+ * @param board The game board.
+ * @param best The best direction is written here.
+ * @param stats The counters are added here. May be NULL.
+ * @return If any direction changes the board
+ */
+bool mc_best_move(MonteCarlo *mc, const Board board, Direction *best, MCStats *stats);
+
+/**
+ * @brief Same as mc_best_move(), without converting the board.
+ *
+ * @param mc The player.
+ * @param bitboard The packed board.
+ * @param best The best direction is written here.
+ * @param stats The counters are added here. May be NULL.
+ * @return If any direction changes the board
+ */
+bool mc_best_move_bitboard(MonteCarlo *mc, BitBoard bitboard, Direction *best, MCStats *stats);
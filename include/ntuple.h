@@ -0,0 +1,175 @@
+/**
+ * @file ntuple.h
+ * @author Gnik Droy
+ * @brief File containing the API of the n-tuple network evaluator.
+ *
+ * An n-tuple network scores a board as the sum of table lookups. Every
+ * tuple is a set of 4 or 6 cells, and the tiles in those cells index a
+ * table of weights. Each tuple is placed on the board in all 8 of its
+ * symmetric positions, which share one table.
+ *
+ * The weights are learnt with temporal difference learning on the
+ * boards after a move and before the new tile (the afterstates): the
+ * value of an afterstate is moved towards the reward of the next move
+ * plus the value of the next afterstate. Training plays games on a
+ * thread pool. The workers update the shared weights without locks
+ * (Hogwild), a lost update only costs a little learning.
+ */
+#pragma once
+#include "bitboard.h"
+#include "threadpool.h"
+
+/** @def NTUPLE_MAX_CELLS
+ * The largest number of cells in a tuple.
+ */
+#define NTUPLE_MAX_CELLS 6
+
+/** An opaque handle to an n-tuple network */
+typedef struct NTuple NTuple;
+
+/** @struct NTupleStats
+ *  @brief Counters collected while training.
+ *
+ *  @var NTupleStats::games
+ *  The number of games played
+ *  @var NTupleStats::moves
+ *  The number of moves made
+ *  @var NTupleStats::score
+ *  The sum of the merge scores of the games
+ *  @var NTupleStats::max_score
+ *  The largest merge score of a game
+ *  @var NTupleStats::wins
+ *  The number of games that reached a 2048 tile
+ */
+typedef struct
+{
+    unsigned long games;
+    unsigned long long moves;
+    unsigned long long score;
+    unsigned long max_score;
+    unsigned long wins;
+} NTupleStats;
+
+/**
+ * @brief Creates a network with all weights 0.
+ *
+ * The 4 cell network has 5 tuples and 1.25 MiB of weights, the 6 cell
+ * network has 4 tuples and 256 MiB of weights but plays much better.
+ * The weights are only backed by memory once they are written, and
+ * huge pages are requested for them. It also builds the bitboard tables
+ * with bitboard_init().
+ *
+ * @param cells The number of cells per tuple, 4 or 6.
+ * @return The new network or NULL if it couldn't be created.
+ */
+NTuple *ntuple_create(unsigned int cells);
+
+/**
+ * @brief Destroyes a network created by ntuple_create() or ntuple_load().
+ *
+ * @param net The network. May be NULL.
+ */
+void ntuple_destroy(NTuple *net);
+
+/**
+ * @brief Returns the number of cells per tuple.
+ *
+ * @param net The network.
+ * @return 4 or 6
+ */
+unsigned int ntuple_cells(const NTuple *net);
+
+/**
+ * @brief Scores an afterstate.
+ *
+ * @param net The network.
+ * @param bitboard The packed board after a move, before the new tile.
+ * @return The expected merge score of the rest of the game
+ */
+float ntuple_value(const NTuple *net, BitBoard bitboard);
+
+/**
+ * @brief Picks the move with the best reward plus afterstate value.
+ *
+ * @param net The network.
+ * @param bitboard The packed board.
+ * @param best The best direction is written here.
+ * @return If any direction changes the board
+ */
+bool ntuple_best_move(const NTuple *net, BitBoard bitboard, Direction *best);
+
+/**
+ * @brief Trains the network on games of self play.
+ *
+ * Every game is played greedily with ntuple_best_move() and learnt from
+ * as it is played. The call returns once every game is over.
+ *
+ * @param net The network.
+ * @param pool The pool the games run on, one task per worker.
+ * @param games The number of games to play.
+ * @param alpha The learning rate, e.g. 0.1. It is split over the tuples.
+ * @param seed The seed of the games. Game i is seeded with seed + i.
+ * @param stats The counters are added here. May be NULL.
+ */
+void ntuple_train(NTuple *net, ThreadPool *pool, unsigned long games, float alpha, uint64_t seed,
+                  NTupleStats *stats);
+
+/**
+ * @brief Writes the weights to a file.
+ *
+ * The file is a table file, see tablefile.h, with a "NTUPMETA" section
+ * holding the version, the cells per tuple and the number of tuples,
+ * a "NTUPPROG" section holding the training progress, see
+ * ntuple_set_progress(), and a "NTUPWGTS" section holding the weights. It is written to a
+ * temporary name and renamed, so an existing checkpoint is never left
+ * half written.
+ *
+ * @param net The network.
+ * @param path The path of the file.
+ * @return If the file was written.
+ */
+bool ntuple_save(const NTuple *net, const char *path);
+
+/**
+ * @brief Maps a network written by ntuple_save().
+ *
+ * The weights are used in place, so loading takes no time however large
+ * they are, and pages are only read from the file once they are looked
+ * up. Huge pages are requested for them. The checksum is only checked
+ * by ntuple_verify().
+ *
+ * @param path The path of the file.
+ * @return The new network or NULL if the file couldn't be mapped.
+ */
+NTuple *ntuple_load(const char *path);
+
+/**
+ * @brief Records how far training got, so it can be resumed.
+ *
+ * It is written by ntuple_save() and read back by ntuple_load().
+ *
+ * @param net The network.
+ * @param seed The seed of the first game of the training run.
+ * @param games The number of games trained on, seeded from seed on.
+ */
+void ntuple_set_progress(NTuple *net, uint64_t seed, unsigned long games);
+
+/**
+ * @brief Returns how far training got, see ntuple_set_progress().
+ *
+ * @param net The network.
+ * @param seed The seed of the first game is written here. May be NULL.
+ * @return The number of games trained on, 0 for a new network.
+ */
+unsigned long ntuple_progress(const NTuple *net, uint64_t *seed);
+
+/**
+ * @brief Checks the checksum of the weights of a loaded network.
+ *
+ * This reads every page of the weights.
+ *
+ * @param net The network.
+ * @return If the weights match their checksum, always true for a
+ * network from ntuple_create().
+ */
+bool ntuple_verify(NTuple *net);
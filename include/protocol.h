@@ -0,0 +1,109 @@
+/**
+ * @file protocol.h
+ * @author Gnik Droy
+ * @brief File containing the wire format of the game server.
+ *
+ * A client holds one game per connection. Every request is answered with
+ * exactly one response, in order, so requests can be pipelined.
+ *
+ * A request is PROTO_REQUEST_SIZE bytes:
+ * - the operation, 8 bits, see ProtoOp
+ * - the argument, 8 bits: the Direction of a PROTO_MOVE
+ * - an id chosen by the client and echoed in the response, 16 bits
+ *
+ * A response is a PROTO_HEADER_SIZE byte header followed by the changed
+ * cells:
+ * - the status, 8 bits, see ProtoStatus
+ * - the number of changed cells, 8 bits
+ * - the id of the request, 16 bits
+ * - the merge score of the game (see Score::merged), 32 bits, saturated
+ * - one byte per changed cell: the cell index x * SIZE + y in the high
+ *   4 bits and the new exponent in the low 4 bits
+ *
+ * A move sends the cells that changed, including the new tile. A new game
+ * and PROTO_BOARD send every cell that is not empty, as changes from an
+ * empty board. The integers are little endian.
+ */
+#pragma once
+#include <stdint.h>
+#include "core.h"
+
+/** @def PROTO_REQUEST_SIZE
+ * The size of a request in bytes.
+ */
+#define PROTO_REQUEST_SIZE 4
+
+/** @def PROTO_HEADER_SIZE
+ * The size of a response header in bytes.
+ */
+#define PROTO_HEADER_SIZE 8
+
+/** @def PROTO_MAX_RESPONSE
+ * The size of the largest response in bytes.
+ */
+#define PROTO_MAX_RESPONSE (PROTO_HEADER_SIZE + SIZE * SIZE)
+
+_Static_assert(SIZE * SIZE <= 16, "A changed cell packs its index into 4 bits");
+
+/** The operations of a request */
+typedef enum
+{
+    PROTO_NEW,
+    PROTO_MOVE,
+    PROTO_BOARD
+} ProtoOp;
+
+/** The status of a response */
+typedef enum
+{
+    PROTO_OK,
+    PROTO_UNCHANGED,
+    PROTO_OVER,
+    PROTO_ERROR
+} ProtoStatus;
+
+/** @struct ProtoResponse
+ *  @brief A decoded response header.
+ *
+ *  @var ProtoResponse::status
+ *  The ProtoStatus
+ *  @var ProtoResponse::count
+ *  The number of changed cells following the header
+ *  @var ProtoResponse::id
+ *  The id of the request
+ *  @var ProtoResponse::score
+ *  The merge score of the game
+ */
+typedef struct
+{
+    uint8_t status;
+    uint8_t count;
+    uint16_t id;
+    uint32_t score;
+} ProtoResponse;
+
+static inline void proto_write_request(uint8_t *out, ProtoOp op, uint8_t arg, uint16_t id)
+{
+    out[0] = (uint8_t)op;
+    out[1] = arg;
+    out[2] = (uint8_t)id;
+    out[3] = (uint8_t)(id >> 8);
+}
+
+static inline void proto_write_header(uint8_t *out, const ProtoResponse *response)
+{
+    out[0] = response->status;
+    out[1] = response->count;
+    out[2] = (uint8_t)response->id;
+    out[3] = (uint8_t)(response->id >> 8);
+    for (unsigned int i = 0; i < 4; i++)
+        out[4 + i] = (uint8_t)(response->score >> (8 * i));
+}
+
+static inline void proto_read_header(const uint8_t *in, ProtoResponse *response)
+{
+    response->status = in[0];
+    response->count = in[1];
+    response->id = (uint16_t)(in[2] | in[3] << 8);
+    response->score = (uint32_t)in[4] | (uint32_t)in[5] << 8 | (uint32_t)in[6] << 16 | (uint32_t)in[7] << 24;
+}
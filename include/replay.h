@@ -0,0 +1,236 @@
+/**
+ * @file replay.h
+ * @author Gnik Droy
+ * @brief File containing the API for recording and reading replays.
+ *
+ * A replay file starts with a 16 byte header and is followed by chunks,
+ * so games can be appended to it at any time. Every chunk is a four
+ * character tag, its length as a 32 bit integer and its payload. Readers
+ * skip tags they do not know. All integers are little endian.
+ *
+ * A "GAME" chunk holds a single game:
+ * - the seed the game was started with, 64 bits
+ * - the number of moves, 32 bits
+ * - the directions, 2 bits per move, four moves per byte from the low bits
+ * - the cells of the new tiles, one more than moves since the first tile
+ *   is placed before any move. They take 4 bits each when the board has
+ *   at most 16 cells, else 8 bits.
+ *
+ * Only moves that changed the board are recorded, so every move has a
+ * new tile.
+ *
+ * A "KEYS" chunk may follow a game chunk, holding keyframes to seek in
+ * long games:
+ * - the number of moves between keyframes, 32 bits
+ * - the number of keyframes, 32 bits
+ * - for each keyframe k, counting from 1, the board after move
+ *   k * interval as a byte per cell, followed by the merge score so far,
+ *   64 bits
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "core.h"
+
+/** @def REPLAY_VERSION
+ * The version written to the file header.
+ */
+#define REPLAY_VERSION 1
+
+/** An opaque handle to a replay writer */
+typedef struct ReplayWriter ReplayWriter;
+
+/** An opaque handle to a replay reader */
+typedef struct ReplayReader ReplayReader;
+
+/** @struct ReplayGame
+ *  @brief A recorded game, pointing into the mapped file.
+ *
+ *  @var ReplayGame::seed
+ *  The seed the game was started with
+ *  @var ReplayGame::moves
+ *  The number of moves
+ *  @var ReplayGame::directions
+ *  The packed directions
+ *  @var ReplayGame::spawns
+ *  The packed cells of the new tiles
+ *  @var ReplayGame::spawn_bits
+ *  The bits per cell in ReplayGame::spawns, 4 or 8
+ *  @var ReplayGame::keyframes
+ *  The packed keyframes, or NULL
+ *  @var ReplayGame::keyframe_count
+ *  The number of keyframes
+ *  @var ReplayGame::keyframe_interval
+ *  The number of moves between keyframes
+ */
+typedef struct
+{
+    uint64_t seed;
+    uint32_t moves;
+    const uint8_t *directions;
+    const uint8_t *spawns;
+    unsigned int spawn_bits;
+    const uint8_t *keyframes;
+    uint32_t keyframe_count;
+    uint32_t keyframe_interval;
+} ReplayGame;
+
+/**
+ * @brief Opens a replay file for appending.
+ *
+ * The header is written if the file is new or empty. A chunk cut short
+ * at the end of the file, e.g. by a crash while writing, is removed, so
+ * the new games follow the last complete chunk.
+ *
+ * @param path The path of the file.
+ * @return The new writer or NULL if the file couldn't be opened.
+ */
+ReplayWriter *replay_writer_open(const char *path);
+
+/**
+ * @brief Writes the buffered games and closes the file.
+ *
+ * A game that was begun but not ended is dropped.
+ *
+ * @param writer The writer. May be NULL.
+ * @return If every game was written.
+ */
+bool replay_writer_close(ReplayWriter *writer);
+
+/**
+ * @brief Sets how often keyframes are taken.
+ *
+ * The writer replays every recorded move with move_tiles() to take the
+ * keyframes, so they cost a move each. Applies from the next game on.
+ *
+ * @param writer The writer.
+ * @param interval The number of moves between keyframes, or 0 for none.
+ */
+void replay_set_keyframes(ReplayWriter *writer, uint32_t interval);
+
+/**
+ * @brief Starts recording a game.
+ *
+ * A game that was begun but not ended is dropped.
+ *
+ * @param writer The writer.
+ * @param seed The seed of the game.
+ * @param spawn The cell of the first tile, as returned by add_random().
+ */
+void replay_begin(ReplayWriter *writer, uint64_t seed, unsigned int spawn);
+
+/**
+ * @brief Records a move that changed the board.
+ *
+ * @param writer The writer.
+ * @param dir The direction of the move.
+ * @param spawn The cell of the new tile, as returned by move_with_spawn().
+ * @return If the move was recorded. False if allocation failed, the
+ * game is then dropped and replay_end() returns false.
+ */
+bool replay_move(ReplayWriter *writer, Direction dir, unsigned int spawn);
+
+/**
+ * @brief Finishes the game and queues it as a chunk.
+ *
+ * The chunk is buffered and written to the file once the buffer fills.
+ *
+ * @param writer The writer.
+ * @return If the game was buffered or written.
+ */
+bool replay_end(ReplayWriter *writer);
+
+/**
+ * @brief Writes the buffered games to the file.
+ *
+ * @param writer The writer.
+ * @return If every game was written.
+ */
+bool replay_flush(ReplayWriter *writer);
+
+/**
+ * @brief Maps a replay file for reading.
+ *
+ * Files with another board size or a newer version are rejected.
+ *
+ * @param path The path of the file.
+ * @return The new reader or NULL if the file couldn't be read.
+ */
+ReplayReader *replay_reader_open(const char *path);
+
+/**
+ * @brief Unmaps the file.
+ *
+ * The games returned by the reader become invalid.
+ *
+ * @param reader The reader. May be NULL.
+ */
+void replay_reader_close(ReplayReader *reader);
+
+/**
+ * @brief Reads the next game of the file.
+ *
+ * Nothing is allocated or copied, the game points into the mapping.
+ * A chunk cut short by a crash while writing ends the file.
+ *
+ * @param reader The reader.
+ * @param game The game that is written to.
+ * @return If there was another game.
+ */
+bool replay_reader_next(ReplayReader *reader, ReplayGame *game);
+
+/**
+ * @brief Returns a direction of a recorded game.
+ *
+ * @param game The game.
+ * @param move The index of the move, below ReplayGame::moves.
+ * @return The direction of the move.
+ */
+static inline Direction replay_direction(const ReplayGame *game, uint32_t move)
+{
+    return (Direction)((game->directions[move / 4] >> (2 * (move % 4))) & 3);
+}
+
+/**
+ * @brief Returns the cell of a new tile of a recorded game.
+ *
+ * @param game The game.
+ * @param index 0 for the first tile, i for the tile after move i - 1.
+ * @return The index (x * SIZE + y) of the cell.
+ */
+static inline unsigned int replay_spawn(const ReplayGame *game, uint32_t index)
+{
+    if (game->spawn_bits == 8)
+        return game->spawns[index];
+    return (game->spawns[index / 2] >> (4 * (index % 2))) & 0xF;
+}
+
+/**
+ * @brief Plays the recorded moves on a board.
+ *
+ * It uses move_tiles() and places the recorded tiles, so no random
+ * number generator is needed.
+ *
+ * @param game The game.
+ * @param moves The number of moves to play. More than ReplayGame::moves
+ * plays the whole game.
+ * @param board The game board that is written to.
+ * @param score The score of the game is written here. May be NULL.
+ */
+void replay_play(const ReplayGame *game, uint32_t moves, Board board, Score *score);
+
+/**
+ * @brief Jumps to a move of a recorded game.
+ *
+ * Starts at the last keyframe before the move and plays the moves after
+ * it, so at most ReplayGame::keyframe_interval moves are played. Without
+ * keyframes it is the same as replay_play().
+ *
+ * @param game The game.
+ * @param move The number of moves to be played on the board. More than
+ * ReplayGame::moves jumps to the end.
+ * @param board The game board that is written to.
+ * @param score The score of the game is written here. May be NULL.
+ * @return The number of moves that were played after the keyframe
+ */
+uint32_t replay_seek(const ReplayGame *game, uint32_t move, Board board, Score *score);
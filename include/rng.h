@@ -0,0 +1,72 @@
+/**
+ * @file rng.h
+ * @author Gnik Droy
+ * @brief File containing the per-game random number generator.
+ *
+ * The generator is xoshiro256**, seeded through splitmix64. Every game
+ * owns its state, so games can be replayed from their seed and played
+ * on many threads without sharing anything.
+ */
+#pragma once
+#include <stdint.h>
+
+/** @struct Rng
+ *  @brief The state of a random number generator.
+ *
+ *  @var Rng::s
+ *  The xoshiro256** state. Never all zero.
+ */
+typedef struct
+{
+    uint64_t s[4];
+} Rng;
+
+/**
+ * @brief Seeds the random number generator.
+ *
+ * The same seed always produces the same sequence.
+ *
+ * @param rng The generator.
+ * @param seed Any 64 bit value.
+ */
+void rng_seed(Rng *rng, uint64_t seed);
+
+static inline uint64_t rng_rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+/**
+ * @brief Returns the next 64 random bits.
+ *
+ * @param rng The generator.
+ * @return A uniformly distributed 64 bit value.
+ */
+static inline uint64_t rng_next(Rng *rng)
+{
+    uint64_t *s = rng->s;
+    uint64_t result = rng_rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rng_rotl(s[3], 45);
+    return result;
+}
+
+/**
+ * @brief Returns a random integer below the bound.
+ *
+ * Uses a multiply and shift instead of a modulo. The bias is at most
+ * bound / 2^32, which is negligible for the small bounds of the game.
+ *
+ * @param rng The generator.
+ * @param bound The exclusive upper bound. Must be at least 1.
+ * @return A value in [0, bound).
+ */
+static inline uint32_t rng_bounded(Rng *rng, uint32_t bound)
+{
+    return (uint32_t)(((rng_next(rng) >> 32) * bound) >> 32);
+}
@@ -0,0 +1,145 @@
+/**
+ * @file sized.h
+ * @author Gnik Droy
+ * @brief File containing the API for playing on boards of any size.
+ *
+ * The core game is built for the single board size SIZE. The functions
+ * here take the size at runtime instead, so one binary plays every
+ * variant. A board is a flat array of size * size exponents, cell
+ * (x, y) at index x * size + y, the same layout as a Board.
+ *
+ * Every size from SIZED_MIN to SIZED_UNROLLED has its own kernels,
+ * generated from one body with the size as a constant, so the compiler
+ * unrolls their loops. Larger sizes up to SIZED_MAX share kernels that
+ * walk the board row by row. sized_ops() returns the kernels of a size
+ * once, so picking them costs nothing per move.
+ */
+#pragma once
+#include "core.h"
+
+/** @def SIZED_MIN
+ * The smallest supported board size.
+ */
+#define SIZED_MIN 3
+
+/** @def SIZED_UNROLLED
+ * The largest board size with its own kernels. Its cells fit in a 64
+ * bit mask.
+ */
+#define SIZED_UNROLLED 8
+
+/** @def SIZED_MAX
+ * The largest supported board size.
+ */
+#define SIZED_MAX 16
+
+/** @struct SizedOps
+ *  @brief The kernels of a board size.
+ *
+ *  Every kernel gets the size as its first argument. The unrolled
+ *  kernels ignore it.
+ *
+ *  @var SizedOps::size
+ *  The board size
+ *  @var SizedOps::kernel
+ *  The name of the kernels, "unrolled" or "generic"
+ *  @var SizedOps::move
+ *  Same as move_tiles()
+ *  @var SizedOps::add_random
+ *  Same as add_random()
+ *  @var SizedOps::is_game_over
+ *  Same as is_game_over()
+ */
+typedef struct
+{
+    unsigned int size;
+    const char *kernel;
+    bool (*move)(unsigned int size, unsigned char *cells, Direction dir, Score *score);
+    unsigned int (*add_random)(unsigned int size, unsigned char *cells, Rng *rng);
+    bool (*is_game_over)(unsigned int size, const unsigned char *cells);
+} SizedOps;
+
+/**
+ * @brief Returns the kernels of a board size.
+ *
+ * @param size The board size.
+ * @return The kernels, or NULL if the size is not supported.
+ */
+const SizedOps *sized_ops(unsigned int size);
+
+/**
+ * @brief Moves the tiles without adding a tile.
+ *
+ * @param ops The kernels of the board size.
+ * @param cells The board.
+ * @param dir The direction of the move.
+ * @param score The score of the game. May be NULL.
+ * @return If the board changed
+ */
+static inline bool sized_move(const SizedOps *ops, unsigned char *cells, Direction dir, Score *score)
+{
+    return ops->move(ops->size, cells, dir, score);
+}
+
+/**
+ * @brief Adds a 1 to a random empty cell.
+ *
+ * @param ops The kernels of the board size.
+ * @param cells The board.
+ * @param rng The random number generator of the game.
+ * @return The index of the filled cell, or size * size if the board is full.
+ */
+static inline unsigned int sized_add_random(const SizedOps *ops, unsigned char *cells, Rng *rng)
+{
+    return ops->add_random(ops->size, cells, rng);
+}
+
+/**
+ * @brief Checks if there are possible moves left on the board.
+ *
+ * @param ops The kernels of the board size.
+ * @param cells The board.
+ * @return If no move changes the board
+ */
+static inline bool sized_is_game_over(const SizedOps *ops, const unsigned char *cells)
+{
+    return ops->is_game_over(ops->size, cells);
+}
+
+/**
+ * @brief Same as move_with_spawn().
+ *
+ * @param ops The kernels of the board size.
+ * @param cells The board.
+ * @param dir The direction of the move.
+ * @param rng The random number generator of the game.
+ * @param score The score of the game. May be NULL.
+ * @return The index of the added tile, or -1 if the board did not change
+ */
+int sized_move_with_spawn(const SizedOps *ops, unsigned char *cells, Direction dir, Rng *rng, Score *score);
+
+/**
+ * @brief Empties the board.
+ *
+ * @param ops The kernels of the board size.
+ * @param cells The board.
+ */
+void sized_clear(const SizedOps *ops, unsigned char *cells);
+
+/**
+ * @brief Same as score_reset().
+ *
+ * @param ops The kernels of the board size.
+ * @param cells The board.
+ * @param score The score that is written to.
+ */
+void sized_score_reset(const SizedOps *ops, const unsigned char *cells, Score *score);
+
+/**
+ * @brief Same as print_board().
+ *
+ * @param ops The kernels of the board size.
+ * @param cells The board.
+ * @param stream The file stream to use.
+ */
+void sized_print(const SizedOps *ops, const unsigned char *cells, FILE *stream);
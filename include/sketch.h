@@ -0,0 +1,81 @@
+/**
+ * @file sketch.h
+ * @author Gnik Droy
+ * @brief File containing the API of the mergeable quantile sketch.
+ *
+ * A sketch counts values in logarithmic buckets: bucket i holds the
+ * values in (gamma^(i-1), gamma^i] with gamma = (1 + a) / (1 - a) for the
+ * relative accuracy a. Any quantile is then known within a of its true
+ * value, however many values were added. Sketches of the same accuracy
+ * are merged by adding their buckets, so every thread can fill its own
+ * and they are combined at the end.
+ *
+ * A sketch has a fixed size and holds no pointers, so it can be copied
+ * or written to a file as it is.
+ */
+#pragma once
+#include <stdint.h>
+
+/** @def SKETCH_ACCURACY
+ * The relative accuracy of the quantiles.
+ */
+#define SKETCH_ACCURACY 0.01
+
+/** @def SKETCH_BUCKETS
+ * The number of buckets. Values up to about 8e8 get their own bucket,
+ * larger ones share the last.
+ */
+#define SKETCH_BUCKETS 1024
+
+/** @struct Sketch
+ *  @brief The buckets of a sketch.
+ *
+ *  @var Sketch::count
+ *  The number of values added
+ *  @var Sketch::min
+ *  The smallest value added
+ *  @var Sketch::max
+ *  The largest value added
+ *  @var Sketch::buckets
+ *  The number of values in each bucket
+ */
+typedef struct
+{
+    uint64_t count;
+    double min;
+    double max;
+    uint64_t buckets[SKETCH_BUCKETS];
+} Sketch;
+
+/**
+ * @brief Empties a sketch.
+ *
+ * @param sketch The sketch.
+ */
+void sketch_clear(Sketch *sketch);
+
+/**
+ * @brief Adds a value.
+ *
+ * @param sketch The sketch.
+ * @param value The value. Values up to 1 are counted as 1.
+ */
+void sketch_add(Sketch *sketch, double value);
+
+/**
+ * @brief Adds the values of one sketch to another.
+ *
+ * @param sketch The sketch that is added to.
+ * @param other The sketch whose values are added.
+ */
+void sketch_merge(Sketch *sketch, const Sketch *other);
+
+/**
+ * @brief Estimates a quantile.
+ *
+ * @param sketch The sketch.
+ * @param q The quantile from 0 to 1, e.g. 0.99.
+ * @return The value within SKETCH_ACCURACY of the quantile, or 0 if the
+ * sketch is empty
+ */
+double sketch_quantile(const Sketch *sketch, double q);
@@ -59,6 +59,80 @@
  */
 #define CELL_FONT_SIZE 40
 
+/** @def TEXT_CACHE_SIZE
+ * The number of rasterized strings kept by the text cache.
+ */
+#define TEXT_CACHE_SIZE 64
+
+/** @def TEXT_CACHE_MAX_LEN
+ * Strings of this length or longer are rasterized without the cache.
+ */
+#define TEXT_CACHE_MAX_LEN 32
+
+//Animation settings
+
+/** @def FRAME_RATE
+ * The frames per second drawn while an animation is running.
+ * The game only redraws on input when nothing is animating.
+ */
+#define FRAME_RATE 60
+
+/** @def SPAWN_ANIMATION_MS
+ * The time in milliseconds a new tile takes to grow to full size.
+ */
+#define SPAWN_ANIMATION_MS 120
+
+/** @def SPLASH_MS
+ * The time in milliseconds "2048" is shown at the start of game.
+ * Any key press skips it.
+ */
+#define SPLASH_MS 1000
+
+/** @def GOVER_MS
+ * The time in milliseconds "Game Over" is shown at the end of game.
+ * Any key press skips it.
+ */
+#define GOVER_MS 1000
+
+/** @def IDLE_CPU_TARGET
+ * The highest acceptable CPU usage of the main thread in percent while
+ * the game is idle.
+ * Reported with the --stats option.
+ */
+#define IDLE_CPU_TARGET 1.0
+
+//Hint settings
+
+/** @def HINT_BUDGET_MS
+ * The time in milliseconds the hint worker searches a board for.
+ * The search goes one move deeper at a time until this runs out.
+ */
+#define HINT_BUDGET_MS 500
+
+/** @def HINT_MAX_DEPTH
+ * The deepest search of the hint worker, in moves.
+ */
+#define HINT_MAX_DEPTH 6
+
+/** @def HINT_ARROW_SIZE
+ * The length in pixels of the hint arrow drawn over the board.
+ */
+#define HINT_ARROW_SIZE 160
+
+//Profiling settings
+
+/** @def PROFILE_BUCKETS
+ * The number of buckets of a timing histogram. Bucket i counts the
+ * calls that took less than 2^i microseconds, the last one every
+ * slower call.
+ */
+#define PROFILE_BUCKETS 24
+
+/** @def HUD_FONT_SIZE
+ * The font size of the frame statistics shown with F1.
+ */
+#define HUD_FONT_SIZE 14
+
 //Music Files
 /** @def MIX_MUSIC_PATH
  * The path to the sound that plays when tiles combine or appear.
@@ -92,6 +166,9 @@ struct COLOR g_button_bg = {255, 153, 102, 255};
 /** The background color used by the score field  */
 struct COLOR g_score_bg = {143, 122, 102, 255};
 
+/** The color of the hint arrow, drawn blended over the board  */
+struct COLOR g_hint_fg = {80, 80, 80, 140};
+
 /** The colors used by the tiles
  *  They are according to exponent.
  *  Example: exponent of 1 will use g_COLORS[1]
@@ -0,0 +1,83 @@
+/**
+ * @file symmetry.h
+ * @author Gnik Droy
+ * @brief File containing function declarations for the board symmetries.
+ *
+ * The game rules do not change when the board is rotated or mirrored,
+ * so the 8 symmetries of the square map a position to 8 equivalent ones.
+ * A cache that stores only the canonical board, the smallest of the 8,
+ * holds 8 times as many distinct positions.
+ *
+ * Symmetry s is applied in three steps: mirror every row if bit 0 is
+ * set, reverse the order of the rows if bit 1 is set, and transpose if
+ * bit 2 is set. Symmetry 0 is the identity.
+ */
+#pragma once
+#include "bitboard.h"
+
+/** @def SYMMETRY_COUNT
+ * The number of symmetries of the square board.
+ */
+#define SYMMETRY_COUNT 8
+
+/**
+ * @brief Mirrors every row of the bitboard.
+ *
+ * Swaps board[x][y] with board[x][SIZE - 1 - y] for every cell.
+ *
+ * @param bitboard The packed board.
+ * @return The mirrored board.
+ */
+BitBoard bitboard_mirror_rows(BitBoard bitboard);
+
+/**
+ * @brief Reverses the order of the rows of the bitboard.
+ *
+ * Swaps board[x][y] with board[SIZE - 1 - x][y] for every cell.
+ *
+ * @param bitboard The packed board.
+ * @return The flipped board.
+ */
+BitBoard bitboard_flip_rows(BitBoard bitboard);
+
+/**
+ * @brief Applies a symmetry to the bitboard.
+ *
+ * @param bitboard The packed board.
+ * @param symmetry The symmetry, below SYMMETRY_COUNT.
+ * @return The transformed board.
+ */
+BitBoard bitboard_symmetry(BitBoard bitboard, unsigned int symmetry);
+
+/**
+ * @brief Returns the symmetry that undoes another one.
+ *
+ * @param symmetry The symmetry, below SYMMETRY_COUNT.
+ * @return The inverse symmetry.
+ */
+unsigned int symmetry_inverse(unsigned int symmetry);
+
+/**
+ * @brief Maps a direction through a symmetry.
+ *
+ * Moving the transformed board in the mapped direction gives the
+ * transformed result of moving the board in the direction.
+ *
+ * @param symmetry The symmetry, below SYMMETRY_COUNT.
+ * @param dir The direction on the original board.
+ * @return The direction on the transformed board.
+ */
+Direction symmetry_direction(unsigned int symmetry, Direction dir);
+
+/**
+ * @brief Returns the smallest of the 8 symmetric boards.
+ *
+ * All 8 boards are built with 3 mirrors and 4 transposes, without
+ * branches or table lookups.
+ *
+ * @param bitboard The packed board.
+ * @param symmetry The symmetry that maps the board to the canonical
+ * one is written here. May be NULL.
+ * @return The canonical board.
+ */
+BitBoard bitboard_canonical(BitBoard bitboard, unsigned int *symmetry);
@@ -0,0 +1,139 @@
+/**
+ * @file tablefile.h
+ * @author Gnik Droy
+ * @brief File containing the API for memory mapped table files.
+ *
+ * A table file holds named sections of precomputed data, e.g. the
+ * weights of an n-tuple network, laid out so the file can be mapped and
+ * used in place without parsing or copying.
+ *
+ * The file starts with a 64 byte header:
+ * - "2048TBLS"
+ * - the version, 32 bits
+ * - the number of sections, 32 bits
+ * - the size of the file, 64 bits
+ * - 0x01020304 in the byte order of the writer, 32 bits. Files of
+ *   another byte order are rejected.
+ *
+ * A 40 byte entry per section follows: an 8 byte tag, the offset, the
+ * size and the checksum of the data, 64 bits each, and 64 reserved bits.
+ * The integers of the header and the entries are little endian, the data
+ * is stored as it was in memory.
+ *
+ * Every section starts at a multiple of TABLEFILE_ALIGN, or of
+ * TABLEFILE_HUGE_ALIGN if it is at least that large, so it can be backed
+ * by huge pages.
+ */
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** @def TABLEFILE_VERSION
+ * The version written to the file header.
+ */
+#define TABLEFILE_VERSION 1
+
+/** @def TABLEFILE_ALIGN
+ * The alignment of a section in the file.
+ */
+#define TABLEFILE_ALIGN 4096
+
+/** @def TABLEFILE_HUGE_ALIGN
+ * The alignment of a section at least this large, the size of a huge page.
+ */
+#define TABLEFILE_HUGE_ALIGN (2 * 1024 * 1024)
+
+/** @def TABLEFILE_TAG_SIZE
+ * The size of a section tag.
+ */
+#define TABLEFILE_TAG_SIZE 8
+
+/** An opaque handle to a mapped table file */
+typedef struct TableFile TableFile;
+
+/** @struct TableSection
+ *  @brief A section to be written by tablefile_write().
+ *
+ *  @var TableSection::tag
+ *  The name of the section, padded with zeros
+ *  @var TableSection::data
+ *  The data of the section
+ *  @var TableSection::size
+ *  The size of the data in bytes
+ */
+typedef struct
+{
+    char tag[TABLEFILE_TAG_SIZE];
+    const void *data;
+    size_t size;
+} TableSection;
+
+/** The result of checking the checksums of a table file */
+typedef enum
+{
+    TABLEFILE_PENDING,
+    TABLEFILE_VALID,
+    TABLEFILE_CORRUPT
+} TableFileStatus;
+
+/**
+ * @brief Writes a table file.
+ *
+ * The file is written to a temporary name and renamed, so an existing
+ * file is never left half written.
+ *
+ * @param path The path of the file.
+ * @param sections The sections.
+ * @param count The number of sections.
+ * @return If the file was written.
+ */
+bool tablefile_write(const char *path, const TableSection *sections, unsigned int count);
+
+/**
+ * @brief Maps a table file.
+ *
+ * Only the header is read, so the sections can be used right away. The
+ * checksums are not checked until tablefile_status() is called. The
+ * mapping is private: writes to a section change the memory of the
+ * process, not the file. Wait for the check before writing to a
+ * section.
+ *
+ * @param path The path of the file.
+ * @param huge_pages If the sections should be backed by huge pages
+ * where the kernel supports it for files. It is only a hint.
+ * @return The mapped file or NULL if it couldn't be mapped or its
+ * header is invalid.
+ */
+TableFile *tablefile_open(const char *path, bool huge_pages);
+
+/**
+ * @brief Waits for the checksums and unmaps the file.
+ *
+ * The sections become invalid.
+ *
+ * @param file The mapped file. May be NULL.
+ */
+void tablefile_close(TableFile *file);
+
+/**
+ * @brief Returns a section of the file.
+ *
+ * @param file The mapped file.
+ * @param tag The name of the section.
+ * @param size The size of the section is written here. May be NULL.
+ * @return The data of the section, or NULL if there is none with the tag.
+ */
+void *tablefile_section(TableFile *file, const char *tag, size_t *size);
+
+/**
+ * @brief Returns the result of checking the checksums.
+ *
+ * The first call starts the check, which reads the whole file. Without
+ * waiting it runs on a background thread.
+ *
+ * @param file The mapped file.
+ * @param wait If the call should wait for the check to finish.
+ * @return The result, only TABLEFILE_PENDING if not waiting.
+ */
+TableFileStatus tablefile_status(TableFile *file, bool wait);
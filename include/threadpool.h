@@ -0,0 +1,68 @@
+/**
+ * @file threadpool.h
+ * @author Gnik Droy
+ * @brief File containing the API of the work-stealing thread pool.
+ *
+ * Every worker owns a deque of tasks. Tasks submitted from outside the
+ * pool are dealt round robin to the workers, tasks submitted by a worker
+ * go to its own deque. A worker runs its newest task first and, once its
+ * deque is empty, steals the oldest task of another worker.
+ */
+#pragma once
+#include <stdbool.h>
+
+/** An opaque handle to a thread pool */
+typedef struct ThreadPool ThreadPool;
+
+/**
+ * @brief A task run by the pool.
+ *
+ * @param arg The argument given to threadpool_submit().
+ * @param worker The index of the worker running the task, below
+ * threadpool_size(). Use it to index per-worker scratch space.
+ */
+typedef void (*Task)(void *arg, unsigned int worker);
+
+/**
+ * @brief Creates a thread pool and starts its workers.
+ *
+ * @param workers The number of worker threads. 0 starts one per online core.
+ * @return The new pool or NULL if it couldn't be created.
+ */
+ThreadPool *threadpool_create(unsigned int workers);
+
+/**
+ * @brief Waits for the queued tasks and stops the workers.
+ *
+ * @param pool The pool. May be NULL.
+ */
+void threadpool_destroy(ThreadPool *pool);
+
+/**
+ * @brief Returns the number of workers of the pool.
+ *
+ * @param pool The pool.
+ * @return The number of workers.
+ */
+unsigned int threadpool_size(const ThreadPool *pool);
+
+/**
+ * @brief Queues a task.
+ *
+ * It can be called from any thread, including from a running task.
+ *
+ * @param pool The pool.
+ * @param task The task.
+ * @param arg The argument passed to the task.
+ * @return If the task was queued. False if allocation failed.
+ */
+bool threadpool_submit(ThreadPool *pool, Task task, void *arg);
+
+/**
+ * @brief Waits until every queued task has finished.
+ *
+ * It must not be called from a task.
+ *
+ * @param pool The pool.
+ */
+void threadpool_wait(ThreadPool *pool);
@@ -0,0 +1,65 @@
+/**
+ * @file zobrist.h
+ * @author Gnik Droy
+ * @brief File containing function declarations for Zobrist hashing.
+ *
+ * The hash of a bitboard is the xor of a random key for every cell and
+ * the tile it holds. Empty cells have the key 0. A move or a new tile
+ * only changes a few cells, so the hash is updated by xoring out the
+ * old tiles and xoring in the new ones instead of hashing every cell.
+ */
+#pragma once
+#include "bitboard.h"
+
+/** The number of tiles a nibble can hold */
+#define ZOBRIST_TILES (BITBOARD_MAX_TILE + 1)
+
+/**
+ * @brief Builds the key table.
+ *
+ * The keys are drawn from a fixed seed, so hashes are the same in
+ * every run. It is safe to call this more than once and from several
+ * threads at once. The keys are drawn by the first call, the others
+ * return once they are ready.
+ */
+void zobrist_init(void);
+
+/**
+ * @brief Returns the key of a tile in a cell.
+ *
+ * @param cell The index (x * SIZE + y) of the cell.
+ * @param tile The exponent of the tile, 0 for an empty cell.
+ * @return The key
+ */
+uint64_t zobrist_key(unsigned int cell, unsigned int tile);
+
+/**
+ * @brief Hashes every cell of the bitboard.
+ *
+ * @param bitboard The packed board.
+ * @return The hash
+ */
+uint64_t zobrist_hash(BitBoard bitboard);
+
+/**
+ * @brief Updates a hash after the bitboard changed.
+ *
+ * Only the cells that differ are visited, e.g. the tiles a move slid or
+ * merged, or the cell of a new tile.
+ *
+ * @param hash The hash of the board before.
+ * @param before The packed board before.
+ * @param after The packed board after.
+ * @return The hash of the board after
+ */
+uint64_t zobrist_update(uint64_t hash, BitBoard before, BitBoard after);
+
+/**
+ * @brief Updates a hash for a new tile in an empty cell.
+ *
+ * @param hash The hash of the board before.
+ * @param cell The index (x * SIZE + y) of the cell.
+ * @param tile The exponent of the new tile.
+ * @return The hash of the board after
+ */
+uint64_t zobrist_add_tile(uint64_t hash, unsigned int cell, unsigned int tile);
@@ -0,0 +1,455 @@
+/**
+ * @file ai.c
+ * @author Gnik Droy
+ * @brief File containing implementation of the expectimax solver.
+ *
+ */
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+#include "ai.h"
+#include "symmetry.h"
+
+/** The number of distinct 16 bit rows */
+#define ROW_COUNT 65536
+
+//Heuristic weights. A lost board scores 0, everything else is offset by
+//SCORE_LOST_PENALTY so it always ranks above a lost board.
+#define SCORE_LOST_PENALTY 200000.0f
+#define SCORE_MONOTONICITY_POWER 4.0f
+#define SCORE_MONOTONICITY_WEIGHT 47.0f
+#define SCORE_SUM_POWER 3.5f
+#define SCORE_SUM_WEIGHT 11.0f
+#define SCORE_MERGES_WEIGHT 700.0f
+#define SCORE_EMPTY_WEIGHT 270.0f
+
+/** @struct Entry
+ *  @brief A transposition table entry for a chance node.
+ *
+ *  @var Entry::board
+ *  The board of the chance node
+ *  @var Entry::value
+ *  The expected score of the board
+ *  @var Entry::depth
+ *  The remaining depth the value was searched with
+ *  @var Entry::generation
+ *  The search the entry was stored by. Older entries are ignored.
+ */
+struct Entry
+{
+	BitBoard board;
+	float value;
+	uint16_t depth;
+	uint16_t generation;
+};
+
+/** @struct AI
+ *  @brief The solver and its transposition table.
+ *
+ *  @var AI::config
+ *  The search settings
+ *  @var AI::table
+ *  The transposition table
+ *  @var AI::mask
+ *  The mask used to index the table
+ *  @var AI::generation
+ *  The current search, bumped instead of clearing the table
+ *  @var AI::abort
+ *  Asked every AI_ABORT_INTERVAL nodes if the search should stop, or NULL
+ *  @var AI::abort_arg
+ *  The argument of AI::abort
+ *  @var AI::aborted
+ *  If the last search was stopped
+ *  @var AI::deadline
+ *  The monotonic time in nanoseconds a timed search stops at, 0 for none
+ *  @var AI::progress
+ *  Told about every finished depth of a timed search, or NULL
+ *  @var AI::progress_arg
+ *  The argument of AI::progress
+ */
+struct AI
+{
+	AIConfig config;
+	struct Entry *table;
+	uint64_t mask;
+	uint16_t generation;
+	AIAbort abort;
+	void *abort_arg;
+	bool aborted;
+	uint64_t deadline;
+	AIProgress progress;
+	void *progress_arg;
+};
+
+/** @struct Search
+ *  @brief The state of a single search.
+ *
+ *  @var Search::aborted
+ *  Set once AI::abort asked to stop. Every node returns at once then.
+ */
+struct Search
+{
+	AI *ai;
+	AIStats stats;
+	bool aborted;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/** Checks the deadline and asks AI::abort. */
+static bool should_stop(const AI *ai)
+{
+	return (ai->deadline != 0 && now_ns() >= ai->deadline) ||
+		   (ai->abort != NULL && ai->abort(ai->abort_arg));
+}
+
+/** Counts a node and checks every AI_ABORT_INTERVAL nodes if the search should stop. */
+static inline bool visit(struct Search *search)
+{
+	if ((++search->stats.nodes & (AI_ABORT_INTERVAL - 1)) == 0 && should_stop(search->ai))
+		search->aborted = true;
+	return !search->aborted;
+}
+
+/** The heuristic score of every possible row */
+static float g_row_score[ROW_COUNT];
+
+/** Builds the heuristic table exactly once, see init_scores() */
+static pthread_once_t g_scores_once = PTHREAD_ONCE_INIT;
+
+static void build_scores(void)
+{
+	for (unsigned int row = 0; row < ROW_COUNT; row++)
+	{
+		unsigned int line[SIZE];
+		for (unsigned int y = 0; y < SIZE; y++)
+			line[y] = (row >> (4 * y)) & 0xF;
+
+		float sum = 0;
+		unsigned int empty = 0, merges = 0, counter = 0, prev = 0;
+		for (unsigned int y = 0; y < SIZE; y++)
+		{
+			sum += powf(line[y], SCORE_SUM_POWER);
+			if (line[y] == 0)
+			{
+				empty++;
+				continue;
+			}
+			if (prev == line[y])
+			{
+				counter++;
+			}
+			else if (counter > 0)
+			{
+				merges += 1 + counter;
+				counter = 0;
+			}
+			prev = line[y];
+		}
+		if (counter > 0)
+			merges += 1 + counter;
+
+		//Penalize rows that are not monotonic, in either direction
+		float monotonicity_left = 0, monotonicity_right = 0;
+		for (unsigned int y = 1; y < SIZE; y++)
+		{
+			float a = powf(line[y - 1], SCORE_MONOTONICITY_POWER);
+			float b = powf(line[y], SCORE_MONOTONICITY_POWER);
+			if (line[y - 1] > line[y])
+				monotonicity_left += a - b;
+			else
+				monotonicity_right += b - a;
+		}
+
+		g_row_score[row] = SCORE_LOST_PENALTY +
+						   SCORE_EMPTY_WEIGHT * empty +
+						   SCORE_MERGES_WEIGHT * merges -
+						   SCORE_MONOTONICITY_WEIGHT * fminf(monotonicity_left, monotonicity_right) -
+						   SCORE_SUM_WEIGHT * sum;
+	}
+}
+
+static void init_scores(void)
+{
+	//AIs created on several threads at once wait for the first to finish
+	pthread_once(&g_scores_once, build_scores);
+}
+
+static float score_rows(BitBoard bitboard)
+{
+	return g_row_score[bitboard & 0xFFFF] +
+		   g_row_score[(bitboard >> 16) & 0xFFFF] +
+		   g_row_score[(bitboard >> 32) & 0xFFFF] +
+		   g_row_score[(bitboard >> 48) & 0xFFFF];
+}
+
+static float score_heuristic(BitBoard bitboard)
+{
+	return score_rows(bitboard) + score_rows(bitboard_transpose(bitboard));
+}
+
+static struct Entry *lookup(AI *ai, BitBoard bitboard)
+{
+	uint64_t hash = (bitboard * 0x9E3779B97F4A7C15ULL) >> 32;
+	return &ai->table[hash & ai->mask];
+}
+
+static float score_max_node(struct Search *search, BitBoard bitboard, unsigned int depth, double prob);
+
+static float score_chance_node(struct Search *search, BitBoard bitboard, unsigned int depth, double prob)
+{
+	if (!visit(search))
+		return 0;
+	if (depth == 0 || prob < search->ai->config.prob_cutoff)
+		return score_heuristic(bitboard);
+
+	BitBoard key = search->ai->config.canonical ? bitboard_canonical(bitboard, NULL) : bitboard;
+	struct Entry *entry = lookup(search->ai, key);
+	if (entry->board == key && entry->generation == search->ai->generation && entry->depth >= depth)
+	{
+		search->stats.table_hits++;
+		return entry->value;
+	}
+
+	//add_random() places a 1 in any empty cell with equal probability
+	unsigned int empty = bitboard_count_empty(bitboard);
+	double cell_prob = prob / empty;
+	float total = 0;
+	for (unsigned int cell = 0; cell < SIZE * SIZE; cell++)
+	{
+		if ((bitboard >> (4 * cell)) & 0xF)
+			continue;
+		total += score_max_node(search, bitboard | (BitBoard)1 << (4 * cell), depth - 1, cell_prob);
+	}
+	float value = total / empty;
+	//An unfinished value must not be reused
+	if (search->aborted)
+		return 0;
+
+	entry->board = key;
+	entry->value = value;
+	entry->depth = (uint16_t)depth;
+	entry->generation = search->ai->generation;
+	return value;
+}
+
+static float score_max_node(struct Search *search, BitBoard bitboard, unsigned int depth, double prob)
+{
+	if (!visit(search))
+		return 0;
+	float best = 0;
+	for (unsigned int dir = 0; dir < 4; dir++)
+	{
+		BitBoard moved = bitboard_move_direction(bitboard, (Direction)dir);
+		if (moved == bitboard)
+			continue;
+		float value = score_chance_node(search, moved, depth, prob);
+		if (value > best)
+			best = value;
+	}
+	return best;
+}
+
+void ai_default_config(AIConfig *config)
+{
+	config->depth = 3;
+	config->prob_cutoff = 0.0001;
+	config->table_bits = 20;
+	config->canonical = false;
+}
+
+AI *ai_create(const AIConfig *config)
+{
+	AI *ai = malloc(sizeof(AI));
+	if (ai == NULL)
+		return NULL;
+	if (config)
+		ai->config = *config;
+	else
+		ai_default_config(&ai->config);
+	if (ai->config.depth < 1)
+		ai->config.depth = 1;
+
+	ai->table = calloc((size_t)1 << ai->config.table_bits, sizeof(struct Entry));
+	if (ai->table == NULL)
+	{
+		free(ai);
+		return NULL;
+	}
+	ai->mask = ((uint64_t)1 << ai->config.table_bits) - 1;
+	ai->generation = 0;
+	ai->abort = NULL;
+	ai->abort_arg = NULL;
+	ai->aborted = false;
+	ai->deadline = 0;
+	ai->progress = NULL;
+	ai->progress_arg = NULL;
+
+	bitboard_init();
+	init_scores();
+	return ai;
+}
+
+void ai_destroy(AI *ai)
+{
+	if (ai == NULL)
+		return;
+	free(ai->table);
+	free(ai);
+}
+
+void ai_set_depth(AI *ai, unsigned int depth)
+{
+	ai->config.depth = depth < 1 ? 1 : depth;
+}
+
+void ai_set_abort(AI *ai, AIAbort abort, void *arg)
+{
+	ai->abort = abort;
+	ai->abort_arg = arg;
+}
+
+void ai_set_progress(AI *ai, AIProgress progress, void *arg)
+{
+	ai->progress = progress;
+	ai->progress_arg = arg;
+}
+
+bool ai_aborted(const AI *ai)
+{
+	return ai->aborted;
+}
+
+/** Starts a new search, the entries of the previous ones become stale. */
+static void next_generation(AI *ai)
+{
+	//Generation 0 marks the empty entries of a fresh table
+	if (++ai->generation == 0)
+		ai->generation = 1;
+}
+
+/** Searches the moves of the board depth moves deep within the current generation. */
+static bool search_root(AI *ai, BitBoard bitboard, unsigned int depth, Direction *best, AIStats *stats)
+{
+	struct Search search = {ai, {0, 0}, false};
+	bool found = false;
+	float best_value = 0;
+	Direction best_dir = DIRECTION_UP;
+	for (unsigned int dir = 0; dir < 4; dir++)
+	{
+		BitBoard moved = bitboard_move_direction(bitboard, (Direction)dir);
+		if (moved == bitboard)
+			continue;
+		float value = score_chance_node(&search, moved, depth - 1, 1.0);
+		if (search.aborted)
+			break;
+		if (!found || value > best_value)
+		{
+			found = true;
+			best_value = value;
+			best_dir = (Direction)dir;
+		}
+	}
+	//An aborted search leaves the move of the last completed one
+	if (found && !search.aborted)
+		*best = best_dir;
+
+	if (stats)
+	{
+		stats->nodes += search.stats.nodes;
+		stats->table_hits += search.stats.table_hits;
+	}
+	ai->aborted = search.aborted;
+	return found && !search.aborted;
+}
+
+bool ai_best_move_bitboard(AI *ai, BitBoard bitboard, Direction *best, AIStats *stats)
+{
+	next_generation(ai);
+	return search_root(ai, bitboard, ai->config.depth, best, stats);
+}
+
+/** Returns the AITimeStats::latency bucket of a time in microseconds. */
+static unsigned int latency_bucket(double us)
+{
+	if (us < 1)
+		return 0;
+	int exponent;
+	//us = fraction * 2^exponent with fraction in [0.5, 1)
+	double fraction = frexp(us, &exponent);
+	unsigned int bucket = 1 + (unsigned int)(exponent - 1) * AI_LATENCY_STEPS +
+						  (unsigned int)((fraction * 2 - 1) * AI_LATENCY_STEPS);
+	return bucket < AI_LATENCY_BUCKETS ? bucket : AI_LATENCY_BUCKETS - 1;
+}
+
+/** Returns the upper bound in microseconds of a latency bucket. */
+static double bucket_limit(unsigned int bucket)
+{
+	if (bucket == 0)
+		return 1;
+	unsigned int step = (bucket - 1) % AI_LATENCY_STEPS;
+	return ldexp(1 + (step + 1.0) / AI_LATENCY_STEPS, (int)((bucket - 1) / AI_LATENCY_STEPS));
+}
+
+bool ai_best_move_timed(AI *ai, BitBoard bitboard, double budget_ms, Direction *best, AITimeStats *stats)
+{
+	uint64_t start = now_ns();
+	uint64_t deadline = start + (uint64_t)(budget_ms > 0 ? budget_ms * 1e6 : 0);
+	//A value is stored with the depth it was searched to, so the depths can share the table
+	next_generation(ai);
+
+	bool found = false;
+	unsigned int reached = 0;
+	for (unsigned int depth = 1; depth <= ai->config.depth; depth++)
+	{
+		//Depth 1 runs without the deadline, so there always is a move
+		ai->deadline = depth == 1 ? 0 : deadline;
+		//best is only written by a completed depth
+		if (!search_root(ai, bitboard, depth, best, NULL))
+			break;
+		found = true;
+		reached = depth;
+		if (ai->progress != NULL)
+			ai->progress(ai->progress_arg, *best, depth);
+		if (now_ns() >= deadline)
+			break;
+	}
+	ai->deadline = 0;
+	//Only the abort function stops depth 1
+	ai->aborted = !found && ai->aborted;
+
+	if (stats)
+	{
+		double us = (now_ns() - start) / 1e3;
+		unsigned int bucket = latency_bucket(us);
+		stats->moves++;
+		stats->depths[reached < AI_MAX_DEPTH ? reached : AI_MAX_DEPTH]++;
+		stats->latency[bucket]++;
+		if (us > stats->max_us)
+			stats->max_us = us;
+	}
+	return found;
+}
+
+double ai_latency_percentile(const AITimeStats *stats, double fraction)
+{
+	unsigned long long rank = (unsigned long long)ceil(fraction * stats->moves), seen = 0;
+	for (unsigned int bucket = 0; bucket + 1 < AI_LATENCY_BUCKETS; bucket++)
+	{
+		seen += stats->latency[bucket];
+		if (seen >= rank && seen > 0)
+			return bucket_limit(bucket);
+	}
+	return stats->max_us;
+}
+
+bool ai_best_move(AI *ai, const Board board, Direction *best, AIStats *stats)
+{
+	return ai_best_move_bitboard(ai, board_to_bitboard(board), best, stats);
+}
@@ -0,0 +1,241 @@
+/**
+ * @file batch.c
+ * @author Gnik Droy
+ * @brief File containing implementation of the batched game engine.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "batch.h"
+#include "bits.h"
+
+//The kernels compute merge scores as powers of two. They are built for
+//any x86 target and picked at runtime, see pick_kernels().
+#if BASE == 2 && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define BATCH_SIMD 1
+#endif
+
+/** @def BATCH_ALIGN
+ * The alignment of the planes and the multiple the stride is rounded to.
+ * It is the width of the widest kernel.
+ */
+#define BATCH_ALIGN 32
+
+/** @def CELLS
+ * The number of cells on a board.
+ */
+#define CELLS (SIZE * SIZE)
+
+/** @struct Batch
+ *  @brief The state of a batch of games.
+ *
+ *  @var Batch::count
+ *  The number of games
+ *  @var Batch::stride
+ *  The number of bytes in a cell plane
+ *  @var Batch::cells
+ *  The CELLS cell planes
+ *  @var Batch::rngs
+ *  The random number generator of every game
+ *  @var Batch::dirs
+ *  The directions of the current step, padded to the stride
+ *  @var Batch::moved
+ *  If each game changed in the current step
+ *  @var Batch::merged
+ *  The merge score of each game in the current step
+ */
+struct Batch
+{
+	size_t count;
+	size_t stride;
+	unsigned char *cells;
+	Rng *rngs;
+	unsigned char *dirs;
+	unsigned char *moved;
+	uint32_t *merged;
+};
+
+Batch *batch_create(size_t count, uint64_t seed)
+{
+	Batch *batch = calloc(1, sizeof(Batch));
+	if (batch == NULL)
+		return NULL;
+	batch->count = count;
+	batch->stride = (count + BATCH_ALIGN - 1) / BATCH_ALIGN * BATCH_ALIGN;
+	if (batch->stride == 0)
+		batch->stride = BATCH_ALIGN;
+	batch->cells = aligned_alloc(BATCH_ALIGN, CELLS * batch->stride);
+	batch->rngs = malloc((count ? count : 1) * sizeof(Rng));
+	batch->dirs = aligned_alloc(BATCH_ALIGN, batch->stride);
+	batch->moved = aligned_alloc(BATCH_ALIGN, batch->stride);
+	batch->merged = aligned_alloc(BATCH_ALIGN, batch->stride * sizeof(uint32_t));
+	if (batch->cells == NULL || batch->rngs == NULL || batch->dirs == NULL ||
+		batch->moved == NULL || batch->merged == NULL)
+	{
+		batch_destroy(batch);
+		return NULL;
+	}
+	//Padding games stay empty, so they never move
+	memset(batch->cells, 0, CELLS * batch->stride);
+	memset(batch->dirs, 0, batch->stride);
+	for (size_t i = 0; i < count; i++)
+		batch_reset(batch, i, seed + i);
+	return batch;
+}
+
+void batch_destroy(Batch *batch)
+{
+	if (batch == NULL)
+		return;
+	free(batch->cells);
+	free(batch->rngs);
+	free(batch->dirs);
+	free(batch->moved);
+	free(batch->merged);
+	free(batch);
+}
+
+size_t batch_count(const Batch *batch)
+{
+	return batch->count;
+}
+
+size_t batch_stride(const Batch *batch)
+{
+	return batch->stride;
+}
+
+const unsigned char *batch_cells(const Batch *batch)
+{
+	return batch->cells;
+}
+
+void batch_reset(Batch *batch, size_t game, uint64_t seed)
+{
+	unsigned char board[SIZE][SIZE];
+	rng_seed(&batch->rngs[game], seed);
+	clear_board(board);
+	add_random(board, &batch->rngs[game]);
+	batch_set_board(batch, game, board);
+}
+
+void batch_get_board(const Batch *batch, size_t game, Board board)
+{
+	for (unsigned int c = 0; c < CELLS; c++)
+		board[c / SIZE][c % SIZE] = batch->cells[c * batch->stride + game];
+}
+
+void batch_set_board(Batch *batch, size_t game, const Board board)
+{
+	for (unsigned int c = 0; c < CELLS; c++)
+		batch->cells[c * batch->stride + game] = board[c / SIZE][c % SIZE];
+}
+
+size_t batch_step_scalar(Batch *batch, const unsigned char *dirs, unsigned char *moved, uint32_t *merged)
+{
+	size_t changed = 0;
+	for (size_t i = 0; i < batch->count; i++)
+	{
+		unsigned char board[SIZE][SIZE];
+		Score score = {0, 0, 0};
+		batch_get_board(batch, i, board);
+		bool step = move_with_spawn(board, (Direction)dirs[i], &batch->rngs[i], &score) >= 0;
+		if (step)
+			batch_set_board(batch, i, board);
+		changed += step;
+		if (moved != NULL)
+			moved[i] = step;
+		if (merged != NULL)
+			merged[i] = (uint32_t)score.merged;
+	}
+	return changed;
+}
+
+size_t batch_game_over_scalar(const Batch *batch, unsigned char *over)
+{
+	size_t count = 0;
+	for (size_t i = 0; i < batch->count; i++)
+	{
+		unsigned char board[SIZE][SIZE];
+		batch_get_board(batch, i, board);
+		over[i] = is_game_over(board);
+		count += over[i];
+	}
+	return count;
+}
+
+#ifdef BATCH_SIMD
+
+#define KERNEL_TARGET "avx2"
+#define KERNEL_AVX2 1
+#define KERNEL_SUFFIX avx2
+#include "batch_kernel.h"
+#undef KERNEL_TARGET
+#undef KERNEL_AVX2
+#undef KERNEL_SUFFIX
+
+#define KERNEL_TARGET "sse4.1"
+#define KERNEL_AVX2 0
+#define KERNEL_SUFFIX sse41
+#include "batch_kernel.h"
+#undef KERNEL_TARGET
+#undef KERNEL_AVX2
+#undef KERNEL_SUFFIX
+
+#endif
+
+/** @struct Kernels
+ *  @brief The kernels batch_step() and batch_game_over() run.
+ *
+ *  @var Kernels::name
+ *  The name returned by batch_kernel()
+ *  @var Kernels::step
+ *  The kernel of batch_step()
+ *  @var Kernels::game_over
+ *  The kernel of batch_game_over()
+ */
+struct Kernels
+{
+	const char *name;
+	size_t (*step)(Batch *batch, const unsigned char *dirs, unsigned char *moved, uint32_t *merged);
+	size_t (*game_over)(const Batch *batch, unsigned char *over);
+};
+
+/** The kernels for the CPU, set once by pick_kernels() */
+static struct Kernels g_kernels;
+
+/** Picks the kernels exactly once */
+static pthread_once_t g_kernels_once = PTHREAD_ONCE_INIT;
+
+/** Picks the widest kernels the CPU supports. */
+static void pick_kernels(void)
+{
+	g_kernels = (struct Kernels){"scalar", batch_step_scalar, batch_game_over_scalar};
+#ifdef BATCH_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		g_kernels = (struct Kernels){"avx2", batch_step_avx2, batch_game_over_avx2};
+	else if (__builtin_cpu_supports("sse4.1"))
+		g_kernels = (struct Kernels){"sse4.1", batch_step_sse41, batch_game_over_sse41};
+#endif
+}
+
+size_t batch_step(Batch *batch, const unsigned char *dirs, unsigned char *moved, uint32_t *merged)
+{
+	pthread_once(&g_kernels_once, pick_kernels);
+	return g_kernels.step(batch, dirs, moved, merged);
+}
+
+size_t batch_game_over(const Batch *batch, unsigned char *over)
+{
+	pthread_once(&g_kernels_once, pick_kernels);
+	return g_kernels.game_over(batch, over);
+}
+
+const char *batch_kernel(void)
+{
+	pthread_once(&g_kernels_once, pick_kernels);
+	return g_kernels.name;
+}
@@ -0,0 +1,325 @@
+/**
+ * @file batch_kernel.h
+ * @author Gnik Droy
+ * @brief File containing the SIMD kernels of the batch engine.
+ *
+ * Only batch.c includes it, once per instruction set. Before each
+ * include it defines KERNEL_TARGET as the target of the set, KERNEL_AVX2
+ * as 1 for AVX2 or 0 for SSE4.1, and KERNEL_SUFFIX. Every function gets
+ * the target attribute and the suffix, e.g. batch_step_avx2(), so both
+ * sets are compiled without -march flags and batch.c picks one at
+ * runtime.
+ */
+
+/** The attribute compiling a function for the instruction set */
+#define TARGET __attribute__((target(KERNEL_TARGET)))
+
+#define KERNEL_CAT2(name, suffix) name##_##suffix
+#define KERNEL_CAT(name, suffix) KERNEL_CAT2(name, suffix)
+/** Adds the suffix of the instruction set to a name */
+#define KERNEL(name) KERNEL_CAT(name, KERNEL_SUFFIX)
+
+#define vec_load KERNEL(vec_load)
+#define vec_store KERNEL(vec_store)
+#define vec_set1 KERNEL(vec_set1)
+#define vec_eq KERNEL(vec_eq)
+#define vec_and KERNEL(vec_and)
+#define vec_or KERNEL(vec_or)
+#define vec_xor KERNEL(vec_xor)
+#define vec_andnot KERNEL(vec_andnot)
+#define vec_sub KERNEL(vec_sub)
+#define vec_blend KERNEL(vec_blend)
+#define vec_movemask KERNEL(vec_movemask)
+#define vec_pow2_epi32 KERNEL(vec_pow2_epi32)
+#define vec_add_pow2 KERNEL(vec_add_pow2)
+#define vec32_zero KERNEL(vec32_zero)
+#define vec32_store KERNEL(vec32_store)
+#define compact_line KERNEL(compact_line)
+#define slide_line KERNEL(slide_line)
+#define select_dir KERNEL(select_dir)
+#define spawn_tiles KERNEL(spawn_tiles)
+#define batch_step KERNEL(batch_step)
+#define batch_game_over KERNEL(batch_game_over)
+
+#if KERNEL_AVX2
+#define Vec __m256i
+
+/** @def VEC_WIDTH
+ * The number of games in a vector.
+ */
+#define VEC_WIDTH 32
+
+static inline TARGET Vec vec_load(const void *p) { return _mm256_load_si256((const __m256i *)p); }
+static inline TARGET void vec_store(void *p, Vec v) { _mm256_store_si256((__m256i *)p, v); }
+static inline TARGET Vec vec_set1(unsigned char x) { return _mm256_set1_epi8((char)x); }
+static inline TARGET Vec vec_eq(Vec a, Vec b) { return _mm256_cmpeq_epi8(a, b); }
+static inline TARGET Vec vec_and(Vec a, Vec b) { return _mm256_and_si256(a, b); }
+static inline TARGET Vec vec_or(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+static inline TARGET Vec vec_xor(Vec a, Vec b) { return _mm256_xor_si256(a, b); }
+static inline TARGET Vec vec_andnot(Vec a, Vec b) { return _mm256_andnot_si256(a, b); }
+static inline TARGET Vec vec_sub(Vec a, Vec b) { return _mm256_sub_epi8(a, b); }
+static inline TARGET Vec vec_blend(Vec a, Vec b, Vec mask) { return _mm256_blendv_epi8(a, b, mask); }
+static inline TARGET uint32_t vec_movemask(Vec v) { return (uint32_t)_mm256_movemask_epi8(v); }
+
+/** Returns 2^e of each 32 bit lane, 0 where e is 0. */
+static inline TARGET __m256i vec_pow2_epi32(__m256i e)
+{
+	//Build the float 2^e from its exponent bits and convert it back
+	__m256i bits = _mm256_slli_epi32(_mm256_add_epi32(e, _mm256_set1_epi32(127)), 23);
+	__m256i pow2 = _mm256_cvttps_epi32(_mm256_castsi256_ps(bits));
+	return _mm256_andnot_si256(_mm256_cmpeq_epi32(e, _mm256_setzero_si256()), pow2);
+}
+
+/** Adds 2^e of every game with a non zero e to its merge score. */
+static inline TARGET void vec_add_pow2(__m256i score[4], Vec e)
+{
+	__m128i low = _mm256_castsi256_si128(e), high = _mm256_extracti128_si256(e, 1);
+	score[0] = _mm256_add_epi32(score[0], vec_pow2_epi32(_mm256_cvtepu8_epi32(low)));
+	score[1] = _mm256_add_epi32(score[1], vec_pow2_epi32(_mm256_cvtepu8_epi32(_mm_srli_si128(low, 8))));
+	score[2] = _mm256_add_epi32(score[2], vec_pow2_epi32(_mm256_cvtepu8_epi32(high)));
+	score[3] = _mm256_add_epi32(score[3], vec_pow2_epi32(_mm256_cvtepu8_epi32(_mm_srli_si128(high, 8))));
+}
+
+#define Vec32 __m256i
+static inline TARGET Vec32 vec32_zero(void) { return _mm256_setzero_si256(); }
+static inline TARGET void vec32_store(void *p, Vec32 v) { _mm256_store_si256((__m256i *)p, v); }
+#else
+#define Vec __m128i
+
+/** @def VEC_WIDTH
+ * The number of games in a vector.
+ */
+#define VEC_WIDTH 16
+
+static inline TARGET Vec vec_load(const void *p) { return _mm_load_si128((const __m128i *)p); }
+static inline TARGET void vec_store(void *p, Vec v) { _mm_store_si128((__m128i *)p, v); }
+static inline TARGET Vec vec_set1(unsigned char x) { return _mm_set1_epi8((char)x); }
+static inline TARGET Vec vec_eq(Vec a, Vec b) { return _mm_cmpeq_epi8(a, b); }
+static inline TARGET Vec vec_and(Vec a, Vec b) { return _mm_and_si128(a, b); }
+static inline TARGET Vec vec_or(Vec a, Vec b) { return _mm_or_si128(a, b); }
+static inline TARGET Vec vec_xor(Vec a, Vec b) { return _mm_xor_si128(a, b); }
+static inline TARGET Vec vec_andnot(Vec a, Vec b) { return _mm_andnot_si128(a, b); }
+static inline TARGET Vec vec_sub(Vec a, Vec b) { return _mm_sub_epi8(a, b); }
+static inline TARGET Vec vec_blend(Vec a, Vec b, Vec mask) { return _mm_blendv_epi8(a, b, mask); }
+static inline TARGET uint32_t vec_movemask(Vec v) { return (uint32_t)_mm_movemask_epi8(v); }
+
+/** Returns 2^e of each 32 bit lane, 0 where e is 0. */
+static inline TARGET __m128i vec_pow2_epi32(__m128i e)
+{
+	//Build the float 2^e from its exponent bits and convert it back
+	__m128i bits = _mm_slli_epi32(_mm_add_epi32(e, _mm_set1_epi32(127)), 23);
+	__m128i pow2 = _mm_cvttps_epi32(_mm_castsi128_ps(bits));
+	return _mm_andnot_si128(_mm_cmpeq_epi32(e, _mm_setzero_si128()), pow2);
+}
+
+/** Adds 2^e of every game with a non zero e to its merge score. */
+static inline TARGET void vec_add_pow2(__m128i score[4], Vec e)
+{
+	score[0] = _mm_add_epi32(score[0], vec_pow2_epi32(_mm_cvtepu8_epi32(e)));
+	score[1] = _mm_add_epi32(score[1], vec_pow2_epi32(_mm_cvtepu8_epi32(_mm_srli_si128(e, 4))));
+	score[2] = _mm_add_epi32(score[2], vec_pow2_epi32(_mm_cvtepu8_epi32(_mm_srli_si128(e, 8))));
+	score[3] = _mm_add_epi32(score[3], vec_pow2_epi32(_mm_cvtepu8_epi32(_mm_srli_si128(e, 12))));
+}
+
+#define Vec32 __m128i
+static inline TARGET Vec32 vec32_zero(void) { return _mm_setzero_si128(); }
+static inline TARGET void vec32_store(void *p, Vec32 v) { _mm_store_si128((__m128i *)p, v); }
+#endif
+
+/** Moves the non zero tiles of every line to its start, keeping their order. */
+static inline TARGET void compact_line(Vec line[SIZE])
+{
+	//A bubble sort on "is empty": every pass carries one more hole to the end
+	const Vec zero = vec_set1(0);
+	for (unsigned int end = SIZE - 1; end > 0; end--)
+	{
+		for (unsigned int k = 0; k < end; k++)
+		{
+			Vec hole = vec_eq(line[k], zero);
+			line[k] = vec_blend(line[k], line[k + 1], hole);
+			line[k + 1] = vec_andnot(hole, line[k + 1]);
+		}
+	}
+}
+
+/** Moves every line towards its start, like shift_x() and merge_x(). */
+static inline TARGET void slide_line(Vec line[SIZE], Vec32 score[4], bool scored)
+{
+	const Vec zero = vec_set1(0);
+	compact_line(line);
+	for (unsigned int k = 0; k + 1 < SIZE; k++)
+	{
+		//The merged tile leaves a hole, so it never merges again
+		Vec merge = vec_andnot(vec_eq(line[k], zero), vec_eq(line[k], line[k + 1]));
+		if (vec_movemask(merge) == 0)
+			continue;
+		line[k] = vec_sub(line[k], merge);
+		line[k + 1] = vec_andnot(merge, line[k + 1]);
+		if (scored)
+			vec_add_pow2(score, vec_and(line[k], merge));
+	}
+	compact_line(line);
+}
+
+/** Picks the value of the direction of every game. */
+static inline TARGET Vec select_dir(Vec left, Vec right, Vec up, Vec down,
+							 Vec is_left, Vec is_right, Vec is_up)
+{
+	Vec v = vec_blend(down, up, is_up);
+	v = vec_blend(v, right, is_right);
+	return vec_blend(v, left, is_left);
+}
+
+/** Adds a tile to every game that changed, as add_random() would. */
+static TARGET void spawn_tiles(Batch *batch, size_t first, const Vec out[CELLS], uint32_t changed)
+{
+	//The empty cells of every game, eight cells per byte
+	_Alignas(BATCH_ALIGN) unsigned char empty[(CELLS + 7) / 8][VEC_WIDTH];
+	const Vec zero = vec_set1(0);
+	for (unsigned int byte = 0; byte < (CELLS + 7) / 8; byte++)
+	{
+		Vec bits = zero;
+		for (unsigned int c = byte * 8; c < CELLS && c < byte * 8 + 8; c++)
+			bits = vec_or(bits, vec_and(vec_eq(out[c], zero), vec_set1((unsigned char)(1u << (c % 8)))));
+		vec_store(empty[byte], bits);
+	}
+	for (; changed != 0; changed &= changed - 1)
+	{
+		unsigned int lane = bits_ctz(changed);
+		uint64_t mask = 0;
+		for (unsigned int byte = 0; byte < (CELLS + 7) / 8; byte++)
+			mask |= (uint64_t)empty[byte][lane] << (8 * byte);
+		//A board that changed always has an empty cell
+		unsigned int cell = bits_select(mask, rng_bounded(&batch->rngs[first + lane], bits_popcount(mask)));
+		batch->cells[cell * batch->stride + first + lane] = 1;
+	}
+}
+
+static TARGET size_t batch_step(Batch *batch, const unsigned char *dirs, unsigned char *moved, uint32_t *merged)
+{
+	const size_t stride = batch->stride;
+	const bool scored = merged != NULL;
+	memcpy(batch->dirs, dirs, batch->count);
+	size_t changed_count = 0;
+	for (size_t first = 0; first < stride; first += VEC_WIDTH)
+	{
+		Vec dir = vec_load(batch->dirs + first);
+		Vec is_left = vec_eq(dir, vec_set1(DIRECTION_LEFT));
+		Vec is_right = vec_eq(dir, vec_set1(DIRECTION_RIGHT));
+		Vec is_up = vec_eq(dir, vec_set1(DIRECTION_UP));
+
+		Vec in[CELLS];
+		for (unsigned int c = 0; c < CELLS; c++)
+			in[c] = vec_load(batch->cells + c * stride + first);
+
+		//Line r position k is the k-th cell from the edge the tiles move to
+		Vec lines[SIZE][SIZE];
+		for (unsigned int r = 0; r < SIZE; r++)
+			for (unsigned int k = 0; k < SIZE; k++)
+				lines[r][k] = select_dir(in[r * SIZE + k], in[r * SIZE + SIZE - 1 - k],
+										 in[k * SIZE + r], in[(SIZE - 1 - k) * SIZE + r],
+										 is_left, is_right, is_up);
+
+		Vec32 score[4] = {vec32_zero(), vec32_zero(), vec32_zero(), vec32_zero()};
+		for (unsigned int r = 0; r < SIZE; r++)
+			slide_line(lines[r], score, scored);
+
+		Vec out[CELLS];
+		Vec diff = vec_set1(0);
+		for (unsigned int x = 0; x < SIZE; x++)
+		{
+			for (unsigned int y = 0; y < SIZE; y++)
+			{
+				Vec v = select_dir(lines[x][y], lines[x][SIZE - 1 - y],
+								   lines[y][x], lines[y][SIZE - 1 - x],
+								   is_left, is_right, is_up);
+				diff = vec_or(diff, vec_xor(v, in[x * SIZE + y]));
+				out[x * SIZE + y] = v;
+				vec_store(batch->cells + (x * SIZE + y) * stride + first, v);
+			}
+		}
+
+		Vec changed = vec_andnot(vec_eq(diff, vec_set1(0)), vec_set1(1));
+		vec_store(batch->moved + first, changed);
+		if (scored)
+		{
+			for (unsigned int j = 0; j < 4; j++)
+				vec32_store(batch->merged + first + j * (VEC_WIDTH / 4), score[j]);
+		}
+		uint32_t changed_mask = vec_movemask(vec_sub(vec_set1(0), changed));
+		if (changed_mask != 0)
+			spawn_tiles(batch, first, out, changed_mask);
+		changed_count += bits_popcount(changed_mask);
+	}
+	if (moved != NULL)
+		memcpy(moved, batch->moved, batch->count);
+	if (merged != NULL)
+		memcpy(merged, batch->merged, batch->count * sizeof(uint32_t));
+	return changed_count;
+}
+
+static TARGET size_t batch_game_over(const Batch *batch, unsigned char *over)
+{
+	const size_t stride = batch->stride;
+	const Vec zero = vec_set1(0);
+	size_t count = 0;
+	for (size_t first = 0; first < stride; first += VEC_WIDTH)
+	{
+		Vec cells[CELLS];
+		for (unsigned int c = 0; c < CELLS; c++)
+			cells[c] = vec_load(batch->cells + c * stride + first);
+		//A game goes on while it has an empty cell or two equal neighbours
+		Vec alive = zero;
+		for (unsigned int x = 0; x < SIZE; x++)
+		{
+			for (unsigned int y = 0; y < SIZE; y++)
+			{
+				Vec cell = cells[x * SIZE + y];
+				alive = vec_or(alive, vec_eq(cell, zero));
+				if (y + 1 < SIZE)
+					alive = vec_or(alive, vec_eq(cell, cells[x * SIZE + y + 1]));
+				if (x + 1 < SIZE)
+					alive = vec_or(alive, vec_eq(cell, cells[(x + 1) * SIZE + y]));
+			}
+		}
+		Vec done = vec_andnot(alive, vec_set1(1));
+		//Padding games are empty, so they are never over
+		count += bits_popcount(vec_movemask(vec_sub(zero, done)));
+		_Alignas(BATCH_ALIGN) unsigned char bytes[VEC_WIDTH];
+		vec_store(bytes, done);
+		size_t games = batch->count - first < VEC_WIDTH ? batch->count - first : VEC_WIDTH;
+		if (first < batch->count)
+			memcpy(over + first, bytes, games);
+	}
+	return count;
+}
+
+
+#undef vec_load
+#undef vec_store
+#undef vec_set1
+#undef vec_eq
+#undef vec_and
+#undef vec_or
+#undef vec_xor
+#undef vec_andnot
+#undef vec_sub
+#undef vec_blend
+#undef vec_movemask
+#undef vec_pow2_epi32
+#undef vec_add_pow2
+#undef vec32_zero
+#undef vec32_store
+#undef compact_line
+#undef slide_line
+#undef select_dir
+#undef spawn_tiles
+#undef batch_step
+#undef batch_game_over
+#undef Vec
+#undef Vec32
+#undef VEC_WIDTH
+#undef TARGET
+#undef KERNEL_CAT2
+#undef KERNEL_CAT
+#undef KERNEL
@@ -0,0 +1,555 @@
+/**
+ * @file bench.c
+ * @author Gnik Droy
+ * @brief File containing the microbenchmarks for the core kernels.
+ *
+ * Every kernel is run over a reproducible corpus of boards sampled from
+ * played games. The corpus holds early, mid and late game positions in
+ * equal parts. Results are printed as a table and can be written as JSON.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "core.h"
+#include "bitboard.h"
+#include "batch.h"
+#include "env.h"
+#include "sized.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+/** @def PHASES
+ * The number of game phases in the corpus: early, mid and late.
+ */
+#define PHASES 3
+
+/** @struct Corpus
+ *  @brief The boards every kernel is run over.
+ *
+ *  @var Corpus::boards
+ *  The game boards
+ *  @var Corpus::packed
+ *  The same boards packed into bitboards
+ *  @var Corpus::open
+ *  Indices of the boards that have an empty cell, used by add_random().
+ *  They are repeated to fill Corpus::count entries.
+ *  @var Corpus::count
+ *  The number of boards
+ */
+struct Corpus
+{
+	unsigned char (*boards)[SIZE][SIZE];
+	BitBoard *packed;
+	size_t *open;
+	size_t count;
+};
+
+/** @struct Result
+ *  @brief The measurements of a single kernel.
+ *
+ *  @var Result::name
+ *  The name of the kernel
+ *  @var Result::ns_per_op
+ *  Nanoseconds per operation, without the cost of copying the board
+ *  @var Result::cycles_per_op
+ *  Time stamp counter cycles per operation, or negative if unavailable
+ */
+struct Result
+{
+	const char *name;
+	double ns_per_op;
+	double cycles_per_op;
+};
+
+/** Keeps the compiler from optimizing the kernels away */
+static volatile unsigned long g_sink;
+
+/** Scratch board the mutating kernels work on */
+static unsigned char g_scratch[SIZE][SIZE];
+
+/** Random number generator used by the kernels that spawn tiles */
+static Rng g_rng;
+
+/** The kernels of the board size SIZE, picked at runtime */
+static const SizedOps *g_sized;
+
+static unsigned char max_tile(const Board board)
+{
+	unsigned char max = 0;
+	for (unsigned int x = 0; x < SIZE; x++)
+		for (unsigned int y = 0; y < SIZE; y++)
+			if (board[x][y] > max)
+				max = board[x][y];
+	return max;
+}
+
+/** Classifies a board by its largest tile: below 64, below 512 and above. */
+static unsigned int game_phase(const Board board)
+{
+	unsigned char max = max_tile(board);
+	return max < 6 ? 0 : max < 9 ? 1 : 2;
+}
+
+/** Plays a corner strategy: down, then left, then right, then up. */
+static bool play_corner(Board board, Rng *rng)
+{
+	static const Direction order[] = {DIRECTION_DOWN, DIRECTION_LEFT, DIRECTION_RIGHT, DIRECTION_UP};
+	for (unsigned int i = 0; i < 4; i++)
+		if (move_direction(board, order[i], rng))
+			return true;
+	return false;
+}
+
+/**
+ * Samples boards from played games until every phase holds a third
+ * of the corpus. Every other game is played randomly, so the corpus
+ * mixes well structured and chaotic positions.
+ */
+static bool build_corpus(struct Corpus *corpus, size_t count, uint64_t seed)
+{
+	corpus->boards = malloc(count * sizeof(*corpus->boards));
+	corpus->packed = malloc(count * sizeof(*corpus->packed));
+	corpus->open = malloc(count * sizeof(*corpus->open));
+	if (corpus->boards == NULL || corpus->packed == NULL || corpus->open == NULL)
+		return false;
+
+	Rng rng;
+	rng_seed(&rng, seed);
+	size_t per_phase = count / PHASES, filled[PHASES] = {0};
+	size_t total = 0;
+	unsigned long game = 0;
+	unsigned char board[SIZE][SIZE];
+	while (total < count)
+	{
+		clear_board(board);
+		add_random(board, &rng);
+		bool corner = game++ % 2 == 0;
+		while (!is_game_over(board) && total < count)
+		{
+			unsigned int phase = game_phase(board);
+			size_t limit = phase == PHASES - 1 ? count - per_phase * (PHASES - 1) : per_phase;
+			//Sample sparsely so a corpus is spread over many games
+			if (filled[phase] < limit && rng_bounded(&rng, 8) == 0)
+			{
+				memcpy(corpus->boards[total++], board, sizeof(board));
+				filled[phase]++;
+			}
+			if (corner)
+				play_corner(board, &rng);
+			else
+				move_direction(board, (Direction)rng_bounded(&rng, 4), &rng);
+		}
+	}
+
+	corpus->count = count;
+	size_t open_count = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		corpus->packed[i] = board_to_bitboard(corpus->boards[i]);
+		if (bitboard_count_empty(corpus->packed[i]) > 0)
+			corpus->open[open_count++] = i;
+	}
+	//Every game starts with empty cells, so there is at least one
+	for (size_t i = open_count; i < count; i++)
+		corpus->open[i] = corpus->open[i - open_count];
+	return true;
+}
+
+static void free_corpus(struct Corpus *corpus)
+{
+	free(corpus->boards);
+	free(corpus->packed);
+	free(corpus->open);
+}
+
+static unsigned long scratch_sum(void)
+{
+	return g_scratch[0][0] + g_scratch[SIZE - 1][SIZE - 1];
+}
+
+static unsigned long kernel_copy(const struct Corpus *c, size_t i)
+{
+	memcpy(g_scratch, c->boards[i], sizeof(g_scratch));
+	return scratch_sum();
+}
+
+static unsigned long kernel_shift_x(const struct Corpus *c, size_t i)
+{
+	memcpy(g_scratch, c->boards[i], sizeof(g_scratch));
+	return shift_x(g_scratch, i & 1) + scratch_sum();
+}
+
+static unsigned long kernel_merge_x(const struct Corpus *c, size_t i)
+{
+	memcpy(g_scratch, c->boards[i], sizeof(g_scratch));
+	return merge_x(g_scratch, i & 1, NULL) + scratch_sum();
+}
+
+static unsigned long kernel_move_x(const struct Corpus *c, size_t i)
+{
+	memcpy(g_scratch, c->boards[i], sizeof(g_scratch));
+	return move_x(g_scratch, i & 1, &g_rng) + scratch_sum();
+}
+
+static unsigned long kernel_move_y(const struct Corpus *c, size_t i)
+{
+	memcpy(g_scratch, c->boards[i], sizeof(g_scratch));
+	return move_y(g_scratch, i & 1, &g_rng) + scratch_sum();
+}
+
+static unsigned long kernel_sized_move_x(const struct Corpus *c, size_t i)
+{
+	memcpy(g_scratch, c->boards[i], sizeof(g_scratch));
+	Direction dir = i & 1 ? DIRECTION_RIGHT : DIRECTION_LEFT;
+	return (sized_move_with_spawn(g_sized, &g_scratch[0][0], dir, &g_rng, NULL) >= 0) + scratch_sum();
+}
+
+static unsigned long kernel_add_random(const struct Corpus *c, size_t i)
+{
+	memcpy(g_scratch, c->boards[c->open[i]], sizeof(g_scratch));
+	add_random(g_scratch, &g_rng);
+	return scratch_sum();
+}
+
+static unsigned long kernel_is_game_over(const struct Corpus *c, size_t i)
+{
+	return is_game_over(c->boards[i]);
+}
+
+static unsigned long kernel_calculate_score(const struct Corpus *c, size_t i)
+{
+	return calculate_score(c->boards[i]);
+}
+
+static unsigned long kernel_bitboard_move_x(const struct Corpus *c, size_t i)
+{
+	return (unsigned long)bitboard_move_x(c->packed[i], i & 1);
+}
+
+static unsigned long kernel_bitboard_move_y(const struct Corpus *c, size_t i)
+{
+	return (unsigned long)bitboard_move_y(c->packed[i], i & 1);
+}
+
+static unsigned long kernel_bitboard_add_random(const struct Corpus *c, size_t i)
+{
+	return (unsigned long)bitboard_add_random(c->packed[c->open[i]], &g_rng);
+}
+
+static unsigned long kernel_bitboard_is_game_over(const struct Corpus *c, size_t i)
+{
+	return bitboard_is_game_over(c->packed[i]);
+}
+
+/** @struct Kernel
+ *  @brief A benchmarked kernel.
+ *
+ *  @var Kernel::name
+ *  The name of the kernel
+ *  @var Kernel::run
+ *  Runs the kernel on the i-th board of the corpus
+ *  @var Kernel::copies
+ *  If the kernel copies the board to the scratch board first
+ */
+struct Kernel
+{
+	const char *name;
+	unsigned long (*run)(const struct Corpus *c, size_t i);
+	bool copies;
+};
+
+static const struct Kernel g_kernels[] = {
+	{"copy", kernel_copy, false},
+	{"shift_x", kernel_shift_x, true},
+	{"merge_x", kernel_merge_x, true},
+	{"move_x", kernel_move_x, true},
+	{"move_y", kernel_move_y, true},
+	{"sized_move_x", kernel_sized_move_x, true},
+	{"add_random", kernel_add_random, true},
+	{"is_game_over", kernel_is_game_over, false},
+	{"calculate_score", kernel_calculate_score, false},
+	{"bitboard_move_x", kernel_bitboard_move_x, false},
+	{"bitboard_move_y", kernel_bitboard_move_y, false},
+	{"bitboard_add_random", kernel_bitboard_add_random, false},
+	{"bitboard_is_game_over", kernel_bitboard_is_game_over, false}};
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static unsigned long long now_cycles(void)
+{
+#ifdef HAVE_RDTSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/** Runs a kernel over the whole corpus the given number of passes. */
+static struct Result measure(const struct Kernel *kernel, const struct Corpus *corpus, unsigned long passes)
+{
+	unsigned long sink = 0;
+	double start = now_ns();
+	unsigned long long start_cycles = now_cycles();
+	for (unsigned long pass = 0; pass < passes; pass++)
+		for (size_t i = 0; i < corpus->count; i++)
+			sink += kernel->run(corpus, i);
+	unsigned long long cycles = now_cycles() - start_cycles;
+	double elapsed = now_ns() - start;
+	g_sink = sink;
+
+	double ops = (double)passes * corpus->count;
+	struct Result result = {kernel->name, elapsed / ops, -1};
+#ifdef HAVE_RDTSC
+	result.cycles_per_op = cycles / ops;
+#else
+	(void)cycles;
+#endif
+	return result;
+}
+
+/**
+ * Steps the whole corpus as one batch the given number of passes.
+ * The boards are restored before every pass, outside of the timing.
+ */
+static struct Result measure_batch(const char *name, size_t (*step)(Batch *, const unsigned char *, unsigned char *, uint32_t *),
+								   const struct Corpus *corpus, unsigned long passes, uint64_t seed)
+{
+	struct Result result = {name, -1, -1};
+	Batch *batch = batch_create(corpus->count, seed);
+	unsigned char *dirs = malloc(corpus->count);
+	uint32_t *merged = malloc(corpus->count * sizeof(uint32_t));
+	if (batch == NULL || dirs == NULL || merged == NULL)
+	{
+		fprintf(stderr, "The batch couldn't be allocated.\n");
+		batch_destroy(batch);
+		free(dirs);
+		free(merged);
+		return result;
+	}
+	Rng rng;
+	rng_seed(&rng, seed);
+	for (size_t i = 0; i < corpus->count; i++)
+		dirs[i] = (unsigned char)rng_bounded(&rng, 4);
+
+	unsigned long sink = 0;
+	double elapsed = 0;
+	unsigned long long cycles = 0;
+	for (unsigned long pass = 0; pass < passes; pass++)
+	{
+		for (size_t i = 0; i < corpus->count; i++)
+			batch_set_board(batch, i, corpus->boards[i]);
+		double start = now_ns();
+		unsigned long long start_cycles = now_cycles();
+		sink += step(batch, dirs, NULL, merged);
+		cycles += now_cycles() - start_cycles;
+		elapsed += now_ns() - start;
+	}
+	g_sink = sink;
+
+	double ops = (double)passes * corpus->count;
+	result.ns_per_op = elapsed / ops;
+#ifdef HAVE_RDTSC
+	result.cycles_per_op = cycles / ops;
+#endif
+	batch_destroy(batch);
+	free(dirs);
+	free(merged);
+	return result;
+}
+
+/**
+ * Steps an environment with as many games as the corpus the given number
+ * of passes, with random actions. It includes writing the observations
+ * and starting the finished games over.
+ */
+static struct Result measure_env(const char *name, EnvObservation observation, const struct Corpus *corpus,
+								 unsigned long passes, uint64_t seed)
+{
+	struct Result result = {name, -1, -1};
+	Env *env = env_create(corpus->count, seed, observation);
+	uint8_t *actions = malloc(corpus->count);
+	float *obs = env ? malloc(corpus->count * env_observation_size(env) * sizeof(float)) : NULL;
+	float *reward = malloc(corpus->count * sizeof(float));
+	uint8_t *done = malloc(corpus->count);
+	if (env == NULL || actions == NULL || obs == NULL || reward == NULL || done == NULL)
+	{
+		fprintf(stderr, "The environment couldn't be allocated.\n");
+		env_destroy(env);
+		free(actions);
+		free(obs);
+		free(reward);
+		free(done);
+		return result;
+	}
+	Rng rng;
+	rng_seed(&rng, seed);
+	for (size_t i = 0; i < corpus->count; i++)
+		actions[i] = (uint8_t)rng_bounded(&rng, 4);
+
+	unsigned long sink = 0;
+	double start = now_ns();
+	unsigned long long start_cycles = now_cycles();
+	for (unsigned long pass = 0; pass < passes; pass++)
+		sink += env_step(env, actions, obs, reward, done);
+	unsigned long long cycles = now_cycles() - start_cycles;
+	double elapsed = now_ns() - start;
+	g_sink = sink;
+
+	double ops = (double)passes * corpus->count;
+	result.ns_per_op = elapsed / ops;
+#ifdef HAVE_RDTSC
+	result.cycles_per_op = cycles / ops;
+#else
+	(void)cycles;
+#endif
+	env_destroy(env);
+	free(actions);
+	free(obs);
+	free(reward);
+	free(done);
+	return result;
+}
+
+static void write_json(FILE *stream, const struct Result *results, size_t count,
+					   uint64_t seed, size_t corpus, unsigned long passes)
+{
+	fprintf(stream, "{\n  \"seed\": %llu,\n  \"corpus\": %zu,\n  \"passes\": %lu,\n  \"results\": [\n",
+			(unsigned long long)seed, corpus, passes);
+	for (size_t i = 0; i < count; i++)
+	{
+		fprintf(stream, "    {\"kernel\": \"%s\", \"ns_per_op\": %.3f, \"moves_per_sec\": %.0f, \"cycles_per_op\": ",
+				results[i].name, results[i].ns_per_op,
+				results[i].ns_per_op > 0 ? 1e9 / results[i].ns_per_op : 0);
+		if (results[i].cycles_per_op < 0)
+			fprintf(stream, "null}");
+		else
+			fprintf(stream, "%.2f}", results[i].cycles_per_op);
+		fprintf(stream, i + 1 < count ? ",\n" : "\n");
+	}
+	fprintf(stream, "  ]\n}\n");
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+			"Usage: %s [-c corpus] [-p passes] [-s seed] [-o file.json]\n"
+			"  -c corpus  Number of boards in the corpus (default 65536)\n"
+			"  -p passes  Passes over the corpus per kernel (default 64)\n"
+			"  -s seed    Seed used to build the corpus (default 2048)\n"
+			"  -o file    Write the results as JSON to the file, '-' for stdout and\n"
+			"             the table to stderr\n",
+			name);
+}
+
+/**
+ * @brief The standard main function
+ *
+ * Builds the corpus, runs every kernel and reports the results.
+ * The cost of copying the board is subtracted from the kernels that
+ * have to work on a scratch copy.
+ *
+ * @param argc Number of arguments
+ * @param argv Arguments
+ */
+int main(int argc, char **argv)
+{
+	size_t corpus_size = 65536;
+	unsigned long passes = 64;
+	uint64_t seed = 2048;
+	const char *json_path = NULL;
+	for (int i = 1; i < argc; i++)
+	{
+		if (i + 1 >= argc)
+		{
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		const char *value = argv[++i];
+		if (strcmp(argv[i - 1], "-c") == 0)
+			corpus_size = strtoul(value, NULL, 10);
+		else if (strcmp(argv[i - 1], "-p") == 0)
+			passes = strtoul(value, NULL, 10);
+		else if (strcmp(argv[i - 1], "-s") == 0)
+			seed = strtoull(value, NULL, 10);
+		else if (strcmp(argv[i - 1], "-o") == 0)
+			json_path = value;
+		else
+		{
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (corpus_size < PHASES || passes == 0)
+	{
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	bitboard_init();
+	g_sized = sized_ops(SIZE);
+	rng_seed(&g_rng, seed);
+	struct Corpus corpus;
+	if (!build_corpus(&corpus, corpus_size, seed))
+	{
+		fprintf(stderr, "The corpus couldn't be allocated.\n");
+		return EXIT_FAILURE;
+	}
+
+	//With the JSON on stdout, the table goes to stderr so stdout stays parseable
+	bool json_stdout = json_path != NULL && strcmp(json_path, "-") == 0;
+	FILE *table = json_stdout ? stderr : stdout;
+	size_t count = sizeof(g_kernels) / sizeof(g_kernels[0]);
+	struct Result results[sizeof(g_kernels) / sizeof(g_kernels[0]) + 4];
+	for (size_t i = 0; i < count; i++)
+		results[i] = measure(&g_kernels[i], &corpus, passes);
+	for (size_t i = 0; i < sizeof(g_kernels) / sizeof(g_kernels[0]); i++)
+	{
+		if (!g_kernels[i].copies)
+			continue;
+		results[i].ns_per_op -= results[0].ns_per_op;
+		if (results[i].cycles_per_op >= 0)
+			results[i].cycles_per_op -= results[0].cycles_per_op;
+	}
+	//The batch kernels step every board with a scored move and a spawn
+	results[count++] = measure_batch("batch_step", batch_step, &corpus, passes, seed);
+	results[count++] = measure_batch("batch_step_scalar", batch_step_scalar, &corpus, passes, seed);
+	fprintf(table, "Batch kernel: %s\n", batch_kernel());
+	//The environment adds the game over check, the auto-reset and the observations
+	results[count++] = measure_env("env_step", ENV_OBS_EXPONENTS, &corpus, passes, seed);
+	results[count++] = measure_env("env_step_onehot", ENV_OBS_ONEHOT, &corpus, passes, seed);
+
+	fprintf(table, "%-24s %12s %14s %12s\n", "kernel", "ns/op", "moves/sec", "cycles/op");
+	for (size_t i = 0; i < count; i++)
+	{
+		fprintf(table, "%-24s %12.3f %14.0f", results[i].name, results[i].ns_per_op,
+				results[i].ns_per_op > 0 ? 1e9 / results[i].ns_per_op : 0);
+		if (results[i].cycles_per_op < 0)
+			fprintf(table, " %12s\n", "-");
+		else
+			fprintf(table, " %12.2f\n", results[i].cycles_per_op);
+	}
+
+	if (json_path != NULL)
+	{
+		FILE *stream = json_stdout ? stdout : fopen(json_path, "w");
+		if (stream == NULL)
+		{
+			fprintf(stderr, "The file %s couldn't be opened.\n", json_path);
+			free_corpus(&corpus);
+			return EXIT_FAILURE;
+		}
+		write_json(stream, results, count, seed, corpus.count, passes);
+		if (stream != stdout)
+			fclose(stream);
+	}
+
+	free_corpus(&corpus);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,211 @@
+/**
+ * @file bitboard.c
+ * @author Gnik Droy
+ * @brief File containing implementation of the packed bitboard engine.
+ *
+ */
+#include "bitboard.h"
+#include "bits.h"
+#include <pthread.h>
+
+/** The number of distinct 16 bit rows */
+#define ROW_COUNT 65536
+
+/** The mask with the lowest bit of every nibble set */
+#define NIBBLE_LOW_BITS 0x1111111111111111ULL
+
+/** Result of moving every possible row to the left */
+static uint16_t g_row_left[ROW_COUNT];
+
+/** Result of moving every possible row to the right */
+static uint16_t g_row_right[ROW_COUNT];
+
+/** The score of the merges in every possible row, see row_merges() */
+static uint32_t g_row_merges[ROW_COUNT];
+
+/** Builds the row tables exactly once, see bitboard_init() */
+static pthread_once_t g_tables_once = PTHREAD_ONCE_INIT;
+
+static uint16_t reverse_row(uint16_t row)
+{
+	return (uint16_t)((row >> 12) | ((row >> 4) & 0x00F0) |
+					  ((row << 4) & 0x0F00) | (row << 12));
+}
+
+static uint16_t move_row_left(uint16_t row)
+{
+	//Same rules as shift_x() followed by merge_x(), on a single row
+	unsigned char out[SIZE] = {0};
+	unsigned int index = 0;
+	bool can_merge = false;
+	for (unsigned int y = 0; y < SIZE; y++)
+	{
+		unsigned char tile = (row >> (4 * y)) & 0xF;
+		if (tile == 0)
+			continue;
+		if (can_merge && out[index - 1] == tile && tile < BITBOARD_MAX_TILE)
+		{
+			out[index - 1]++;
+			can_merge = false;
+		}
+		else
+		{
+			out[index++] = tile;
+			can_merge = true;
+		}
+	}
+	uint16_t result = 0;
+	for (unsigned int y = 0; y < SIZE; y++)
+		result |= (uint16_t)(out[y] << (4 * y));
+	return result;
+}
+
+static uint32_t row_merges(uint16_t row)
+{
+	//The merged score goes in the low 24 bits, the largest merged tile
+	//in the high 8 bits. The pairs are the same in both directions.
+	uint32_t merged = 0, max_tile = 0;
+	unsigned char last = 0;
+	for (unsigned int y = 0; y < SIZE; y++)
+	{
+		unsigned char tile = (row >> (4 * y)) & 0xF;
+		if (tile == 0)
+			continue;
+		if (tile == last && tile < BITBOARD_MAX_TILE)
+		{
+			merged += (uint32_t)pow_int(BASE, tile + 1);
+			if (tile + 1u > max_tile)
+				max_tile = tile + 1u;
+			last = 0;
+		}
+		else
+		{
+			last = tile;
+		}
+	}
+	return merged | max_tile << 24;
+}
+
+static void build_tables(void)
+{
+	for (unsigned int row = 0; row < ROW_COUNT; row++)
+	{
+		uint16_t left = move_row_left((uint16_t)row);
+		g_row_left[row] = left;
+		g_row_right[reverse_row((uint16_t)row)] = reverse_row(left);
+		g_row_merges[row] = row_merges((uint16_t)row);
+	}
+}
+
+void bitboard_init(void)
+{
+	//Threads calling it at the same time wait for the first to finish
+	pthread_once(&g_tables_once, build_tables);
+}
+
+BitBoard board_to_bitboard(const Board board)
+{
+	BitBoard bitboard = 0;
+	for (unsigned int x = 0; x < SIZE; x++)
+	{
+		for (unsigned int y = 0; y < SIZE; y++)
+		{
+			BitBoard tile = board[x][y] > BITBOARD_MAX_TILE ? BITBOARD_MAX_TILE : board[x][y];
+			bitboard |= tile << (4 * (x * SIZE + y));
+		}
+	}
+	return bitboard;
+}
+
+void bitboard_to_board(BitBoard bitboard, Board board)
+{
+	for (unsigned int x = 0; x < SIZE; x++)
+	{
+		for (unsigned int y = 0; y < SIZE; y++)
+		{
+			board[x][y] = (bitboard >> (4 * (x * SIZE + y))) & 0xF;
+		}
+	}
+}
+
+BitBoard bitboard_transpose(BitBoard x)
+{
+	//Swap the 2x2 blocks of nibbles, then the 2x2 blocks of bytes
+	BitBoard a1 = x & 0xF0F00F0FF0F00F0FULL;
+	BitBoard a2 = x & 0x0000F0F00000F0F0ULL;
+	BitBoard a3 = x & 0x0F0F00000F0F0000ULL;
+	BitBoard a = a1 | (a2 << 12) | (a3 >> 12);
+	BitBoard b1 = a & 0xFF00FF0000FF00FFULL;
+	BitBoard b2 = a & 0x00FF00FF00000000ULL;
+	BitBoard b3 = a & 0x00000000FF00FF00ULL;
+	return b1 | (b2 >> 24) | (b3 << 24);
+}
+
+BitBoard bitboard_empty_mask(BitBoard bitboard)
+{
+	//Collapse every nibble into its lowest bit, set only if all four are 0
+	BitBoard x = ~bitboard;
+	x &= x >> 2;
+	x &= x >> 1;
+	return x & NIBBLE_LOW_BITS;
+}
+
+unsigned int bitboard_count_empty(BitBoard bitboard)
+{
+	return bits_popcount(bitboard_empty_mask(bitboard));
+}
+
+BitBoard bitboard_add_random(BitBoard bitboard, Rng *rng)
+{
+	BitBoard mask = bitboard_empty_mask(bitboard);
+	if (mask == 0)
+		return bitboard;
+	//The selected bit is the lowest bit of the empty nibble, i.e. a tile of 1
+	return bitboard | (BitBoard)1 << bits_select(mask, rng_bounded(rng, bits_popcount(mask)));
+}
+
+static BitBoard move_rows(BitBoard bitboard, const uint16_t *table)
+{
+	return (BitBoard)table[bitboard & 0xFFFF] |
+		   (BitBoard)table[(bitboard >> 16) & 0xFFFF] << 16 |
+		   (BitBoard)table[(bitboard >> 32) & 0xFFFF] << 32 |
+		   (BitBoard)table[(bitboard >> 48) & 0xFFFF] << 48;
+}
+
+BitBoard bitboard_move_x(BitBoard bitboard, bool opp)
+{
+	return move_rows(bitboard, opp ? g_row_right : g_row_left);
+}
+
+BitBoard bitboard_move_y(BitBoard bitboard, bool opp)
+{
+	BitBoard transposed = bitboard_transpose(bitboard);
+	return bitboard_transpose(move_rows(transposed, opp ? g_row_right : g_row_left));
+}
+
+BitBoard bitboard_move_direction(BitBoard bitboard, Direction dir)
+{
+	if (dir == DIRECTION_UP || dir == DIRECTION_DOWN)
+		return bitboard_move_y(bitboard, dir & 1);
+	return bitboard_move_x(bitboard, dir & 1);
+}
+
+void bitboard_update_score(BitBoard bitboard, Direction dir, Score *score)
+{
+	if (dir == DIRECTION_UP || dir == DIRECTION_DOWN)
+		bitboard = bitboard_transpose(bitboard);
+	for (unsigned int i = 0; i < 64; i += 16)
+	{
+		uint32_t merges = g_row_merges[(bitboard >> i) & 0xFFFF];
+		score_add_merges(score, merges & 0xFFFFFF, (unsigned char)(merges >> 24));
+	}
+}
+
+bool bitboard_is_game_over(BitBoard bitboard)
+{
+	//With no empty cells the board can only change through merges, and a
+	//merge is possible in one direction exactly when it is in the opposite.
+	return bitboard_count_empty(bitboard) == 0 &&
+		   bitboard_move_x(bitboard, 0) == bitboard &&
+		   bitboard_move_y(bitboard, 0) == bitboard;
+}
@@ -0,0 +1,418 @@
+/**
+ * @file check.c
+ * @author Gnik Droy
+ * @brief File containing the equivalence checks of the engines.
+ *
+ * The faster engines must play exactly like the scalar one in core.c.
+ * This compares the bitboard engine, the batch kernels and the sized
+ * kernels with it on random boards, and jumping to a move of a replay
+ * with playing it from the start. It also checks that the 8 symmetries
+ * of a board share its canonical board and that Zobrist hashes kept up
+ * to date move by move match hashes computed from scratch. It is run by
+ * ctest.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "core.h"
+#include "bitboard.h"
+#include "symmetry.h"
+#include "zobrist.h"
+#include "batch.h"
+#include "sized.h"
+#include "replay.h"
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+			"Usage: %s [-n boards] [-s seed]\n"
+			"  -n boards  Number of random boards to move in every direction (default 1000000)\n"
+			"  -s seed    Seed of the random boards (default 2048)\n",
+			name);
+}
+
+/** Moves a board with the scalar functions of core.c only. */
+static bool scalar_move(Board board, Direction dir, Score *score)
+{
+	bool opp = dir & 1;
+	bool a, b;
+	if (dir == DIRECTION_UP || dir == DIRECTION_DOWN)
+	{
+		a = shift_y(board, opp);
+		b = merge_y(board, opp, score);
+	}
+	else
+	{
+		a = shift_x(board, opp);
+		b = merge_x(board, opp, score);
+	}
+	return a || b;
+}
+
+/** Compares the bitboard engine with the scalar one. Returns the number of mismatches. */
+static unsigned long check_bitboard(unsigned long count, uint64_t seed)
+{
+	Rng rng;
+	rng_seed(&rng, seed);
+	unsigned long failures = 0;
+	for (unsigned long i = 0; i < count; i++)
+	{
+		unsigned char board[SIZE][SIZE];
+		//Tiles below BITBOARD_MAX_TILE, where the engines cap merges differently
+		for (unsigned int x = 0; x < SIZE; x++)
+			for (unsigned int y = 0; y < SIZE; y++)
+				board[x][y] = (unsigned char)rng_bounded(&rng, BITBOARD_MAX_TILE);
+		BitBoard packed = board_to_bitboard(board);
+		if (bitboard_is_game_over(packed) != is_game_over(board))
+			failures++;
+		for (unsigned int dir = 0; dir < 4; dir++)
+		{
+			unsigned char moved[SIZE][SIZE], unpacked[SIZE][SIZE];
+			memcpy(moved, board, sizeof(board));
+			Score score = {0, 0, 0}, packed_score = {0, 0, 0};
+			bool changed = scalar_move(moved, (Direction)dir, &score);
+			BitBoard after = bitboard_move_direction(packed, (Direction)dir);
+			bitboard_update_score(packed, (Direction)dir, &packed_score);
+			bitboard_to_board(after, unpacked);
+			if (changed != (after != packed) || memcmp(moved, unpacked, sizeof(moved)) != 0 ||
+				score.merged != packed_score.merged)
+			{
+				if (failures++ == 0)
+				{
+					fprintf(stderr, "bitboard: direction %u of this board differs\n", dir);
+					print_board(board, stderr);
+				}
+			}
+		}
+	}
+	return failures;
+}
+
+/**
+ * Checks that every symmetry of a random board has the same canonical
+ * board, and that moves map through the symmetries. Returns the number
+ * of mismatches.
+ */
+static unsigned long check_symmetry(unsigned long count, uint64_t seed)
+{
+	Rng rng;
+	rng_seed(&rng, seed);
+	unsigned long failures = 0;
+	for (unsigned long i = 0; i < count; i++)
+	{
+		BitBoard board = rng_next(&rng);
+		unsigned int symmetry;
+		BitBoard canonical = bitboard_canonical(board, &symmetry);
+		bool same = bitboard_symmetry(board, symmetry) == canonical &&
+					bitboard_symmetry(canonical, symmetry_inverse(symmetry)) == board;
+		for (unsigned int s = 0; s < SYMMETRY_COUNT; s++)
+		{
+			BitBoard transformed = bitboard_symmetry(board, s);
+			same = same && bitboard_canonical(transformed, NULL) == canonical;
+			for (unsigned int dir = 0; dir < 4; dir++)
+			{
+				BitBoard moved = bitboard_move_direction(board, (Direction)dir);
+				same = same && bitboard_move_direction(transformed, symmetry_direction(s, (Direction)dir)) ==
+								   bitboard_symmetry(moved, s);
+			}
+		}
+		if (!same && failures++ == 0)
+			fprintf(stderr, "symmetry: the symmetries of %016llx differ\n", (unsigned long long)board);
+	}
+	return failures;
+}
+
+/**
+ * Plays random games and keeps their Zobrist hash up to date with every
+ * move and new tile. Returns the number of times it differs from the
+ * hash of the whole board.
+ */
+static unsigned long check_zobrist(uint64_t seed)
+{
+	zobrist_init();
+	Rng rng;
+	rng_seed(&rng, seed);
+	unsigned long failures = 0;
+	for (unsigned int game = 0; game < 1000; game++)
+	{
+		BitBoard board = bitboard_add_random(0, &rng);
+		uint64_t hash = zobrist_hash(board);
+		while (!bitboard_is_game_over(board))
+		{
+			BitBoard moved = bitboard_move_direction(board, (Direction)rng_bounded(&rng, 4));
+			if (moved == board)
+				continue;
+			hash = zobrist_update(hash, board, moved);
+			board = bitboard_add_random(moved, &rng);
+			//The new tile is the only nibble that changed
+			unsigned int cell = (unsigned int)__builtin_ctzll(board ^ moved) / 4;
+			hash = zobrist_add_tile(hash, cell, (unsigned int)(board >> (4 * cell)) & 0xF);
+			if (hash != zobrist_hash(board))
+			{
+				if (failures++ == 0)
+					fprintf(stderr, "zobrist: the hash of game %u differs after a move\n", game);
+				hash = zobrist_hash(board);
+			}
+		}
+	}
+	return failures;
+}
+
+/** Compares batch_step() with batch_step_scalar(). Returns the number of mismatches. */
+static unsigned long check_batch(uint64_t seed)
+{
+	size_t games = 1000, steps = 500;
+	Batch *fast = batch_create(games, seed), *slow = batch_create(games, seed);
+	unsigned char *dirs = malloc(games), *moved[2] = {malloc(games), malloc(games)};
+	uint32_t *merged[2] = {malloc(games * sizeof(uint32_t)), malloc(games * sizeof(uint32_t))};
+	if (fast == NULL || slow == NULL || dirs == NULL || moved[0] == NULL || moved[1] == NULL ||
+		merged[0] == NULL || merged[1] == NULL)
+	{
+		fprintf(stderr, "batch: out of memory\n");
+		return 1;
+	}
+	Rng rng;
+	rng_seed(&rng, seed);
+	unsigned long failures = 0;
+	for (size_t step = 0; step < steps; step++)
+	{
+		for (size_t i = 0; i < games; i++)
+			dirs[i] = (unsigned char)rng_bounded(&rng, 4);
+		batch_step(fast, dirs, moved[0], merged[0]);
+		batch_step_scalar(slow, dirs, moved[1], merged[1]);
+		if (memcmp(moved[0], moved[1], games) != 0 || memcmp(merged[0], merged[1], games * sizeof(uint32_t)) != 0)
+			failures++;
+		for (size_t i = 0; i < games; i++)
+		{
+			unsigned char a[SIZE][SIZE], b[SIZE][SIZE];
+			batch_get_board(fast, i, a);
+			batch_get_board(slow, i, b);
+			if (memcmp(a, b, sizeof(a)) != 0)
+				failures++;
+		}
+	}
+	if (failures > 0)
+		fprintf(stderr, "batch: the %s kernels differ from the scalar ones\n", batch_kernel());
+	batch_destroy(fast);
+	batch_destroy(slow);
+	free(dirs);
+	free(moved[0]);
+	free(moved[1]);
+	free(merged[0]);
+	free(merged[1]);
+	return failures;
+}
+
+/** Checks that a sized board is only over when no direction moves it. Returns the number of mismatches. */
+static unsigned long check_sized_game_over(const SizedOps *ops, const unsigned char *cells)
+{
+	bool over = true;
+	for (unsigned int dir = 0; dir < 4 && over; dir++)
+	{
+		unsigned char moved[SIZED_MAX * SIZED_MAX];
+		memcpy(moved, cells, ops->size * ops->size);
+		over = !sized_move(ops, moved, (Direction)dir, NULL);
+	}
+	return over != sized_is_game_over(ops, cells);
+}
+
+/**
+ * Plays random games with move_with_spawn() and the 4x4 sized kernels
+ * from the same seed, and smoke tests the unrolled and generic kernels
+ * of other sizes. Returns the number of mismatches.
+ */
+static unsigned long check_sized(uint64_t seed)
+{
+	unsigned long failures = 0;
+	const SizedOps *ops = sized_ops(SIZE);
+	for (unsigned int game = 0; game < 3000; game++)
+	{
+		Rng rng, sized_rng;
+		rng_seed(&rng, seed + game);
+		rng_seed(&sized_rng, seed + game);
+		unsigned char board[SIZE][SIZE], cells[SIZE * SIZE];
+		Score score, sized_score;
+		clear_board(board);
+		sized_clear(ops, cells);
+		bool same = add_random(board, &rng) == sized_add_random(ops, cells, &sized_rng);
+		score_reset(&score, board);
+		sized_score_reset(ops, cells, &sized_score);
+		while (same && !is_game_over(board))
+		{
+			Direction dir = (Direction)rng_bounded(&rng, 4);
+			rng_bounded(&sized_rng, 4);
+			same = move_with_spawn(board, dir, &rng, &score) ==
+					   sized_move_with_spawn(ops, cells, dir, &sized_rng, &sized_score) &&
+				   memcmp(board, cells, sizeof(cells)) == 0 && score.sum == sized_score.sum &&
+				   score.merged == sized_score.merged && score.max_tile == sized_score.max_tile;
+		}
+		if (!same || !sized_is_game_over(ops, cells))
+		{
+			if (failures++ == 0)
+				fprintf(stderr, "sized: game %u differs from move_with_spawn()\n", game);
+		}
+	}
+
+	//Sizes 3 to SIZED_UNROLLED are unrolled, larger ones take the generic kernels
+	const unsigned int sizes[] = {3, 8, 9, SIZED_MAX};
+	for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	{
+		ops = sized_ops(sizes[i]);
+		unsigned char cells[SIZED_MAX * SIZED_MAX];
+		Rng rng;
+		rng_seed(&rng, seed + sizes[i]);
+		Score score, rescored;
+		sized_clear(ops, cells);
+		sized_add_random(ops, cells, &rng);
+		sized_score_reset(ops, cells, &score);
+		//The large boards are only played for a while
+		for (unsigned long moves = 0; moves < 20000 && !sized_is_game_over(ops, cells); moves++)
+		{
+			sized_move_with_spawn(ops, cells, (Direction)rng_bounded(&rng, 4), &rng, &score);
+			if (moves % 64 == 0)
+				failures += check_sized_game_over(ops, cells);
+		}
+		failures += check_sized_game_over(ops, cells);
+		sized_score_reset(ops, cells, &rescored);
+		if (score.sum != rescored.sum || score.max_tile != rescored.max_tile)
+		{
+			fprintf(stderr, "sized: the %s kernels of size %u keep a wrong score\n", ops->kernel, sizes[i]);
+			failures++;
+		}
+	}
+	return failures;
+}
+
+/** Records random games and plays them back. Returns the number of mismatches. */
+static unsigned long check_replay(uint64_t seed)
+{
+	char path[] = "/tmp/2048-check-XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0)
+	{
+		fprintf(stderr, "replay: the temporary file couldn't be created\n");
+		return 1;
+	}
+	close(fd);
+	unlink(path);
+
+	unsigned int games = 50;
+	unsigned char (*finals)[SIZE][SIZE] = malloc(games * sizeof(*finals));
+	unsigned long *scores = malloc(games * sizeof(unsigned long));
+	ReplayWriter *writer = replay_writer_open(path);
+	if (finals == NULL || scores == NULL || writer == NULL)
+	{
+		fprintf(stderr, "replay: the replay couldn't be written\n");
+		return 1;
+	}
+	replay_set_keyframes(writer, 16);
+	Rng rng;
+	for (unsigned int game = 0; game < games; game++)
+	{
+		rng_seed(&rng, seed + game);
+		Score score;
+		clear_board(finals[game]);
+		unsigned int cell = add_random(finals[game], &rng);
+		score_reset(&score, finals[game]);
+		replay_begin(writer, seed + game, cell);
+		while (!is_game_over(finals[game]))
+		{
+			Direction dir = (Direction)rng_bounded(&rng, 4);
+			int spawn = move_with_spawn(finals[game], dir, &rng, &score);
+			if (spawn >= 0)
+				replay_move(writer, dir, (unsigned int)spawn);
+		}
+		replay_end(writer);
+		scores[game] = score.merged;
+	}
+	unsigned long failures = 0;
+	if (!replay_writer_close(writer))
+	{
+		fprintf(stderr, "replay: the replay couldn't be written\n");
+		failures++;
+	}
+
+	ReplayReader *reader = replay_reader_open(path);
+	ReplayGame replay;
+	unsigned int read = 0;
+	while (reader != NULL && replay_reader_next(reader, &replay))
+	{
+		unsigned char played[SIZE][SIZE], seeked[SIZE][SIZE];
+		Score played_score, seeked_score;
+		replay_play(&replay, replay.moves, played, &played_score);
+		if (read >= games || memcmp(played, finals[read], sizeof(played)) != 0 || played_score.merged != scores[read])
+			failures++;
+		for (uint32_t move = 0; move <= replay.moves; move += 7)
+		{
+			replay_play(&replay, move, played, &played_score);
+			replay_seek(&replay, move, seeked, &seeked_score);
+			if (memcmp(played, seeked, sizeof(played)) != 0 || played_score.merged != seeked_score.merged)
+				failures++;
+		}
+		read++;
+	}
+	if (reader == NULL || read != games)
+		failures++;
+	if (failures > 0)
+		fprintf(stderr, "replay: %u of %u games read back, playback differs\n", read, games);
+	replay_reader_close(reader);
+	unlink(path);
+	free(finals);
+	free(scores);
+	return failures;
+}
+
+/**
+ * @brief The standard main function
+ *
+ * Runs every check and prints its mismatches.
+ *
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return EXIT_SUCCESS if every engine matches the scalar one
+ */
+int main(int argc, char **argv)
+{
+	unsigned long boards = 1000000;
+	uint64_t seed = 2048;
+	for (int i = 1; i < argc; i++)
+	{
+		if (i + 1 >= argc)
+		{
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		const char *arg = argv[i], *value = argv[++i];
+		if (strcmp(arg, "-n") == 0)
+			boards = strtoul(value, NULL, 10);
+		else if (strcmp(arg, "-s") == 0)
+			seed = strtoull(value, NULL, 10);
+		else
+		{
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	bitboard_init();
+	unsigned long failures = 0, found;
+	found = check_bitboard(boards, seed);
+	printf("bitboard: %lu boards, %lu mismatches\n", boards, found);
+	failures += found;
+	found = check_symmetry(boards, seed);
+	printf("symmetry: %lu boards, %lu mismatches\n", boards, found);
+	failures += found;
+	found = check_zobrist(seed);
+	printf("zobrist: %lu mismatches\n", found);
+	failures += found;
+	found = check_batch(seed);
+	printf("batch (%s): %lu mismatches\n", batch_kernel(), found);
+	failures += found;
+	found = check_sized(seed);
+	printf("sized: %lu mismatches\n", found);
+	failures += found;
+	found = check_replay(seed);
+	printf("replay: %lu mismatches\n", found);
+	failures += found;
+	return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -5,8 +5,12 @@
  *
  */
 #include <stdlib.h>
-#include <time.h>
+#include <string.h>
 #include "core.h"
+#include "bits.h"
+#ifdef USE_BITBOARD
+#include "bitboard.h"
+#endif
 
 unsigned long pow_int(int base, int exponent)
 {
@@ -54,6 +58,21 @@ unsigned long calculate_score(const Board board)
 	return score;
 }
 
+void score_reset(Score *score, const Board board)
+{
+	score->sum = calculate_score(board);
+	score->merged = 0;
+	score->max_tile = 0;
+	for (unsigned int x = 0; x < SIZE; x++)
+	{
+		for (unsigned int y = 0; y < SIZE; y++)
+		{
+			if (board[x][y] > score->max_tile)
+				score->max_tile = board[x][y];
+		}
+	}
+}
+
 void print_board(const Board board, FILE *stream)
 {
 	for (unsigned int x = 0; x < SIZE; x++)
@@ -74,27 +93,44 @@ void print_board(const Board board, FILE *stream)
 	fprintf(stream, "\n");
 }
 
-void add_random(Board board)
+uint64_t empty_mask(const Board board)
 {
-	unsigned int pos[SIZE * SIZE];
-	unsigned int len = 0;
-	for (unsigned int x = 0; x < SIZE; x++)
+	const unsigned char *cells = &board[0][0];
+	uint64_t mask = 0;
+	unsigned int i = 0;
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	//Test eight cells at once. The high bit of a byte ends up set exactly
+	//when the byte is 0, then the multiply gathers the eight high bits.
+	const uint64_t low7 = 0x7F7F7F7F7F7F7F7FULL;
+	for (; i + 8 <= SIZE * SIZE; i += 8)
 	{
-		for (unsigned int y = 0; y < SIZE; y++)
-		{
-			if (board[x][y] == 0)
-			{
-				pos[len] = x * SIZE + y;
-				len++;
-			}
-		}
+		uint64_t word;
+		memcpy(&word, cells + i, sizeof(word));
+		uint64_t zero = ~(((word & low7) + low7) | word | low7);
+		mask |= (((zero >> 7) * 0x0102040810204080ULL) >> 56) << i;
 	}
-	unsigned int index = rand() % len;
-	board[pos[index] / SIZE][pos[index] % SIZE] = 1;
+#endif
+	for (; i < SIZE * SIZE; i++)
+		mask |= (uint64_t)(cells[i] == 0) << i;
+	return mask;
+}
+
+unsigned int add_random(Board board, Rng *rng)
+{
+	uint64_t mask = empty_mask(board);
+	if (mask == 0)
+		return SIZE * SIZE;
+	unsigned int cell = bits_select(mask, rng_bounded(rng, bits_popcount(mask)));
+	board[cell / SIZE][cell % SIZE] = 1;
+	return cell;
 }
 
 bool is_game_over(const Board board)
 {
+#ifdef USE_BITBOARD
+	bitboard_init();
+	return bitboard_is_game_over(board_to_bitboard(board));
+#else
 	for (unsigned int x = 0; x < SIZE - 1; x++)
 	{
 		for (unsigned int y = 0; y < SIZE - 1; y++)
@@ -113,7 +149,9 @@ bool is_game_over(const Board board)
 			board[SIZE - 1][x] == 0)
 			return false;
 	}
-	return true;
+	//The corner is not covered by the loop above
+	return board[SIZE - 1][SIZE - 1] != 0;
+#endif
 }
 
 bool shift_x(Board board, bool opp)
@@ -145,7 +183,7 @@ bool shift_x(Board board, bool opp)
 	}
 	return moved;
 }
-bool merge_x(Board board, bool opp)
+bool merge_x(Board board, bool opp, Score *score)
 {
 	bool merged = false;
 	int start = 0, end = SIZE - 1, increment = 1;
@@ -166,6 +204,7 @@ bool merge_x(Board board, bool opp)
 				{
 					board[x][index] = board[x][y] + 1;
 					board[x][y + increment] = 0;
+					score_add_merges(score, pow_int(BASE, board[x][index]), board[x][index]);
 					if (index != y)
 						board[x][y] = 0;
 					merged = true;
@@ -190,7 +229,7 @@ bool merge_x(Board board, bool opp)
 	}
 	return merged;
 }
-bool merge_y(Board board, bool opp)
+bool merge_y(Board board, bool opp, Score *score)
 {
 	bool merged = false;
 	int start = 0, end = SIZE - 1, increment = 1;
@@ -211,6 +250,7 @@ bool merge_y(Board board, bool opp)
 				{
 					board[index][y] = board[x][y] + 1;
 					board[x + increment][y] = 0;
+					score_add_merges(score, pow_int(BASE, board[index][y]), board[index][y]);
 					if (index != x)
 						board[x][y] = 0;
 					index += increment;
@@ -264,20 +304,63 @@ bool shift_y(Board board, bool opp)
 	return moved;
 }
 
-inline void move_y(Board board, bool opp)
+bool move_tiles(Board board, Direction dir, Score *score)
 {
+	bool vertical = dir == DIRECTION_UP || dir == DIRECTION_DOWN;
+	bool opp = dir & 1;
+#ifdef USE_BITBOARD
+	bitboard_init();
+	BitBoard before = board_to_bitboard(board);
+	BitBoard after = vertical ? bitboard_move_y(before, opp) : bitboard_move_x(before, opp);
+	if (after == before)
+		return false;
+	if (score != NULL)
+		bitboard_update_score(before, dir, score);
+	bitboard_to_board(after, board);
+	return true;
+#else
 	//Assigning values insted of evaluating directly to force both operations
 	//Bypassing lazy 'OR' evaluation
-	bool a = shift_y(board, opp), b = merge_y(board, opp);
-	if (a || b)
-		add_random(board);
+	bool a, b;
+	if (vertical)
+	{
+		a = shift_y(board, opp);
+		b = merge_y(board, opp, score);
+	}
+	else
+	{
+		a = shift_x(board, opp);
+		b = merge_x(board, opp, score);
+	}
+	return a || b;
+#endif
 }
 
-inline void move_x(Board board, bool opp)
+int move_with_spawn(Board board, Direction dir, Rng *rng, Score *score)
 {
-	//Assigning values insted of evaluating directly to force both operations
-	//Bypassing lazy 'OR' evaluation
-	bool a = shift_x(board, opp), b = merge_x(board, opp);
-	if (a || b)
-		add_random(board);
+	if (!move_tiles(board, dir, score))
+		return -1;
+	unsigned int cell = add_random(board, rng);
+	if (score != NULL && cell < SIZE * SIZE)
+	{
+		score->sum += BASE;
+		if (score->max_tile < 1)
+			score->max_tile = 1;
+	}
+	return (int)cell;
+}
+
+inline bool move_y(Board board, bool opp, Rng *rng)
+{
+	return move_with_spawn(board, opp ? DIRECTION_DOWN : DIRECTION_UP, rng, NULL) >= 0;
+}
+
+inline bool move_x(Board board, bool opp, Rng *rng)
+{
+	return move_with_spawn(board, opp ? DIRECTION_RIGHT : DIRECTION_LEFT, rng, NULL) >= 0;
+}
+
+bool move_direction(Board board, Direction dir, Rng *rng)
+{
+	return move_with_spawn(board, dir, rng, NULL) >= 0;
 }
@@ -0,0 +1,147 @@
+/**
+ * @file env.c
+ * @author Gnik Droy
+ * @brief File containing implementation of the vectorized environment.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "env.h"
+#include "batch.h"
+
+/** @def CELLS
+ * The number of cells on a board.
+ */
+#define CELLS (SIZE * SIZE)
+
+/** @struct Env
+ *  @brief The state of an environment.
+ *
+ *  @var Env::batch
+ *  The games
+ *  @var Env::observation
+ *  The layout of the observations
+ *  @var Env::next_seed
+ *  The seed of the next game started by an auto-reset
+ *  @var Env::actions
+ *  The directions of the current step
+ *  @var Env::merged
+ *  The merge score of each game in the current step
+ *  @var Env::over
+ *  If each game is over after the current step
+ */
+struct Env
+{
+	Batch *batch;
+	EnvObservation observation;
+	uint64_t next_seed;
+	unsigned char *actions;
+	uint32_t *merged;
+	unsigned char *over;
+};
+
+uint32_t env_abi_version(void)
+{
+	return ENV_ABI_VERSION;
+}
+
+Env *env_create(size_t n, uint64_t seed, EnvObservation observation)
+{
+	if (observation != ENV_OBS_EXPONENTS && observation != ENV_OBS_ONEHOT)
+		return NULL;
+	Env *env = calloc(1, sizeof(Env));
+	if (env == NULL)
+		return NULL;
+	env->observation = observation;
+	env->batch = batch_create(n, seed);
+	env->actions = malloc(n ? n : 1);
+	env->merged = malloc((n ? n : 1) * sizeof(uint32_t));
+	env->over = malloc(n ? n : 1);
+	if (env->batch == NULL || env->actions == NULL || env->merged == NULL || env->over == NULL)
+	{
+		env_destroy(env);
+		return NULL;
+	}
+	env->next_seed = seed + n;
+	return env;
+}
+
+void env_destroy(Env *env)
+{
+	if (env == NULL)
+		return;
+	batch_destroy(env->batch);
+	free(env->actions);
+	free(env->merged);
+	free(env->over);
+	free(env);
+}
+
+size_t env_count(const Env *env)
+{
+	return batch_count(env->batch);
+}
+
+size_t env_observation_size(const Env *env)
+{
+	return env->observation == ENV_OBS_ONEHOT ? ENV_PLANES * CELLS : CELLS;
+}
+
+/** Writes the observation of every game from the cell planes of the batch. */
+static void observe(const Env *env, float *obs_out)
+{
+	const unsigned char *cells = batch_cells(env->batch);
+	size_t count = batch_count(env->batch), stride = batch_stride(env->batch);
+	if (env->observation == ENV_OBS_EXPONENTS)
+	{
+		//Plane by plane, so the batch is read in order
+		for (unsigned int c = 0; c < CELLS; c++)
+		{
+			const unsigned char *plane = cells + c * stride;
+			for (size_t i = 0; i < count; i++)
+				obs_out[i * CELLS + c] = plane[i];
+		}
+		return;
+	}
+	memset(obs_out, 0, count * ENV_PLANES * CELLS * sizeof(float));
+	for (unsigned int c = 0; c < CELLS; c++)
+	{
+		const unsigned char *plane = cells + c * stride;
+		//Tiles of 2^16 and above share the last plane
+		for (size_t i = 0; i < count; i++)
+			obs_out[(i * ENV_PLANES + (plane[i] < ENV_PLANES ? plane[i] : ENV_PLANES - 1)) * CELLS + c] = 1;
+	}
+}
+
+void env_reset(Env *env, uint64_t seed, float *obs_out)
+{
+	size_t count = batch_count(env->batch);
+	for (size_t i = 0; i < count; i++)
+		batch_reset(env->batch, i, seed + i);
+	env->next_seed = seed + count;
+	if (obs_out != NULL)
+		observe(env, obs_out);
+}
+
+size_t env_step(Env *env, const uint8_t *actions, float *obs_out, float *reward_out, uint8_t *done_out)
+{
+	size_t count = batch_count(env->batch);
+	for (size_t i = 0; i < count; i++)
+		env->actions[i] = actions[i] & 3;
+	batch_step(env->batch, env->actions, NULL, env->merged);
+	size_t done = batch_game_over(env->batch, env->over);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (reward_out != NULL)
+			reward_out[i] = (float)env->merged[i];
+		if (done_out != NULL)
+			done_out[i] = env->over[i];
+	}
+	//Games are started over in order, so the seeds only depend on the actions
+	for (size_t i = 0; done > 0 && i < count; i++)
+		if (env->over[i])
+			batch_reset(env->batch, i, env->next_seed++);
+	observe(env, obs_out);
+	return done;
+}
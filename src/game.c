@@ -6,8 +6,11 @@
  */
 #include "styles.h"
 #include "game.h"
+#include "replay.h"
+#include "ai.h"
 #include <time.h>
 #include <stdlib.h>
+#include <string.h>
 #include <SDL2/SDL_mixer.h>
 
 /** The pointer to the background music.*/
@@ -16,6 +19,246 @@ Mix_Music *g_background_music;
 /** The pointer to the mix music chunk.*/
 Mix_Chunk *g_mix_music;
 
+/** The random number generator of the game.*/
+Rng g_rng;
+
+/** The score of the game, updated on every move.*/
+Score g_score;
+
+/** The replay the games are recorded to, or NULL when not recording.*/
+ReplayWriter *g_replay;
+
+/** @def ASSETS_FONTS
+ * The event code of the assets event when the fonts are loaded.
+ */
+#define ASSETS_FONTS 1
+
+/** @def ASSETS_AUDIO
+ * The event code of the assets event when the audio is loaded.
+ */
+#define ASSETS_AUDIO 2
+
+/** The font used for the title.*/
+TTF_Font *g_title_font;
+
+/** The font used for "Game Over".*/
+TTF_Font *g_gover_font;
+
+/** The font used for the cells, the score and the button.*/
+TTF_Font *g_cell_font;
+
+/** Set to 1 once load_assets() opened the fonts.*/
+SDL_atomic_t g_fonts_ready;
+
+/** Set to 1 once load_assets() loaded the music and the sound.*/
+SDL_atomic_t g_audio_ready;
+
+/** The text shown over the game, or NULL when there is none.*/
+const char *g_overlay_text;
+
+/** The address of the font of the overlay text.*/
+TTF_Font **g_overlay_font;
+
+/** The time in milliseconds when the overlay is hidden.*/
+Uint32 g_overlay_until;
+
+/** @struct TextEntry
+ *  @brief A rasterized text kept by the text cache.
+ *
+ *  @var TextEntry::font
+ *  The font of the text, NULL for an unused entry
+ *  @var TextEntry::color
+ *  The color of the text
+ *  @var TextEntry::text
+ *  The text
+ *  @var TextEntry::texture
+ *  The rasterized text
+ *  @var TextEntry::w
+ *  The width of the texture
+ *  @var TextEntry::h
+ *  The height of the texture
+ *  @var TextEntry::last_used
+ *  The value of g_text_clock when the entry was last used
+ */
+struct TextEntry
+{
+	TTF_Font *font;
+	SDL_Color color;
+	char text[TEXT_CACHE_MAX_LEN];
+	SDL_Texture *texture;
+	int w;
+	int h;
+	unsigned long last_used;
+};
+
+/** The cell of the tile added by the last move, or -1 when it is not animated.*/
+int g_spawn_cell = -1;
+
+/** The time the spawn animation started at, in milliseconds.*/
+Uint32 g_spawn_start;
+
+/** @def DRAWN_NONE
+ * The value of a cell of g_drawn that has to be drawn again.
+ */
+#define DRAWN_NONE 0xFF
+
+/** The exponents of the tiles as drawn to the board layer, see draw_board().*/
+unsigned char g_drawn[SIZE][SIZE];
+
+/** The texture holding the board as last drawn, or NULL when render 
+ *  targets can't be used.*/
+SDL_Texture *g_board_layer;
+
+/** Set once creating g_board_layer failed, the board is then drawn 
+ *  in full every frame.*/
+bool g_board_layer_failed;
+
+/** If g_board_layer holds the static parts drawn with g_board_layer_font.*/
+bool g_board_layer_valid;
+
+/** The font the labels in g_board_layer were drawn with.*/
+TTF_Font *g_board_layer_font;
+
+/** The CPU time in seconds the main thread spent while the game loop was idle.*/
+double g_idle_cpu;
+
+/** The wall time in milliseconds the game loop was idle.*/
+Uint32 g_idle_ms;
+
+/** The text cache.*/
+struct TextEntry g_text_cache[TEXT_CACHE_SIZE];
+
+/** Counts the text cache lookups, used to find the least recently used entry.*/
+unsigned long g_text_clock;
+
+/** @struct Histogram
+ *  @brief The timings of a section, see profile_end().
+ *
+ *  @var Histogram::count
+ *  The number of timed calls
+ *  @var Histogram::max_us
+ *  The slowest call in microseconds
+ *  @var Histogram::buckets
+ *  Bucket i counts the calls that took from 2^(i-1) up to 2^i
+ *  microseconds, the last one every slower call
+ */
+struct Histogram
+{
+	SDL_atomic_t count;
+	SDL_atomic_t max_us;
+	SDL_atomic_t buckets[PROFILE_BUCKETS];
+};
+
+/** The histograms of the timed sections, indexed by ProfileSection.*/
+struct Histogram g_profile[PROFILE_COUNT];
+
+/** The names of the timed sections in the JSON of write_profile().*/
+const char *g_profile_names[PROFILE_COUNT] = {"render_game", "draw_board", "draw_text", "rasterize",
+											  "texture_upload", "present", "handle_move"};
+
+/** The number of textures created from surfaces.*/
+unsigned long g_texture_uploads;
+
+/** The number of frames presented.*/
+unsigned long g_frames;
+
+/** The font of the frame statistics.*/
+TTF_Font *g_hud_font;
+
+/** If the frame statistics are shown.*/
+bool g_hud;
+
+/** The time in microseconds render_game() took for the last frame.*/
+Uint32 g_frame_us;
+
+/** The textures uploaded during the last frame.*/
+unsigned long g_frame_uploads;
+
+/** The frames presented per second, counted once a second.*/
+unsigned int g_fps;
+
+/** The frames presented since g_fps_start.*/
+unsigned int g_fps_frames;
+
+/** The time in milliseconds g_fps_frames started counting at.*/
+Uint32 g_fps_start;
+
+Uint32 profile_end(ProfileSection section, Uint64 start)
+{
+	Uint64 us64 = (SDL_GetPerformanceCounter() - start) * 1000000 / SDL_GetPerformanceFrequency();
+	Uint32 us = us64 > SDL_MAX_SINT32 ? SDL_MAX_SINT32 : (Uint32)us64;
+	struct Histogram *histogram = &g_profile[section];
+	unsigned int bucket = 0;
+	while (bucket < PROFILE_BUCKETS - 1 && us >> bucket != 0)
+		bucket++;
+	SDL_AtomicAdd(&histogram->buckets[bucket], 1);
+	SDL_AtomicAdd(&histogram->count, 1);
+	int max = SDL_AtomicGet(&histogram->max_us);
+	while ((int)us > max && !SDL_AtomicCAS(&histogram->max_us, max, (int)us))
+		max = SDL_AtomicGet(&histogram->max_us);
+	return us;
+}
+
+/** Returns the upper bound in microseconds of the bucket a quantile of
+ *  the calls falls into, 0 without calls. */
+static unsigned long profile_quantile(struct Histogram *histogram, double q)
+{
+	int count = SDL_AtomicGet(&histogram->count);
+	if (count == 0)
+		return 0;
+	double seen = 0;
+	for (unsigned int i = 0; i < PROFILE_BUCKETS - 1; i++)
+	{
+		seen += SDL_AtomicGet(&histogram->buckets[i]);
+		if (seen >= q * count)
+			return 1ul << i;
+	}
+	return (unsigned long)SDL_AtomicGet(&histogram->max_us);
+}
+
+void write_profile(FILE *stream)
+{
+	fprintf(stream, "{\n  \"frames\": %lu,\n  \"texture_uploads\": %lu,\n", g_frames, g_texture_uploads);
+	for (int i = 0; i < PROFILE_COUNT; i++)
+	{
+		struct Histogram *histogram = &g_profile[i];
+		fprintf(stream, "  \"%s\": {\"count\": %d, \"p50_us\": %lu, \"p99_us\": %lu, \"max_us\": %d, \"us_below\": {",
+				g_profile_names[i], SDL_AtomicGet(&histogram->count), profile_quantile(histogram, 0.5),
+				profile_quantile(histogram, 0.99), SDL_AtomicGet(&histogram->max_us));
+		bool first = true;
+		for (unsigned int j = 0; j < PROFILE_BUCKETS; j++)
+		{
+			int calls = SDL_AtomicGet(&histogram->buckets[j]);
+			if (calls == 0)
+				continue;
+			//The last bucket has no upper bound
+			if (j == PROFILE_BUCKETS - 1)
+				fprintf(stream, "%s\"inf\": %d", first ? "" : ", ", calls);
+			else
+				fprintf(stream, "%s\"%lu\": %d", first ? "" : ", ", 1ul << j, calls);
+			first = false;
+		}
+		fprintf(stream, "}}%s\n", i + 1 < PROFILE_COUNT ? "," : "");
+	}
+	fprintf(stream, "}\n");
+}
+
+/** Rasterizes a text and uploads it to a texture, timing both steps. */
+static SDL_Texture *upload_text(SDL_Renderer *renderer, TTF_Font *font, const char *text, SDL_Color color)
+{
+	Uint64 start = SDL_GetPerformanceCounter();
+	SDL_Surface *surface = TTF_RenderText_Blended(font, text, color);
+	profile_end(PROFILE_RASTERIZE, start);
+	if (surface == NULL)
+		return NULL;
+	start = SDL_GetPerformanceCounter();
+	SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
+	profile_end(PROFILE_UPLOAD, start);
+	g_texture_uploads++;
+	SDL_FreeSurface(surface);
+	return texture;
+}
+
 bool initSDL(SDL_Window **window, SDL_Renderer **renderer)
 {
 	TTF_Init();
@@ -45,19 +288,116 @@ bool initSDL(SDL_Window **window, SDL_Renderer **renderer)
 	return true;
 }
 
+static bool same_color(SDL_Color a, SDL_Color b)
+{
+	return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+SDL_Texture *get_text_texture(SDL_Renderer *renderer, TTF_Font *font, const char *text, SDL_Color color, int *w, int *h)
+{
+	if (font == NULL || strlen(text) >= TEXT_CACHE_MAX_LEN)
+		return NULL;
+
+	struct TextEntry *victim = &g_text_cache[0];
+	for (int i = 0; i < TEXT_CACHE_SIZE; i++)
+	{
+		struct TextEntry *entry = &g_text_cache[i];
+		if (entry->font == font && same_color(entry->color, color) && strcmp(entry->text, text) == 0)
+		{
+			entry->last_used = ++g_text_clock;
+			*w = entry->w;
+			*h = entry->h;
+			return entry->texture;
+		}
+		if (victim->font != NULL && (entry->font == NULL || entry->last_used < victim->last_used))
+			victim = entry;
+	}
+
+	SDL_Texture *texture = upload_text(renderer, font, text, color);
+	if (texture == NULL)
+		return NULL;
+
+	if (victim->texture != NULL)
+		SDL_DestroyTexture(victim->texture);
+	victim->font = font;
+	victim->color = color;
+	strcpy(victim->text, text);
+	victim->texture = texture;
+	TTF_SizeText(font, text, &victim->w, &victim->h);
+	victim->last_used = ++g_text_clock;
+	*w = victim->w;
+	*h = victim->h;
+	return texture;
+}
+
+void forget_font(TTF_Font *font)
+{
+	for (int i = 0; i < TEXT_CACHE_SIZE; i++)
+	{
+		struct TextEntry *entry = &g_text_cache[i];
+		if (entry->font != font)
+			continue;
+		SDL_DestroyTexture(entry->texture);
+		memset(entry, 0, sizeof(*entry));
+	}
+}
+
+void clear_text_cache(void)
+{
+	for (int i = 0; i < TEXT_CACHE_SIZE; i++)
+	{
+		if (g_text_cache[i].texture != NULL)
+			SDL_DestroyTexture(g_text_cache[i].texture);
+	}
+	memset(g_text_cache, 0, sizeof(g_text_cache));
+}
+
 void draw_text(SDL_Renderer *renderer, TTF_Font *font, const char *text, SDL_Rect rect, SDL_Color color)
 {
-	SDL_Surface *surfaceMessage = TTF_RenderText_Blended(font, text, color);
-	SDL_Texture *Message = SDL_CreateTextureFromSurface(renderer, surfaceMessage);
+	//The font may still be loading
+	if (font == NULL)
+		return;
+	Uint64 start = SDL_GetPerformanceCounter();
 	SDL_Rect message_rect;
-
-	TTF_SizeText(font, text, &message_rect.w, &message_rect.h);
+	SDL_Texture *Message = get_text_texture(renderer, font, text, color, &message_rect.w, &message_rect.h);
+	bool cached = Message != NULL;
+	if (!cached)
+	{
+		//Not cached, rasterize it for this frame only
+		Message = upload_text(renderer, font, text, color);
+		TTF_SizeText(font, text, &message_rect.w, &message_rect.h);
+	}
 	message_rect.x = rect.x + rect.w / 2 - message_rect.w / 2;
 	message_rect.y = rect.y + rect.h / 2 - message_rect.h / 2;
 
 	SDL_RenderCopy(renderer, Message, NULL, &message_rect);
-	SDL_DestroyTexture(Message);
-	SDL_FreeSurface(surfaceMessage);
+	if (!cached && Message != NULL)
+		SDL_DestroyTexture(Message);
+	profile_end(PROFILE_DRAW_TEXT, start);
+}
+
+void draw_glyphs(SDL_Renderer *renderer, TTF_Font *font, const char *text, SDL_Rect rect, SDL_Color color)
+{
+	SDL_Texture *glyphs[TEXT_CACHE_MAX_LEN];
+	SDL_Rect glyph_rects[TEXT_CACHE_MAX_LEN];
+	int count = 0, width = 0;
+	for (; text[count] != '\0' && count < TEXT_CACHE_MAX_LEN; count++)
+	{
+		char glyph[2] = {text[count], '\0'};
+		glyphs[count] = get_text_texture(renderer, font, glyph, color, &glyph_rects[count].w, &glyph_rects[count].h);
+		if (glyphs[count] == NULL)
+			return;
+		width += glyph_rects[count].w;
+	}
+
+	int x = rect.x + rect.w / 2 - width / 2;
+	for (int i = 0; i < count; i++)
+	{
+		glyph_rects[i].x = x;
+		glyph_rects[i].y = rect.y + rect.h / 2 - glyph_rects[i].h / 2;
+		SDL_RenderCopy(renderer, glyphs[i], NULL, &glyph_rects[i]);
+		x += glyph_rects[i].w;
+	}
 }
 
 void draw_white_text(SDL_Renderer *renderer, TTF_Font *font, const char *text, SDL_Rect rect)
@@ -68,6 +408,8 @@ void draw_white_text(SDL_Renderer *renderer, TTF_Font *font, const char *text, S
 
 void closeSDL(SDL_Window **window)
 {
+	clear_text_cache();
+	reset_board_layer(true);
 	SDL_DestroyWindow(*window);
 	*window = NULL;
 	TTF_Quit();
@@ -81,78 +423,466 @@ void clear_screen(SDL_Renderer *renderer)
 	SDL_RenderClear(renderer);
 }
 
-void display_text(SDL_Renderer *renderer, const char *text, int size)
+void display_text(SDL_Renderer *renderer, const char *text, TTF_Font *font)
 {
-	TTF_Font *font = NULL;
-	font = TTF_OpenFont(FONT_PATH, size);
-	if (font == NULL)
-	{
-		fprintf(stderr, "The required font was not found. TTF_OpenFont: %s\n", TTF_GetError());
-		exit(EXIT_FAILURE);
-	}
 	SDL_Color black = {g_fg.r, g_fg.g, g_fg.b};
 	clear_screen(renderer);
 	SDL_Rect rect = {SCREEN_PAD, SCREEN_HEIGHT / 4, SCREEN_WIDTH - 2 * SCREEN_PAD, SCREEN_HEIGHT / 2};
 	draw_text(renderer, font, text, rect, black);
-	SDL_RenderPresent(renderer);
-	SDL_Delay(1000);
-	TTF_CloseFont(font);
 }
 
-void draw_board(SDL_Renderer *renderer, const Board board, TTF_Font *font)
+void show_overlay(const char *text, TTF_Font **font, Uint32 duration)
+{
+	g_overlay_text = text;
+	g_overlay_font = font;
+	g_overlay_until = SDL_GetTicks() + duration;
+}
+
+/** Opens a font, printing an error on failure. */
+static TTF_Font *open_font(int size)
+{
+	TTF_Font *font = TTF_OpenFont(FONT_PATH, size);
+	if (font == NULL)
+		fprintf(stderr, "The required font was not found. TTF_OpenFont: %s\n", TTF_GetError());
+	return font;
+}
+
+/** Tells the game loop that a group of assets finished loading. */
+static void push_assets_event(Uint32 type, Sint32 code)
+{
+	SDL_Event e;
+	SDL_zero(e);
+	e.type = type;
+	e.user.code = code;
+	SDL_PushEvent(&e);
+}
+
+int load_assets(void *data)
+{
+	Uint32 type = *(Uint32 *)data;
+
+	g_title_font = open_font(TITLE_FONT_SIZE);
+	g_gover_font = open_font(GOVER_FONT_SIZE);
+	g_cell_font = open_font(CELL_FONT_SIZE);
+	g_hud_font = open_font(HUD_FONT_SIZE);
+	if (g_title_font == NULL || g_gover_font == NULL || g_cell_font == NULL || g_hud_font == NULL)
+	{
+		push_assets_event(type, -ASSETS_FONTS);
+		return -1;
+	}
+	//Publish the fonts before the flag, the main thread reads them after it
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&g_fonts_ready, 1);
+	push_assets_event(type, ASSETS_FONTS);
+
+	g_background_music = Mix_LoadMUS(BACKGROUND_MUSIC_PATH);
+	g_mix_music = Mix_LoadWAV(MIX_MUSIC_PATH);
+	if (g_background_music == NULL || g_mix_music == NULL)
+	{
+		push_assets_event(type, -ASSETS_AUDIO);
+		return -1;
+	}
+	//Published like the fonts, handle_move() plays the sound
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&g_audio_ready, 1);
+	push_assets_event(type, ASSETS_AUDIO);
+	return 0;
+}
+
+/** Returns a font once load_assets() opened it, NULL before. */
+static TTF_Font *loaded_font(TTF_Font **font)
+{
+	if (SDL_AtomicGet(&g_fonts_ready) == 0)
+		return NULL;
+	SDL_MemoryBarrierAcquire();
+	return *font;
+}
+
+/** Returns if load_assets() loaded the audio, g_mix_music and 
+ *  g_background_music can be used after it returned true. */
+static bool audio_loaded(void)
+{
+	if (SDL_AtomicGet(&g_audio_ready) == 0)
+		return false;
+	SDL_MemoryBarrierAcquire();
+	return true;
+}
+
+/** Closes the fonts opened by load_assets(). */
+static void close_fonts(void)
+{
+	TTF_Font **fonts[] = {&g_title_font, &g_gover_font, &g_cell_font, &g_hud_font};
+	for (unsigned int i = 0; i < sizeof(fonts) / sizeof(fonts[0]); i++)
+	{
+		if (*fonts[i] == NULL)
+			continue;
+		forget_font(*fonts[i]);
+		TTF_CloseFont(*fonts[i]);
+		*fonts[i] = NULL;
+	}
+}
+
+/** Returns the text of a tile, formatting each exponent only once. */
+static const char *tile_label(unsigned char exponent)
+{
+	static char labels[256][24];
+	if (labels[exponent][0] == '\0')
+		sprintf(labels[exponent], "%lu", pow_int(BASE, exponent));
+	return labels[exponent];
+}
+
+/** Returns the rect of the cell in column x and row y. */
+static SDL_Rect cell_rect(int x, int y)
 {
 	int squareSize = (SCREEN_WIDTH - 2 * SCREEN_PAD) / SIZE - SCREEN_PAD;
+	SDL_Rect rect = {SCREEN_PAD + x * (squareSize + SCREEN_PAD), SCREEN_PAD + y * (squareSize + SCREEN_PAD), squareSize, squareSize};
+	return rect;
+}
+
+/** @struct Fill
+ *  @brief A rect queued by draw_board() to be filled with a tile color.
+ *
+ *  @var Fill::exponent
+ *  The exponent of the tile, selects the color
+ *  @var Fill::rect
+ *  The rect
+ */
+struct Fill
+{
+	unsigned char exponent;
+	SDL_Rect rect;
+};
+
+/** Fills the queued rects with one draw call per color. The rects must not overlap. */
+static void fill_by_color(SDL_Renderer *renderer, struct Fill *fills, int count)
+{
+	SDL_Rect rects[SIZE * SIZE];
+	while (count > 0)
+	{
+		//Take every fill of the color of the first one, keep the rest
+		unsigned char exponent = fills[0].exponent;
+		int same = 0, rest = 0;
+		for (int i = 0; i < count; i++)
+		{
+			if (fills[i].exponent == exponent)
+				rects[same++] = fills[i].rect;
+			else
+				fills[rest++] = fills[i];
+		}
+		struct COLOR s = g_COLORS[exponent];
+		SDL_SetRenderDrawColor(renderer, s.r, s.g, s.b, s.a);
+		SDL_RenderFillRects(renderer, rects, same);
+		count = rest;
+	}
+}
+
+void draw_static(SDL_Renderer *renderer, TTF_Font *font)
+{
+	struct Fill fills[SIZE * SIZE];
+	int count = 0;
+	for (int x = 0; x < SIZE; x++)
+		for (int y = 0; y < SIZE; y++)
+			fills[count++] = (struct Fill){0, cell_rect(x, y)};
+	clear_screen(renderer);
+	fill_by_color(renderer, fills, count);
+	SDL_Rect scoreRect = {SCREEN_WIDTH / 2 + 5,
+						  SCREEN_WIDTH + SCREEN_PAD,
+						  SCREEN_WIDTH / 2 - 2 * SCREEN_PAD,
+						  SCREEN_HEIGHT - SCREEN_WIDTH - 2 * SCREEN_PAD};
+	SDL_SetRenderDrawColor(renderer, g_score_bg.r, g_score_bg.g, g_score_bg.b, g_score_bg.a);
+	SDL_RenderFillRect(renderer, &scoreRect);
+	draw_button(renderer, font);
+	memset(g_drawn, 0, sizeof(g_drawn));
+}
+
+void draw_board(SDL_Renderer *renderer, const Board board, TTF_Font *font)
+{
+	Uint64 start = SDL_GetPerformanceCounter();
+	struct Fill fills[SIZE * SIZE], grows[SIZE * SIZE];
+	int count = 0, grow_count = 0, labels[SIZE * SIZE], label_count = 0;
 
 	for (int x = 0; x < SIZE; x++)
 	{
 		for (int y = 0; y < SIZE; y++)
 		{
-			SDL_Rect fillRect = {SCREEN_PAD + x * (squareSize + SCREEN_PAD), SCREEN_PAD + y * (squareSize + SCREEN_PAD), squareSize, squareSize};
-			struct COLOR s = g_COLORS[board[y][x]];
-			SDL_SetRenderDrawColor(renderer, s.r, s.g, s.b, s.a);
-			SDL_RenderFillRect(renderer, &fillRect);
-			char str[15]; // 15 chars is enough for 2^16. But not for other exponents ;)
-			sprintf(str, "%lu", pow_int(BASE, board[y][x]));
-
-			if (board[y][x] == 0)
+			if (board[y][x] == g_drawn[y][x] && y * SIZE + x != g_spawn_cell)
+				continue;
+			SDL_Rect fillRect = cell_rect(x, y);
+			if (y * SIZE + x == g_spawn_cell)
 			{
-				str[0] = ' ';
-				str[1] = '\0';
+				Uint32 elapsed = SDL_GetTicks() - g_spawn_start;
+				if (elapsed < SPAWN_ANIMATION_MS)
+				{
+					//Grow the new tile from the center of an empty cell
+					int inset = fillRect.w * (SPAWN_ANIMATION_MS - elapsed) / (2 * SPAWN_ANIMATION_MS);
+					SDL_Rect growRect = {fillRect.x + inset, fillRect.y + inset, fillRect.w - 2 * inset, fillRect.h - 2 * inset};
+					fills[count++] = (struct Fill){0, fillRect};
+					grows[grow_count++] = (struct Fill){board[y][x], growRect};
+					//Drawn again until the animation ends
+					g_drawn[y][x] = DRAWN_NONE;
+					continue;
+				}
+				g_spawn_cell = -1;
 			}
-			draw_white_text(renderer, font, str, fillRect);
+			fills[count++] = (struct Fill){board[y][x], fillRect};
+			if (board[y][x] != 0)
+				labels[label_count++] = y * SIZE + x;
+			g_drawn[y][x] = board[y][x];
 		}
 	}
+
+	fill_by_color(renderer, fills, count);
+	//The growing tiles lie over the empty cells filled above
+	fill_by_color(renderer, grows, grow_count);
+	for (int i = 0; i < label_count; i++)
+	{
+		int x = labels[i] % SIZE, y = labels[i] / SIZE;
+		draw_white_text(renderer, font, tile_label(board[y][x]), cell_rect(x, y));
+	}
+	profile_end(PROFILE_DRAW_BOARD, start);
 }
 
-void handle_move(SDL_Event e, Board board, SDL_Renderer *renderer)
+/** The hint worker thread, or NULL when there are no hints.*/
+SDL_Thread *g_hint_thread;
+
+/** Posted for every request, the hint worker sleeps on it.*/
+SDL_sem *g_hint_wake;
+
+/** The number of the current request. Bumped by the main thread after 
+ *  g_hint_board is written, which cancels the search of the previous one.*/
+SDL_atomic_t g_hint_request;
+
+/** The board of the current request, written by the main thread only.*/
+BitBoard g_hint_board;
+
+/** If the hints are shown and boards searched.*/
+SDL_atomic_t g_hints_enabled;
+
+/** Set to stop the hint worker.*/
+SDL_atomic_t g_hint_quit;
+
+/** The latest hint, written by the hint worker only. See pack_hint().*/
+SDL_atomic_t g_hint_result;
+
+/** The event type pushed by hint_worker().*/
+Uint32 g_hint_event;
+
+/** The bits of a request number kept in a packed hint.*/
+#define HINT_REQUEST_MASK 0x7FFFFF
+
+/** Packs a hint into one int, so it is published in a single store:
+ *  the direction plus one in bits 0-3, the depth in bits 4-7 and the 
+ *  request in the rest. 0 is no hint.*/
+static int pack_hint(int request, Direction dir, unsigned int depth)
 {
-	if (is_game_over(board))
+	return (request & HINT_REQUEST_MASK) << 8 | (int)(depth & 0xF) << 4 | ((int)dir + 1);
+}
+
+/** Stops the search once a newer board was requested.*/
+static bool hint_abort(void *arg)
+{
+	return SDL_AtomicGet(&g_hint_request) != *(const int *)arg;
+}
+
+/** Publishes the move of a finished depth.*/
+static void hint_progress(void *arg, Direction best, unsigned int depth)
+{
+	SDL_AtomicSet(&g_hint_result, pack_hint(*(const int *)arg, best, depth));
+	SDL_Event e;
+	SDL_zero(e);
+	e.type = g_hint_event;
+	SDL_PushEvent(&e);
+}
+
+int hint_worker(void *data)
+{
+	AI *ai = data;
+	int request = 0;
+	ai_set_abort(ai, hint_abort, &request);
+	ai_set_progress(ai, hint_progress, &request);
+	ai_set_depth(ai, HINT_MAX_DEPTH);
+	int searched = 0;
+	while (SDL_SemWait(g_hint_wake) == 0 && !SDL_AtomicGet(&g_hint_quit))
+	{
+		//Every request posts once, the older posts find nothing new
+		request = SDL_AtomicGet(&g_hint_request);
+		if (request == searched || !SDL_AtomicGet(&g_hints_enabled))
+			continue;
+		searched = request;
+		BitBoard bitboard = __atomic_load_n(&g_hint_board, __ATOMIC_ACQUIRE);
+		//The board may belong to a newer request, which posted as well
+		if (SDL_AtomicGet(&g_hint_request) != request)
+			continue;
+
+		Direction dir;
+		ai_best_move_timed(ai, bitboard, HINT_BUDGET_MS, &dir, NULL);
+	}
+	ai_destroy(ai);
+	return 0;
+}
+
+bool start_hints(const Board board)
+{
+	AIConfig config;
+	ai_default_config(&config);
+	AI *ai = ai_create(&config);
+	g_hint_wake = SDL_CreateSemaphore(0);
+	g_hint_event = SDL_RegisterEvents(1);
+	if (ai == NULL || g_hint_wake == NULL || g_hint_event == (Uint32)-1)
 	{
-		display_text(renderer, "Game Over", GOVER_FONT_SIZE);
-		clear_board(board);
-		add_random(board);
+		fprintf(stderr, "The hints couldn't be started.\n");
+		ai_destroy(ai);
+		if (g_hint_wake != NULL)
+			SDL_DestroySemaphore(g_hint_wake);
+		return false;
+	}
+	g_hint_thread = SDL_CreateThread(hint_worker, "hint_worker", ai);
+	if (g_hint_thread == NULL)
+	{
+		fprintf(stderr, "The hint thread couldn't be created. SDL_ERROR: %s\n", SDL_GetError());
+		ai_destroy(ai);
+		SDL_DestroySemaphore(g_hint_wake);
+		return false;
+	}
+	SDL_AtomicSet(&g_hints_enabled, 1);
+	request_hint(board);
+	return true;
+}
+
+void stop_hints(void)
+{
+	if (g_hint_thread == NULL)
+		return;
+	SDL_AtomicSet(&g_hint_quit, 1);
+	SDL_AtomicAdd(&g_hint_request, 1);
+	SDL_SemPost(g_hint_wake);
+	SDL_WaitThread(g_hint_thread, NULL);
+	SDL_DestroySemaphore(g_hint_wake);
+	g_hint_thread = NULL;
+}
+
+void request_hint(const Board board)
+{
+	if (g_hint_thread == NULL)
+		return;
+	__atomic_store_n(&g_hint_board, board_to_bitboard(board), __ATOMIC_RELEASE);
+	SDL_AtomicAdd(&g_hint_request, 1);
+	SDL_SemPost(g_hint_wake);
+}
+
+void toggle_hints(const Board board)
+{
+	SDL_AtomicSet(&g_hints_enabled, !SDL_AtomicGet(&g_hints_enabled));
+	//Cancels the search when turned off
+	request_hint(board);
+}
+
+/** Returns the hint for the current board, false if there is none yet.*/
+static bool current_hint(Direction *dir)
+{
+	if (g_hint_thread == NULL || !SDL_AtomicGet(&g_hints_enabled))
+		return false;
+	int hint = SDL_AtomicGet(&g_hint_result);
+	if (hint == 0 || (hint >> 8) != (SDL_AtomicGet(&g_hint_request) & HINT_REQUEST_MASK))
+		return false;
+	*dir = (Direction)((hint & 0xF) - 1);
+	return true;
+}
+
+void draw_hint(SDL_Renderer *renderer)
+{
+	Direction dir;
+	if (!current_hint(&dir))
 		return;
+	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+	SDL_SetRenderDrawColor(renderer, g_hint_fg.r, g_hint_fg.g, g_hint_fg.b, g_hint_fg.a);
+	//The arrow is drawn in strips from its tip, t along it and w across it
+	int center = SCREEN_WIDTH / 2, head = HINT_ARROW_SIZE / 2, strip = 4;
+	int head_width = HINT_ARROW_SIZE * 3 / 5, shaft_width = HINT_ARROW_SIZE / 5;
+	SDL_Rect rects[(HINT_ARROW_SIZE + 3) / 4];
+	int count = 0;
+	for (int t = 0; t < HINT_ARROW_SIZE; t += strip)
+	{
+		int w = t < head ? (t + strip) * head_width / head : shaft_width;
+		int along = center - HINT_ARROW_SIZE / 2 + t;
+		SDL_Rect rect;
+		switch (dir)
+		{
+		case DIRECTION_UP:
+			rect = (SDL_Rect){center - w / 2, along, w, strip};
+			break;
+		case DIRECTION_DOWN:
+			rect = (SDL_Rect){center - w / 2, 2 * center - along - strip, w, strip};
+			break;
+		case DIRECTION_LEFT:
+			rect = (SDL_Rect){along, center - w / 2, strip, w};
+			break;
+		default:
+			rect = (SDL_Rect){2 * center - along - strip, center - w / 2, strip, w};
+			break;
+		}
+		rects[count++] = rect;
+	}
+	//The strips don't overlap, so they are blended in one call
+	SDL_RenderFillRects(renderer, rects, count);
+	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+}
+
+void new_game(Board board)
+{
+	//Every game gets its own seed, so a recorded game can be played again
+	uint64_t seed = rng_next(&g_rng);
+	rng_seed(&g_rng, seed);
+	clear_board(board);
+	unsigned int cell = add_random(board, &g_rng);
+	score_reset(&g_score, board);
+	g_spawn_cell = -1;
+	if (g_replay != NULL)
+	{
+		replay_end(g_replay);
+		replay_begin(g_replay, seed, cell);
+	}
+	request_hint(board);
+}
+
+bool handle_move(SDL_Event e, Board board, SDL_Renderer *renderer)
+{
+	(void)renderer;
+	if (is_game_over(board))
+	{
+		show_overlay("Game Over", &g_gover_font, GOVER_MS);
+		new_game(board);
+		return true;
 	}
+	Direction dir;
 	switch (e.key.keysym.sym)
 	{
 	case SDLK_UP:
-		Mix_PlayChannel(-1, g_mix_music, 0);
-		move_y(board, 0);
+		dir = DIRECTION_UP;
 		break;
 	case SDLK_DOWN:
-		Mix_PlayChannel(-1, g_mix_music, 0);
-		move_y(board, 1);
+		dir = DIRECTION_DOWN;
 		break;
 	case SDLK_LEFT:
-		Mix_PlayChannel(-1, g_mix_music, 0);
-		move_x(board, 0);
+		dir = DIRECTION_LEFT;
 		break;
 	case SDLK_RIGHT:
-		Mix_PlayChannel(-1, g_mix_music, 0);
-		move_x(board, 1);
+		dir = DIRECTION_RIGHT;
 		break;
-	default:;
+	default:
+		return false;
 	}
+	if (audio_loaded())
+		Mix_PlayChannel(-1, g_mix_music, 0);
+	int cell = move_with_spawn(board, dir, &g_rng, &g_score);
+	if (cell < 0)
+		return false;
+	if (g_replay != NULL)
+		replay_move(g_replay, dir, (unsigned int)cell);
+	g_spawn_cell = cell;
+	g_spawn_start = SDL_GetTicks();
+	request_hint(board);
+	return true;
 }
 
 void draw_button(SDL_Renderer *renderer, TTF_Font *font)
@@ -166,7 +896,7 @@ void draw_button(SDL_Renderer *renderer, TTF_Font *font)
 	SDL_RenderFillRect(renderer, &fillRect);
 	draw_white_text(renderer, font, txt, fillRect);
 }
-void button_handler(SDL_Event e, Board board)
+bool button_handler(SDL_Event e, Board board)
 {
 	SDL_Rect draw_rect = {SCREEN_PAD / 2,
 						  SCREEN_WIDTH + SCREEN_PAD,
@@ -178,50 +908,215 @@ void button_handler(SDL_Event e, Board board)
 		e.button.y >= draw_rect.y &&
 		e.button.y <= (draw_rect.y + draw_rect.h))
 	{
-		clear_board(board);
-		add_random(board);
+		new_game(board);
+		return true;
 	}
+	return false;
 }
 void draw_score(SDL_Renderer *renderer, Board board, TTF_Font *font)
 {
 	char score[15]; //15 chars is enough for score.
-	sprintf(score, "%lu", calculate_score(board));
+	(void)board;
+	sprintf(score, "%lu", g_score.sum);
 	char scoreText[30] = "Score:";
 	strncat(scoreText, score, 15);
 	SDL_Rect fillRect = {SCREEN_WIDTH / 2 + 5,
 						 SCREEN_WIDTH + SCREEN_PAD,
 						 SCREEN_WIDTH / 2 - 2 * SCREEN_PAD,
 						 SCREEN_HEIGHT - SCREEN_WIDTH - 2 * SCREEN_PAD};
-	SDL_SetRenderDrawColor(renderer, g_score_bg.r, g_score_bg.g, g_score_bg.b, g_score_bg.a);
-	SDL_RenderFillRect(renderer, &fillRect);
-	draw_white_text(renderer, font, scoreText, fillRect);
+	//The panel is part of the static layer, the score changes often, so 
+	//it is drawn from cached digits
+	SDL_Color White = {255, 255, 255};
+	draw_glyphs(renderer, font, scoreText, fillRect, White);
 }
-void render_game(SDL_Renderer *renderer, Board board, TTF_Font *font)
+void draw_hud(SDL_Renderer *renderer)
 {
-	clear_screen(renderer);
-	draw_board(renderer, board, font);
-	draw_score(renderer, board, font);
-	draw_button(renderer, font);
+	TTF_Font *font = loaded_font(&g_hud_font);
+	if (!g_hud || font == NULL)
+		return;
+	char text[TEXT_CACHE_MAX_LEN];
+	snprintf(text, sizeof(text), "%.1f ms %u fps %lu up", g_frame_us / 1000.0, g_fps, g_frame_uploads);
+	SDL_Rect rect = {0, SCREEN_PAD, SCREEN_WIDTH, 2 * HUD_FONT_SIZE};
+	SDL_Color color = {g_fg.r, g_fg.g, g_fg.b};
+	draw_glyphs(renderer, font, text, rect, color);
+}
+
+/** Creates g_board_layer and draws the static parts to it when they 
+ *  are missing. Returns false if the board has to be drawn without it. */
+static bool board_layer(SDL_Renderer *renderer, TTF_Font *font)
+{
+	if (g_board_layer == NULL && !g_board_layer_failed)
+	{
+		if (SDL_RenderTargetSupported(renderer))
+			g_board_layer = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, SCREEN_WIDTH, SCREEN_HEIGHT);
+		if (g_board_layer == NULL)
+		{
+			fprintf(stderr, "The board layer couldn't be created, drawing every frame in full. SDL_ERROR: %s\n", SDL_GetError());
+			g_board_layer_failed = true;
+			return false;
+		}
+		g_board_layer_valid = false;
+	}
+	if (g_board_layer == NULL)
+		return false;
+	//The button text appears once the font is loaded
+	if (!g_board_layer_valid || font != g_board_layer_font)
+	{
+		SDL_SetRenderTarget(renderer, g_board_layer);
+		draw_static(renderer, font);
+		SDL_SetRenderTarget(renderer, NULL);
+		g_board_layer_valid = true;
+		g_board_layer_font = font;
+	}
+	return true;
+}
+
+void reset_board_layer(bool lost)
+{
+	if (lost && g_board_layer != NULL)
+	{
+		SDL_DestroyTexture(g_board_layer);
+		g_board_layer = NULL;
+	}
+	g_board_layer_valid = false;
+}
+
+/** Presents the frame and counts the frames per second. */
+static void present(SDL_Renderer *renderer)
+{
+	Uint64 start = SDL_GetPerformanceCounter();
 	SDL_RenderPresent(renderer);
+	profile_end(PROFILE_PRESENT, start);
+	g_frames++;
+	g_fps_frames++;
+	Uint32 now = SDL_GetTicks();
+	if (now - g_fps_start >= 1000)
+	{
+		g_fps = g_fps_frames * 1000 / (now - g_fps_start);
+		g_fps_frames = 0;
+		g_fps_start = now;
+	}
 }
 
-void game_loop(Board board, SDL_Renderer *renderer)
+void render_game(SDL_Renderer *renderer, Board board, TTF_Font *font)
 {
-	TTF_Font *font = NULL;
-	font = TTF_OpenFont(FONT_PATH, CELL_FONT_SIZE);
-	if (font == NULL)
+	Uint64 start = SDL_GetPerformanceCounter();
+	unsigned long uploads = g_texture_uploads;
+	if (g_overlay_text != NULL)
 	{
-		fprintf(stderr, "The required font was not found. TTF_OpenFont: %s\n", TTF_GetError());
-		exit(EXIT_FAILURE);
+		display_text(renderer, g_overlay_text, loaded_font(g_overlay_font));
+	}
+	else
+	{
+		if (board_layer(renderer, font))
+		{
+			//Only the tiles that changed are drawn to the layer
+			SDL_SetRenderTarget(renderer, g_board_layer);
+			draw_board(renderer, board, font);
+			SDL_SetRenderTarget(renderer, NULL);
+			SDL_RenderCopy(renderer, g_board_layer, NULL, NULL);
+		}
+		else
+		{
+			draw_static(renderer, font);
+			draw_board(renderer, board, font);
+		}
+		draw_hint(renderer);
+		draw_score(renderer, board, font);
 	}
+	//Shows the previous frame, this one isn't finished yet
+	draw_hud(renderer);
+	present(renderer);
+	g_frame_uploads = g_texture_uploads - uploads;
+	g_frame_us = profile_end(PROFILE_RENDER, start);
+}
+
+bool is_animating(void)
+{
+	return g_spawn_cell >= 0;
+}
+
+/** The CPU time of the calling thread in seconds. The hint worker and 
+ *  the loader are busy while the game loop is idle, so clock() would 
+ *  count them too. */
+static double thread_cpu_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-	render_game(renderer, board, font);
+/** Milliseconds since the performance counter value start. */
+static double elapsed_ms(Uint64 start)
+{
+	return (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+/** The performance counter value when main() was entered.*/
+Uint64 g_startup_counter;
+
+/** Milliseconds from startup until the first frame was presented.*/
+double g_first_frame_ms = -1;
+
+/** Milliseconds from startup until the first frame of the playable game was presented.*/
+double g_interactive_ms = -1;
+
+/** The event type pushed by load_assets().*/
+Uint32 g_assets_event;
 
+void game_loop(Board board, SDL_Renderer *renderer)
+{
 	bool quit = false;
+	bool dirty = true;
+	Uint32 next_frame = SDL_GetTicks();
 	SDL_Event e;
 	while (!quit)
 	{
-		while (SDL_PollEvent(&e) != 0)
+		Uint32 now = SDL_GetTicks();
+		if (g_overlay_text != NULL && (Sint32)(now - g_overlay_until) >= 0)
+		{
+			g_overlay_text = NULL;
+			dirty = true;
+		}
+		if (dirty || (is_animating() && (Sint32)(now - next_frame) >= 0))
+		{
+			TTF_Font *font = loaded_font(&g_cell_font);
+			render_game(renderer, board, font);
+			dirty = false;
+			next_frame = now + 1000 / FRAME_RATE;
+			if (g_first_frame_ms < 0)
+				g_first_frame_ms = elapsed_ms(g_startup_counter);
+			if (g_interactive_ms < 0 && font != NULL && g_overlay_text == NULL)
+				g_interactive_ms = elapsed_ms(g_startup_counter);
+		}
+
+		//Wait for input until the next frame is due or the overlay ends
+		Sint32 wait = -1;
+		if (is_animating())
+			wait = (Sint32)(next_frame - SDL_GetTicks());
+		if (g_overlay_text != NULL)
+		{
+			Sint32 overlay_wait = (Sint32)(g_overlay_until - SDL_GetTicks());
+			if (wait < 0 || overlay_wait < wait)
+				wait = overlay_wait;
+		}
+
+		int pending;
+		if (wait >= 0 || g_overlay_text != NULL || is_animating())
+		{
+			pending = SDL_WaitEventTimeout(&e, wait > 0 ? wait : 0);
+		}
+		else
+		{
+			//Nothing changes until the next event, so sleep until then
+			double idle_cpu = thread_cpu_seconds();
+			Uint32 idle_start = SDL_GetTicks();
+			pending = SDL_WaitEvent(&e);
+			g_idle_cpu += thread_cpu_seconds() - idle_cpu;
+			g_idle_ms += SDL_GetTicks() - idle_start;
+		}
+
+		for (; pending; pending = SDL_PollEvent(&e))
 		{
 			//User requests quit
 			if (e.type == SDL_QUIT)
@@ -230,19 +1125,64 @@ void game_loop(Board board, SDL_Renderer *renderer)
 			}
 			else if (e.type == SDL_KEYUP)
 			{
-				handle_move(e, board, renderer);
-				//Redraw all portions of game
-				render_game(renderer, board, font);
+				//A key press skips the overlay and is handled right away
+				if (g_overlay_text != NULL)
+				{
+					g_overlay_text = NULL;
+					dirty = true;
+				}
+				if (e.key.keysym.sym == SDLK_h)
+				{
+					toggle_hints(board);
+					dirty = true;
+				}
+				else if (e.key.keysym.sym == SDLK_F1)
+				{
+					g_hud = !g_hud;
+					dirty = true;
+				}
+				else
+				{
+					Uint64 start = SDL_GetPerformanceCounter();
+					dirty |= handle_move(e, board, renderer);
+					profile_end(PROFILE_HANDLE_MOVE, start);
+				}
 			}
 			else if (e.type == SDL_MOUSEBUTTONUP)
 			{
-				button_handler(e, board);
-				render_game(renderer, board, font);
+				dirty |= button_handler(e, board);
+			}
+			else if (e.type == SDL_WINDOWEVENT)
+			{
+				//The window may have been uncovered or resized
+				dirty = true;
+			}
+			else if (e.type == SDL_RENDER_TARGETS_RESET || e.type == SDL_RENDER_DEVICE_RESET)
+			{
+				//The contents of the textures are lost, on a device reset the textures too
+				if (e.type == SDL_RENDER_DEVICE_RESET)
+					clear_text_cache();
+				reset_board_layer(e.type == SDL_RENDER_DEVICE_RESET);
+				dirty = true;
+			}
+			else if (e.type == g_assets_event)
+			{
+				if (e.user.code < 0)
+				{
+					fprintf(stderr, e.user.code == -ASSETS_FONTS ? "The fonts couldn't be loaded.\n" : "Music files couldn't be loaded.\n");
+					exit(EXIT_FAILURE);
+				}
+				if (e.user.code == ASSETS_AUDIO && audio_loaded())
+					Mix_PlayMusic(g_background_music, -1);
+				dirty = true;
+			}
+			else if (e.type == g_hint_event)
+			{
+				//A deeper move for the board was found
+				dirty = true;
 			}
 		}
 	}
-	TTF_CloseFont(font);
-	//No need to null out font.
 }
 
 /**
@@ -250,18 +1190,44 @@ void game_loop(Board board, SDL_Renderer *renderer)
  * 
  * Starts the game
  * 
+ * The window is shown right away, while the fonts and audio are loaded 
+ * on a background thread.
+ * With the --stats option, the startup times and the CPU usage while 
+ * idle are reported on exit. With --record file, the games are appended 
+ * to the replay file. With --profile file, the timing histograms are
+ * written to the file as JSON on exit, see write_profile().
+ * 
  * @param argc Number of arguments
  * @param argv Arguments
  */
 int main(int argc, char **argv)
 {
+	g_startup_counter = SDL_GetPerformanceCounter();
+	bool stats = false;
+	const char *profile = NULL;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--stats") == 0)
+			stats = true;
+		else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+			profile = argv[++i];
+		else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+		{
+			g_replay = replay_writer_open(argv[++i]);
+			if (g_replay == NULL)
+			{
+				fprintf(stderr, "The replay %s couldn't be opened.\n", argv[i]);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+
 	//Set up the seed
-	srand(time(NULL));
+	rng_seed(&g_rng, (uint64_t)time(NULL));
 
 	//Set up the game board.
 	unsigned char board[SIZE][SIZE];
-	clear_board(board);
-	add_random(board);
+	new_game(board);
 
 	//Init the SDL gui variables
 	SDL_Window *window = NULL;
@@ -269,20 +1235,57 @@ int main(int argc, char **argv)
 	if (!initSDL(&window, &renderer))
 		exit(EXIT_FAILURE);
 
-	//Load Music Files
-	g_background_music = Mix_LoadMUS(BACKGROUND_MUSIC_PATH);
-	g_mix_music = Mix_LoadWAV(MIX_MUSIC_PATH);
-	if (g_background_music == NULL || g_mix_music == NULL)
+	//Load the fonts and music files while the splash is shown
+	g_assets_event = SDL_RegisterEvents(1);
+	SDL_Thread *loader = SDL_CreateThread(load_assets, "load_assets", &g_assets_event);
+	if (loader == NULL)
 	{
-		fprintf(stderr, "Music files couldn't be loaded.");
+		fprintf(stderr, "The loader thread couldn't be created. SDL_ERROR: %s\n", SDL_GetError());
 		exit(EXIT_FAILURE);
 	}
 
-	Mix_PlayMusic(g_background_music, -1);
-	display_text(renderer, "2048", TITLE_FONT_SIZE);
+	//Search for hints while the player thinks
+	start_hints(board);
+
+	show_overlay("2048", &g_title_font, SPLASH_MS);
 	game_loop(board, renderer);
+	SDL_WaitThread(loader, NULL);
+	stop_hints();
+
+	if (stats)
+	{
+		fprintf(stderr, "Startup: first frame after %.1f ms, playable after %.1f ms\n",
+				g_first_frame_ms, g_interactive_ms);
+		if (g_idle_ms > 0)
+		{
+			double idle_cpu = 100.0 * g_idle_cpu / (g_idle_ms / 1000.0);
+			fprintf(stderr, "Idle CPU usage: %.2f%% over %.1f s (target %.2f%%)\n",
+					idle_cpu, g_idle_ms / 1000.0, IDLE_CPU_TARGET);
+		}
+	}
+
+	if (profile != NULL)
+	{
+		FILE *stream = fopen(profile, "w");
+		if (stream == NULL)
+			fprintf(stderr, "The file %s couldn't be opened.\n", profile);
+		else
+		{
+			write_profile(stream);
+			fclose(stream);
+		}
+	}
+
+	//The unfinished game is recorded as well
+	if (g_replay != NULL)
+	{
+		replay_end(g_replay);
+		if (!replay_writer_close(g_replay))
+			fprintf(stderr, "The replay couldn't be written.\n");
+	}
 
 	//Releases all resource
+	close_fonts();
 	closeSDL(&window);
 	Mix_FreeMusic(g_background_music);
 	Mix_FreeChunk(g_mix_music);
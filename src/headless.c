@@ -0,0 +1,598 @@
+/**
+ * @file headless.c
+ * @author Gnik Droy
+ * @brief File containing the headless command line driver.
+ *
+ * Plays games at full speed without SDL, either from a scripted list
+ * of moves or from random input.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lib2048.h"
+#include "ai.h"
+#include "montecarlo.h"
+#include "ntuple.h"
+#include "replay.h"
+#include "sized.h"
+
+/** @struct Options
+ *  @brief The command line options of the driver.
+ *
+ *  @var Options::games
+ *  The number of games to play with random input
+ *  @var Options::seed
+ *  The seed of the first game. Game n is seeded with seed + n.
+ *  @var Options::script
+ *  The scripted moves, or NULL for random input
+ *  @var Options::quiet
+ *  If the final boards should not be printed
+ *  @var Options::depth
+ *  The expectimax search depth, or 0 for random input
+ *  @var Options::budget
+ *  The time in milliseconds the solver may take per move, or 0 to always
+ *  search Options::depth deep
+ *  @var Options::rollouts
+ *  The Monte Carlo rollouts per direction, or 0 for random input
+ *  @var Options::threads
+ *  The number of Monte Carlo worker threads, or 0 for one per core
+ *  @var Options::network
+ *  The n-tuple network weights to play with, or NULL
+ *  @var Options::record
+ *  The replay file the games are appended to, or NULL
+ *  @var Options::keyframes
+ *  The number of moves between replay keyframes, or 0 for none
+ *  @var Options::playback
+ *  The replay file to play back instead of playing, or NULL
+ *  @var Options::seek
+ *  The move every played back game jumps to, or -1 for its end
+ *  @var Options::size
+ *  The board size of random games on the sized kernels, or 0 for SIZE
+ *  @var Options::limit
+ *  The most moves of a game on the sized kernels, or 0 for no limit
+ */
+struct Options
+{
+	unsigned long games;
+	uint64_t seed;
+	char *script;
+	bool quiet;
+	unsigned int depth;
+	double budget;
+	unsigned int rollouts;
+	unsigned int threads;
+	const char *network;
+	const char *record;
+	uint32_t keyframes;
+	const char *playback;
+	long seek;
+	unsigned int size;
+	unsigned long limit;
+};
+
+/** The replay the games are recorded to, or NULL */
+static ReplayWriter *g_replay;
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+			"Usage: %s [-n games] [-s seed] [-m moves | -f file | -a depth [-d ms] | -r rollouts [-t threads] | -e file] [-w file [-k moves]] [-q]\n"
+			"       %s -p file [-j move] [-q]\n"
+			"       %s -b size [-l moves] [-n games] [-s seed] [-q]\n"
+			"  -n games  Number of games to play with random input (default 1)\n"
+			"  -s seed   Seed of the first game, game n uses seed + n (default time)\n"
+			"  -m moves  Play the scripted moves, a string of U, D, L and R\n"
+			"  -f file   Read the scripted moves from a file, '-' for stdin\n"
+			"  -a depth  Let the expectimax solver play with the search depth\n"
+			"  -d ms     Let the solver search deeper until the time per move runs out, up to -a\n"
+			"            (default %d) moves deep\n"
+			"  -r rollouts  Let the Monte Carlo player play with the rollouts per direction\n"
+			"  -t threads   Number of Monte Carlo worker threads (default one per core)\n"
+			"  -e file   Let the n-tuple network with the weights from 2048-train play\n"
+			"  -w file   Append the games to the replay file\n"
+			"  -k moves  Store a keyframe in the replay every number of moves\n"
+			"  -p file   Play back every game of the replay file\n"
+			"  -j move   Jump to the move of every game instead of playing it to the end\n"
+			"  -b size   Play random games on a board of the size, from %d to %d\n"
+			"  -l moves  Stop a game on such a board after the moves, large boards rarely fill up\n"
+			"  -q        Do not print the final boards\n",
+			name, name, name, AI_MAX_DEPTH, SIZED_MIN, SIZED_MAX);
+}
+
+/** Reads a whole stream into a string. Returns NULL on failure. */
+static char *read_stream(FILE *stream)
+{
+	size_t len = 0, cap = 4096;
+	char *buffer = malloc(cap);
+	while (buffer != NULL)
+	{
+		len += fread(buffer + len, 1, cap - len - 1, stream);
+		if (len < cap - 1)
+			break;
+		cap *= 2;
+		char *grown = realloc(buffer, cap);
+		if (grown == NULL)
+			free(buffer);
+		buffer = grown;
+	}
+	if (buffer != NULL)
+		buffer[len] = '\0';
+	return buffer;
+}
+
+static char *read_script(const char *path)
+{
+	if (strcmp(path, "-") == 0)
+		return read_stream(stdin);
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+		return NULL;
+	char *script = read_stream(file);
+	fclose(file);
+	return script;
+}
+
+/** Maps a script character to a direction. Returns false for other characters. */
+static bool parse_direction(char c, Direction *dir)
+{
+	switch (c)
+	{
+	case 'U':
+	case 'u':
+		*dir = DIRECTION_UP;
+		return true;
+	case 'D':
+	case 'd':
+		*dir = DIRECTION_DOWN;
+		return true;
+	case 'L':
+	case 'l':
+		*dir = DIRECTION_LEFT;
+		return true;
+	case 'R':
+	case 'r':
+		*dir = DIRECTION_RIGHT;
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool parse_options(int argc, char **argv, struct Options *options)
+{
+	options->games = 1;
+	options->seed = (uint64_t)time(NULL);
+	options->script = NULL;
+	options->quiet = false;
+	options->depth = 0;
+	options->budget = 0;
+	options->rollouts = 0;
+	options->threads = 0;
+	options->network = NULL;
+	options->record = NULL;
+	options->keyframes = 0;
+	options->playback = NULL;
+	options->seek = -1;
+	options->size = 0;
+	options->limit = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		const char *arg = argv[i];
+		if (strcmp(arg, "-q") == 0)
+		{
+			options->quiet = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+			return false;
+		const char *value = argv[++i];
+		if (strcmp(arg, "-n") == 0)
+			options->games = strtoul(value, NULL, 10);
+		else if (strcmp(arg, "-s") == 0)
+			options->seed = strtoull(value, NULL, 10);
+		else if (strcmp(arg, "-m") == 0)
+			options->script = strdup(value);
+		else if (strcmp(arg, "-a") == 0)
+			options->depth = (unsigned int)strtoul(value, NULL, 10);
+		else if (strcmp(arg, "-d") == 0)
+			options->budget = strtod(value, NULL);
+		else if (strcmp(arg, "-r") == 0)
+			options->rollouts = (unsigned int)strtoul(value, NULL, 10);
+		else if (strcmp(arg, "-t") == 0)
+			options->threads = (unsigned int)strtoul(value, NULL, 10);
+		else if (strcmp(arg, "-e") == 0)
+			options->network = value;
+		else if (strcmp(arg, "-w") == 0)
+			options->record = value;
+		else if (strcmp(arg, "-k") == 0)
+			options->keyframes = (uint32_t)strtoul(value, NULL, 10);
+		else if (strcmp(arg, "-p") == 0)
+			options->playback = value;
+		else if (strcmp(arg, "-b") == 0)
+			options->size = (unsigned int)strtoul(value, NULL, 10);
+		else if (strcmp(arg, "-l") == 0)
+			options->limit = strtoul(value, NULL, 10);
+		else if (strcmp(arg, "-j") == 0)
+			options->seek = strtol(value, NULL, 10);
+		else if (strcmp(arg, "-f") == 0)
+		{
+			options->script = read_script(value);
+			if (options->script == NULL)
+			{
+				fprintf(stderr, "The script %s couldn't be read.\n", value);
+				exit(EXIT_FAILURE);
+			}
+		}
+		else
+			return false;
+	}
+	return true;
+}
+
+/** Returns the wall clock time in seconds, which also counts idle threads. */
+static double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** Moves the game and records the move if it changed the board. Returns if it did. */
+static bool step(Game *game, Direction dir)
+{
+	if (!game_step(game, dir))
+		return false;
+	if (g_replay != NULL)
+		replay_move(g_replay, dir, game_last_spawn(game));
+	return true;
+}
+
+/** Plays one game to the end of the script or until game over. */
+static unsigned long play_scripted(Game *game, const char *script)
+{
+	unsigned long moves = 0;
+	Direction dir;
+	for (const char *c = script; *c && !game_is_over(game); c++)
+	{
+		if (parse_direction(*c, &dir))
+		{
+			if (step(game, dir))
+				moves++;
+		}
+	}
+	return moves;
+}
+
+/** Plays one game with random moves until game over. */
+static unsigned long play_random(Game *game, Rng *input)
+{
+	unsigned long moves = 0;
+	while (!game_is_over(game))
+	{
+		if (step(game, (Direction)rng_bounded(input, 4)))
+			moves++;
+	}
+	return moves;
+}
+
+/** Plays one game with the solver until game over, timed if budget is not 0. */
+static unsigned long play_ai(Game *game, AI *ai, double budget, AIStats *stats, AITimeStats *time_stats)
+{
+	unsigned long moves = 0;
+	unsigned char board[SIZE][SIZE];
+	Direction dir;
+	while (!game_is_over(game))
+	{
+		game_get_board(game, board);
+		bool found = budget > 0 ? ai_best_move_timed(ai, board_to_bitboard(board), budget, &dir, time_stats)
+								: ai_best_move(ai, board, &dir, stats);
+		if (!found)
+			break;
+		if (step(game, dir))
+			moves++;
+	}
+	return moves;
+}
+
+/** Plays one game with the Monte Carlo player until game over. */
+static unsigned long play_mc(Game *game, MonteCarlo *mc, MCStats *stats)
+{
+	unsigned long moves = 0;
+	unsigned char board[SIZE][SIZE];
+	Direction dir;
+	while (!game_is_over(game))
+	{
+		game_get_board(game, board);
+		if (!mc_best_move(mc, board, &dir, stats))
+			break;
+		if (step(game, dir))
+			moves++;
+	}
+	return moves;
+}
+
+/** Plays one game with the n-tuple network until game over. */
+static unsigned long play_network(Game *game, const NTuple *net)
+{
+	unsigned long moves = 0;
+	unsigned char board[SIZE][SIZE];
+	Direction dir;
+	while (!game_is_over(game))
+	{
+		game_get_board(game, board);
+		if (!ntuple_best_move(net, board_to_bitboard(board), &dir))
+			break;
+		if (step(game, dir))
+			moves++;
+	}
+	return moves;
+}
+
+/** Plays back every game of a replay file, or jumps to a move of them if seek is not negative. */
+static int play_back(const char *path, long seek, bool quiet)
+{
+	ReplayReader *reader = replay_reader_open(path);
+	if (reader == NULL)
+	{
+		fprintf(stderr, "The replay %s couldn't be read.\n", path);
+		return EXIT_FAILURE;
+	}
+	unsigned long games = 0, total_moves = 0;
+	double start = now_seconds();
+	ReplayGame replay;
+	unsigned char board[SIZE][SIZE];
+	Score score;
+	while (replay_reader_next(reader, &replay))
+	{
+		uint32_t move = replay.moves;
+		if (seek >= 0 && (unsigned long)seek < replay.moves)
+			move = (uint32_t)seek;
+		if (seek >= 0)
+			total_moves += replay_seek(&replay, move, board, &score);
+		else
+		{
+			replay_play(&replay, move, board, &score);
+			total_moves += move;
+		}
+		games++;
+		if (!quiet)
+		{
+			printf("Game %lu (seed %llu): score %lu, merge score %lu, max tile %lu, move %lu of %lu\n", games,
+				   (unsigned long long)replay.seed, score.sum, score.merged,
+				   pow_int(BASE, score.max_tile), (unsigned long)move, (unsigned long)replay.moves);
+			print_board(board, stdout);
+		}
+	}
+	double seconds = now_seconds() - start;
+	replay_reader_close(reader);
+
+	printf("%lu games, %lu moves played back in %.3f s", games, total_moves, seconds);
+	if (seconds > 0)
+		printf(" (%.0f moves/sec)", total_moves / seconds);
+	printf("\n");
+	return EXIT_SUCCESS;
+}
+
+/** Plays random games on a board of another size, with the kernels of that size. */
+static int play_sized(const struct Options *options)
+{
+	const SizedOps *ops = sized_ops(options->size);
+	if (ops == NULL)
+	{
+		fprintf(stderr, "The board size must be from %d to %d.\n", SIZED_MIN, SIZED_MAX);
+		return EXIT_FAILURE;
+	}
+	unsigned char cells[SIZED_MAX * SIZED_MAX];
+	unsigned long total_moves = 0;
+	double start = now_seconds();
+	for (unsigned long g = 0; g < options->games; g++)
+	{
+		uint64_t seed = options->seed + g;
+		Rng rng, input;
+		rng_seed(&rng, seed);
+		rng_seed(&input, ~seed);
+		Score score;
+		sized_clear(ops, cells);
+		sized_add_random(ops, cells, &rng);
+		sized_score_reset(ops, cells, &score);
+		unsigned long moves = 0;
+		bool over;
+		while (!(over = sized_is_game_over(ops, cells)) && (options->limit == 0 || moves < options->limit))
+		{
+			sized_move_with_spawn(ops, cells, (Direction)rng_bounded(&input, 4), &rng, &score);
+			moves++;
+		}
+		total_moves += moves;
+		if (!options->quiet)
+		{
+			printf("Game %lu (seed %llu): score %lu, merge score %lu, max tile %lu, moves %lu%s\n", g + 1,
+				   (unsigned long long)seed, score.sum, score.merged, pow_int(BASE, score.max_tile), moves,
+				   over ? ", game over" : "");
+			sized_print(ops, cells, stdout);
+		}
+	}
+	double seconds = now_seconds() - start;
+
+	printf("%lu games, %lu moves on %ux%u (%s kernels) in %.3f s", options->games, total_moves,
+		   ops->size, ops->size, ops->kernel, seconds);
+	if (seconds > 0)
+		printf(" (%.0f moves/sec)", total_moves / seconds);
+	printf("\n");
+	return EXIT_SUCCESS;
+}
+
+/**
+ * @brief The standard main function
+ *
+ * Plays the games and prints the results
+ *
+ * @param argc Number of arguments
+ * @param argv Arguments
+ */
+int main(int argc, char **argv)
+{
+	struct Options options;
+	if (!parse_options(argc, argv, &options))
+	{
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (options.playback)
+		return play_back(options.playback, options.seek, options.quiet);
+	if (options.size)
+		return play_sized(&options);
+	if (options.record)
+	{
+		g_replay = replay_writer_open(options.record);
+		if (g_replay == NULL)
+		{
+			fprintf(stderr, "The replay %s couldn't be opened.\n", options.record);
+			return EXIT_FAILURE;
+		}
+		replay_set_keyframes(g_replay, options.keyframes);
+	}
+	Game *game = game_create(options.seed);
+	if (game == NULL)
+	{
+		fprintf(stderr, "The game couldn't be created.\n");
+		return EXIT_FAILURE;
+	}
+
+	AI *ai = NULL;
+	AIStats stats = {0, 0};
+	AITimeStats time_stats;
+	memset(&time_stats, 0, sizeof(time_stats));
+	if ((options.depth > 0 || options.budget > 0) && options.script == NULL)
+	{
+		AIConfig config;
+		ai_default_config(&config);
+		config.depth = options.depth > 0 ? options.depth : AI_MAX_DEPTH;
+		ai = ai_create(&config);
+		if (ai == NULL)
+		{
+			fprintf(stderr, "The solver couldn't be created.\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	ThreadPool *pool = NULL;
+	MonteCarlo *mc = NULL;
+	MCStats mc_stats = {0, 0};
+	if (options.rollouts > 0 && ai == NULL && options.script == NULL)
+	{
+		MCConfig config;
+		mc_default_config(&config);
+		config.rollouts = options.rollouts;
+		config.seed = ~options.seed;
+		pool = threadpool_create(options.threads);
+		mc = pool ? mc_create(&config, pool) : NULL;
+		if (mc == NULL)
+		{
+			fprintf(stderr, "The Monte Carlo player couldn't be created.\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	NTuple *net = NULL;
+	if (options.network && ai == NULL && mc == NULL && options.script == NULL)
+	{
+		net = ntuple_load(options.network);
+		//No game is played with weights that don't match their checksum
+		if (net == NULL || !ntuple_verify(net))
+		{
+			fprintf(stderr, "The network %s couldn't be read or is corrupt.\n", options.network);
+			ntuple_destroy(net);
+			game_destroy(game);
+			replay_writer_close(g_replay);
+			free(options.script);
+			return EXIT_FAILURE;
+		}
+	}
+
+	unsigned long games = options.script ? 1 : options.games;
+	unsigned long total_moves = 0;
+	double start = now_seconds();
+	for (unsigned long g = 0; g < games; g++)
+	{
+		uint64_t seed = options.seed + g;
+		game_reset(game, seed);
+		if (g_replay)
+			replay_begin(g_replay, seed, game_last_spawn(game));
+		unsigned long moves;
+		if (options.script)
+			moves = play_scripted(game, options.script);
+		else if (ai)
+			moves = play_ai(game, ai, options.budget, &stats, &time_stats);
+		else if (mc)
+			moves = play_mc(game, mc, &mc_stats);
+		else if (net)
+			moves = play_network(game, net);
+		else
+		{
+			//The input has its own stream, so the game only depends on its seed
+			Rng input;
+			rng_seed(&input, ~seed);
+			moves = play_random(game, &input);
+		}
+		total_moves += moves;
+		if (g_replay && !replay_end(g_replay))
+		{
+			fprintf(stderr, "The replay %s couldn't be written.\n", options.record);
+			return EXIT_FAILURE;
+		}
+		if (!options.quiet)
+		{
+			unsigned char board[SIZE][SIZE];
+			game_get_board(game, board);
+			printf("Game %lu (seed %llu): score %lu, merge score %lu, max tile %lu, moves %lu%s\n", g + 1,
+				   (unsigned long long)seed, game_score(game), game_merge_score(game),
+				   pow_int(BASE, game_max_tile(game)), moves,
+				   game_is_over(game) ? ", game over" : "");
+			print_board(board, stdout);
+		}
+	}
+	double seconds = now_seconds() - start;
+
+	printf("%lu games, %lu moves in %.3f s", games, total_moves, seconds);
+	if (seconds > 0)
+		printf(" (%.0f moves/sec)", total_moves / seconds);
+	printf("\n");
+	if (ai && options.budget > 0)
+	{
+		printf("Depth reached:");
+		for (unsigned int depth = 1; depth <= AI_MAX_DEPTH; depth++)
+			if (time_stats.depths[depth])
+				printf(" %u: %.1f%%", depth, 100.0 * time_stats.depths[depth] / time_stats.moves);
+		printf("\nLatency per move: p50 < %.0f us, p99 < %.0f us, max %.0f us (budget %.0f us)\n",
+			   ai_latency_percentile(&time_stats, 0.5), ai_latency_percentile(&time_stats, 0.99),
+			   time_stats.max_us, options.budget * 1000);
+	}
+	else if (ai)
+	{
+		printf("%llu nodes, %llu table hits", stats.nodes, stats.table_hits);
+		if (seconds > 0)
+			printf(" (%.0f nodes/sec)", stats.nodes / seconds);
+		printf("\n");
+	}
+	if (mc)
+	{
+		printf("%llu rollouts, %llu rollout moves on %u threads", mc_stats.rollouts,
+			   mc_stats.moves, threadpool_size(pool));
+		if (seconds > 0)
+			printf(" (%.0f rollout moves/sec)", mc_stats.moves / seconds);
+		printf("\n");
+	}
+
+	ai_destroy(ai);
+	mc_destroy(mc);
+	threadpool_destroy(pool);
+	ntuple_destroy(net);
+	if (!replay_writer_close(g_replay))
+	{
+		fprintf(stderr, "The replay %s couldn't be written.\n", options.record);
+		return EXIT_FAILURE;
+	}
+	game_destroy(game);
+	free(options.script);
+	return EXIT_SUCCESS;
+}
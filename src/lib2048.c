@@ -0,0 +1,90 @@
+/**
+ * @file lib2048.c
+ * @author Gnik Droy
+ * @brief File containing implementation of the headless core library.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "lib2048.h"
+
+/** @struct Game
+ *  @brief The state of a single running game.
+ *
+ *  @var Game::board
+ *  The game board
+ *  @var Game::rng
+ *  The random number generator of the game
+ *  @var Game::score
+ *  The score of the game, updated on every step
+ *  @var Game::spawn
+ *  The cell of the last new tile
+ */
+struct Game
+{
+	unsigned char board[SIZE][SIZE];
+	Rng rng;
+	Score score;
+	unsigned int spawn;
+};
+
+Game *game_create(uint64_t seed)
+{
+	Game *game = malloc(sizeof(Game));
+	if (game == NULL)
+		return NULL;
+	game_reset(game, seed);
+	return game;
+}
+
+void game_destroy(Game *game)
+{
+	free(game);
+}
+
+void game_reset(Game *game, uint64_t seed)
+{
+	rng_seed(&game->rng, seed);
+	clear_board(game->board);
+	game->spawn = add_random(game->board, &game->rng);
+	score_reset(&game->score, game->board);
+}
+
+bool game_step(Game *game, Direction dir)
+{
+	int spawn = move_with_spawn(game->board, dir, &game->rng, &game->score);
+	if (spawn < 0)
+		return false;
+	game->spawn = (unsigned int)spawn;
+	return true;
+}
+
+unsigned int game_last_spawn(const Game *game)
+{
+	return game->spawn;
+}
+
+unsigned long game_score(const Game *game)
+{
+	return game->score.sum;
+}
+
+unsigned long game_merge_score(const Game *game)
+{
+	return game->score.merged;
+}
+
+unsigned char game_max_tile(const Game *game)
+{
+	return game->score.max_tile;
+}
+
+bool game_is_over(const Game *game)
+{
+	return is_game_over(game->board);
+}
+
+void game_get_board(const Game *game, Board board)
+{
+	memcpy(board, game->board, sizeof(game->board));
+}
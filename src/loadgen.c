@@ -0,0 +1,463 @@
+/**
+ * @file loadgen.c
+ * @author Gnik Droy
+ * @brief File containing the load generator for the game server.
+ *
+ * Opens many connections to 2048-server and plays random moves on each,
+ * keeping a window of requests in flight per connection. Every response
+ * is timed from the send of its request; the throughput and the latency
+ * percentiles are printed at the end. Linux only.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "protocol.h"
+
+/** @def LOADGEN_MAX_WINDOW
+ * The largest number of requests in flight per connection. A power of two.
+ */
+#define LOADGEN_MAX_WINDOW 64
+
+/** @def LATENCY_STEPS
+ * The number of latency buckets per power of two of microseconds.
+ */
+#define LATENCY_STEPS 8
+
+/** @def LATENCY_BUCKETS
+ * The number of latency buckets. Bucket 0 counts responses faster than
+ * 1 microsecond, the last one everything slower than about 16 seconds.
+ */
+#define LATENCY_BUCKETS (1 + 24 * LATENCY_STEPS)
+
+/** @struct Options
+ *  @brief The command line options of the load generator.
+ *
+ *  @var Options::path
+ *  The Unix domain socket of the server, or NULL for TCP
+ *  @var Options::port
+ *  The TCP port of the server on 127.0.0.1
+ *  @var Options::connections
+ *  The number of connections
+ *  @var Options::window
+ *  The number of requests in flight per connection
+ *  @var Options::requests
+ *  The number of requests to send in total
+ *  @var Options::threads
+ *  The number of client threads, each with its own epoll loop
+ *  @var Options::seed
+ *  The seed of the random moves
+ */
+struct Options
+{
+	const char *path;
+	unsigned int port;
+	unsigned int connections;
+	unsigned int window;
+	unsigned long long requests;
+	unsigned int threads;
+	uint64_t seed;
+};
+
+/** @struct Connection
+ *  @brief A connection and its requests in flight.
+ *
+ *  @var Connection::fd
+ *  The socket
+ *  @var Connection::next_id
+ *  The id of the next request, ids are sent in order
+ *  @var Connection::in_flight
+ *  The number of requests waiting for a response
+ *  @var Connection::sent_at
+ *  The send time of every request in flight by its id
+ *  @var Connection::new_game
+ *  If the next request should start a new game
+ *  @var Connection::in_len
+ *  The bytes of partly read responses in Connection::in
+ */
+struct Connection
+{
+	int fd;
+	uint16_t next_id;
+	unsigned int in_flight;
+	uint64_t sent_at[LOADGEN_MAX_WINDOW];
+	bool new_game;
+	size_t in_len;
+	uint8_t in[LOADGEN_MAX_WINDOW * PROTO_MAX_RESPONSE];
+};
+
+/** @struct Client
+ *  @brief A client thread and its counters.
+ *
+ *  @var Client::options
+ *  The options of the run
+ *  @var Client::connections
+ *  The number of connections of the thread
+ *  @var Client::quota
+ *  The number of requests the thread sends
+ *  @var Client::sent
+ *  The number of requests sent
+ *  @var Client::received
+ *  The number of responses received
+ *  @var Client::games
+ *  The number of games played to the end
+ *  @var Client::unchanged
+ *  The number of moves that didn't change the board
+ *  @var Client::errors
+ *  The number of error responses
+ *  @var Client::latency
+ *  The number of responses by their latency, see LATENCY_BUCKETS
+ *  @var Client::max_us
+ *  The slowest response in microseconds
+ *  @var Client::rng
+ *  Picks the moves
+ *  @var Client::failed
+ *  If a connection failed
+ */
+struct Client
+{
+	const struct Options *options;
+	unsigned int connections;
+	unsigned long long quota;
+	unsigned long long sent;
+	unsigned long long received;
+	unsigned long long games;
+	unsigned long long unchanged;
+	unsigned long long errors;
+	unsigned long long latency[LATENCY_BUCKETS];
+	double max_us;
+	Rng rng;
+	bool failed;
+	pthread_t thread;
+};
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+			"Usage: %s [-u path | -p port] [-c connections] [-w window] [-n requests] [-t threads] [-s seed]\n"
+			"  -u path         Connect to a Unix domain socket\n"
+			"  -p port         Connect to 127.0.0.1 (default port 2048)\n"
+			"  -c connections  Number of connections, one game each (default 256)\n"
+			"  -w window       Requests in flight per connection, up to %d (default 1)\n"
+			"  -n requests     Number of requests in total (default 1000000)\n"
+			"  -t threads      Number of client threads (default 1)\n"
+			"  -s seed         Seed of the random moves (default 2048)\n",
+			name, LOADGEN_MAX_WINDOW);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static unsigned int latency_bucket(double us)
+{
+	if (us < 1)
+		return 0;
+	int exponent;
+	//us = fraction * 2^exponent with fraction in [0.5, 1)
+	double fraction = frexp(us, &exponent);
+	unsigned int bucket = 1 + (unsigned int)(exponent - 1) * LATENCY_STEPS +
+						  (unsigned int)((fraction * 2 - 1) * LATENCY_STEPS);
+	return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+/** Returns the upper bound in microseconds of the bucket holding a percentile. */
+static double latency_percentile(const unsigned long long *latency, unsigned long long count, double max_us,
+								 double fraction)
+{
+	unsigned long long rank = (unsigned long long)ceil(fraction * count), seen = 0;
+	for (unsigned int bucket = 0; bucket + 1 < LATENCY_BUCKETS; bucket++)
+	{
+		seen += latency[bucket];
+		if (seen >= rank && seen > 0)
+		{
+			if (bucket == 0)
+				return 1;
+			unsigned int step = (bucket - 1) % LATENCY_STEPS;
+			return ldexp(1 + (step + 1.0) / LATENCY_STEPS, (int)((bucket - 1) / LATENCY_STEPS));
+		}
+	}
+	return max_us;
+}
+
+static int connect_server(const struct Options *options)
+{
+	int fd;
+	if (options->path)
+	{
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, options->path, sizeof(addr.sun_path) - 1);
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		{
+			close(fd);
+			return -1;
+		}
+	}
+	else
+	{
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons((uint16_t)options->port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		{
+			close(fd);
+			return -1;
+		}
+		int one = 1;
+		if (fd >= 0)
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	return fd;
+}
+
+/** Sends the next request of a connection. Returns false on failure. */
+static bool send_request(struct Client *client, struct Connection *conn)
+{
+	uint8_t request[PROTO_REQUEST_SIZE];
+	if (conn->new_game)
+		proto_write_request(request, PROTO_NEW, 0, conn->next_id);
+	else
+		proto_write_request(request, PROTO_MOVE, (uint8_t)rng_bounded(&client->rng, 4), conn->next_id);
+	//The response tells if the game ended, until then moves are sent
+	conn->new_game = false;
+	conn->sent_at[conn->next_id % LOADGEN_MAX_WINDOW] = now_ns();
+	//The socket buffer always has room for a window of requests
+	if (send(conn->fd, request, sizeof(request), MSG_NOSIGNAL) != sizeof(request))
+		return false;
+	conn->next_id++;
+	conn->in_flight++;
+	client->sent++;
+	return true;
+}
+
+/** Reads the responses of a connection and refills its window. Returns false on failure. */
+static bool receive(struct Client *client, struct Connection *conn)
+{
+	ssize_t got = recv(conn->fd, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len, 0);
+	if (got <= 0)
+		return got < 0 && (errno == EAGAIN || errno == EINTR);
+	uint64_t now = now_ns();
+	conn->in_len += (size_t)got;
+
+	size_t done = 0;
+	ProtoResponse response;
+	while (conn->in_len - done >= PROTO_HEADER_SIZE)
+	{
+		proto_read_header(conn->in + done, &response);
+		if (conn->in_len - done < PROTO_HEADER_SIZE + (size_t)response.count)
+			break;
+		done += PROTO_HEADER_SIZE + response.count;
+
+		double us = (now - conn->sent_at[response.id % LOADGEN_MAX_WINDOW]) / 1e3;
+		client->latency[latency_bucket(us)]++;
+		if (us > client->max_us)
+			client->max_us = us;
+		client->received++;
+		conn->in_flight--;
+		if (response.status == PROTO_OVER)
+		{
+			client->games++;
+			conn->new_game = true;
+		}
+		else if (response.status == PROTO_UNCHANGED)
+			client->unchanged++;
+		else if (response.status == PROTO_ERROR)
+			client->errors++;
+	}
+	memmove(conn->in, conn->in + done, conn->in_len - done);
+	conn->in_len -= done;
+
+	while (conn->in_flight < client->options->window && client->sent < client->quota)
+		if (!send_request(client, conn))
+			return false;
+	return true;
+}
+
+static void *run_client(void *arg)
+{
+	struct Client *client = arg;
+	struct Connection *conns = calloc(client->connections, sizeof(struct Connection));
+	int epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (conns == NULL || epoll < 0)
+	{
+		client->failed = true;
+		free(conns);
+		return NULL;
+	}
+	unsigned int open = 0;
+	for (; open < client->connections; open++)
+	{
+		struct Connection *conn = &conns[open];
+		conn->fd = connect_server(client->options);
+		struct epoll_event event = {EPOLLIN, {.u32 = open}};
+		if (conn->fd < 0 || epoll_ctl(epoll, EPOLL_CTL_ADD, conn->fd, &event) < 0)
+		{
+			client->failed = true;
+			break;
+		}
+	}
+
+	//Every connection starts with a window of requests, the first starts its game
+	for (unsigned int i = 0; i < open && !client->failed; i++)
+	{
+		conns[i].new_game = true;
+		while (conns[i].in_flight < client->options->window && client->sent < client->quota)
+		{
+			//A failed send counts no request, so it would be tried forever
+			if (!send_request(client, &conns[i]))
+			{
+				client->failed = true;
+				break;
+			}
+		}
+	}
+
+	struct epoll_event events[256];
+	while (!client->failed && client->received < client->sent)
+	{
+		int count = epoll_wait(epoll, events, 256, 1000);
+		if (count < 0 && errno != EINTR)
+			break;
+		if (count == 0)
+		{
+			fprintf(stderr, "The server stopped responding.\n");
+			client->failed = true;
+		}
+		for (int i = 0; i < count; i++)
+			if (!receive(client, &conns[events[i].data.u32]))
+				client->failed = true;
+	}
+
+	for (unsigned int i = 0; i < open; i++)
+		close(conns[i].fd);
+	close(epoll);
+	free(conns);
+	return NULL;
+}
+
+/**
+ * @brief The standard main function
+ *
+ * Runs the load and prints the throughput and the latency percentiles.
+ *
+ * @param argc Number of arguments
+ * @param argv Arguments
+ */
+int main(int argc, char **argv)
+{
+	struct Options options = {NULL, 2048, 256, 1, 1000000, 1, 2048};
+	for (int i = 1; i < argc; i++)
+	{
+		if (i + 1 >= argc)
+		{
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		const char *arg = argv[i], *value = argv[++i];
+		if (strcmp(arg, "-u") == 0)
+			options.path = value;
+		else if (strcmp(arg, "-p") == 0)
+			options.port = (unsigned int)strtoul(value, NULL, 10);
+		else if (strcmp(arg, "-c") == 0)
+			options.connections = (unsigned int)strtoul(value, NULL, 10);
+		else if (strcmp(arg, "-w") == 0)
+			options.window = (unsigned int)strtoul(value, NULL, 10);
+		else if (strcmp(arg, "-n") == 0)
+			options.requests = strtoull(value, NULL, 10);
+		else if (strcmp(arg, "-t") == 0)
+			options.threads = (unsigned int)strtoul(value, NULL, 10);
+		else if (strcmp(arg, "-s") == 0)
+			options.seed = strtoull(value, NULL, 10);
+		else
+		{
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (options.threads == 0 || options.connections < options.threads || options.window == 0 ||
+		options.window > LOADGEN_MAX_WINDOW)
+	{
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	struct Client *clients = calloc(options.threads, sizeof(struct Client));
+	if (clients == NULL)
+	{
+		fprintf(stderr, "The clients couldn't be allocated.\n");
+		return EXIT_FAILURE;
+	}
+	uint64_t start = now_ns();
+	for (unsigned int i = 0; i < options.threads; i++)
+	{
+		//The connections and requests are split evenly, the first threads take the rest
+		clients[i].options = &options;
+		clients[i].connections = options.connections / options.threads + (i < options.connections % options.threads);
+		clients[i].quota = options.requests / options.threads + (i < options.requests % options.threads);
+		rng_seed(&clients[i].rng, options.seed + i);
+		if (pthread_create(&clients[i].thread, NULL, run_client, &clients[i]) != 0)
+		{
+			fprintf(stderr, "The client thread couldn't be created.\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	struct Client total;
+	memset(&total, 0, sizeof(total));
+	for (unsigned int i = 0; i < options.threads; i++)
+	{
+		pthread_join(clients[i].thread, NULL);
+		total.received += clients[i].received;
+		total.games += clients[i].games;
+		total.unchanged += clients[i].unchanged;
+		total.errors += clients[i].errors;
+		total.failed |= clients[i].failed;
+		if (clients[i].max_us > total.max_us)
+			total.max_us = clients[i].max_us;
+		for (unsigned int b = 0; b < LATENCY_BUCKETS; b++)
+			total.latency[b] += clients[i].latency[b];
+	}
+	double seconds = (now_ns() - start) / 1e9;
+	free(clients);
+
+	printf("%llu requests over %u connections in %.3f s", total.received, options.connections, seconds);
+	if (seconds > 0)
+		printf(" (%.0f requests/sec)", total.received / seconds);
+	printf("\n%llu games over, %llu unchanged moves, %llu errors\n", total.games, total.unchanged, total.errors);
+	printf("Latency: p50 < %.1f us, p99 < %.1f us, max %.1f us\n",
+		   latency_percentile(total.latency, total.received, total.max_us, 0.5),
+		   latency_percentile(total.latency, total.received, total.max_us, 0.99), total.max_us);
+	if (total.failed)
+	{
+		fprintf(stderr, "Not every connection could be served, is 2048-server running?\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,222 @@
+/**
+ * @file montecarlo.c
+ * @author Gnik Droy
+ * @brief File containing implementation of the Monte Carlo player.
+ *
+ */
+#include <stdlib.h>
+#include "montecarlo.h"
+
+/** @struct Chunk
+ *  @brief A task playing a part of the rollouts of one direction.
+ *
+ *  Every chunk is written by one task only and read after the pool
+ *  finished, so there is nothing to synchronize.
+ *
+ *  @var Chunk::board
+ *  The board after the move, before the new tile
+ *  @var Chunk::seed
+ *  The seed of the rollouts
+ *  @var Chunk::rollouts
+ *  The number of rollouts to play
+ *  @var Chunk::total
+ *  The sum of the merge scores of the rollouts
+ *  @var Chunk::moves
+ *  The number of moves made in the rollouts
+ */
+struct Chunk
+{
+	_Alignas(64) BitBoard board;
+	uint64_t seed;
+	unsigned int rollouts;
+	double total;
+	unsigned long long moves;
+};
+
+/** @struct MonteCarlo
+ *  @brief The player, its pool and its task storage.
+ *
+ *  @var MonteCarlo::config
+ *  The settings
+ *  @var MonteCarlo::pool
+ *  The pool the rollouts run on
+ *  @var MonteCarlo::owns_pool
+ *  If the pool was created by mc_create()
+ *  @var MonteCarlo::chunks
+ *  The tasks of the current search, for every direction
+ *  @var MonteCarlo::chunks_per_dir
+ *  The number of tasks per direction
+ *  @var MonteCarlo::rng
+ *  Draws the seeds of the chunks on the calling thread
+ */
+struct MonteCarlo
+{
+	MCConfig config;
+	ThreadPool *pool;
+	bool owns_pool;
+	struct Chunk *chunks;
+	unsigned int chunks_per_dir;
+	Rng rng;
+};
+
+void mc_default_config(MCConfig *config)
+{
+	config->rollouts = 256;
+	config->chunk = 16;
+	config->seed = 2048;
+}
+
+MonteCarlo *mc_create(const MCConfig *config, ThreadPool *pool)
+{
+	MonteCarlo *mc = calloc(1, sizeof(MonteCarlo));
+	if (mc == NULL)
+		return NULL;
+	if (config)
+		mc->config = *config;
+	else
+		mc_default_config(&mc->config);
+	if (mc->config.rollouts < 1)
+		mc->config.rollouts = 1;
+	if (mc->config.chunk < 1)
+		mc->config.chunk = 1;
+
+	mc->pool = pool;
+	if (pool == NULL)
+	{
+		mc->pool = threadpool_create(0);
+		mc->owns_pool = true;
+	}
+	mc->chunks_per_dir = (mc->config.rollouts + mc->config.chunk - 1) / mc->config.chunk;
+	if (mc->pool != NULL)
+		mc->chunks = aligned_alloc(_Alignof(struct Chunk), 4 * mc->chunks_per_dir * sizeof(struct Chunk));
+	if (mc->pool == NULL || mc->chunks == NULL)
+	{
+		mc_destroy(mc);
+		return NULL;
+	}
+	rng_seed(&mc->rng, mc->config.seed);
+	bitboard_init();
+	return mc;
+}
+
+void mc_destroy(MonteCarlo *mc)
+{
+	if (mc == NULL)
+		return;
+	if (mc->owns_pool)
+		threadpool_destroy(mc->pool);
+	free(mc->chunks);
+	free(mc);
+}
+
+/** Plays random moves until game over and returns the merge score. */
+static double rollout(BitBoard bitboard, Rng *rng, unsigned long long *moves)
+{
+	Score score = {0, 0, 0};
+	for (;;)
+	{
+		bitboard = bitboard_add_random(bitboard, rng);
+		//Draw directions without replacement until one is legal, so every
+		//legal direction is played with the same probability
+		Direction left[4] = {DIRECTION_UP, DIRECTION_DOWN, DIRECTION_LEFT, DIRECTION_RIGHT};
+		Direction dir = DIRECTION_UP;
+		BitBoard moved = bitboard;
+		for (unsigned int count = 4; count > 0 && moved == bitboard; count--)
+		{
+			unsigned int pick = count > 1 ? rng_bounded(rng, count) : 0;
+			dir = left[pick];
+			left[pick] = left[count - 1];
+			moved = bitboard_move_direction(bitboard, dir);
+		}
+		if (moved == bitboard)
+			break;
+		bitboard_update_score(bitboard, dir, &score);
+		bitboard = moved;
+		(*moves)++;
+	}
+	return (double)score.merged;
+}
+
+/** Plays the rollouts of a chunk. They are seeded from the chunk, so they don't depend on the worker. */
+static void play_chunk(struct Chunk *chunk)
+{
+	Rng rng;
+	rng_seed(&rng, chunk->seed);
+	double total = 0;
+	unsigned long long moves = 0;
+	for (unsigned int i = 0; i < chunk->rollouts; i++)
+		total += rollout(chunk->board, &rng, &moves);
+	chunk->total = total;
+	chunk->moves = moves;
+}
+
+static void run_chunk(void *arg, unsigned int worker)
+{
+	(void)worker;
+	play_chunk(arg);
+}
+
+bool mc_best_move_bitboard(MonteCarlo *mc, BitBoard bitboard, Direction *best, MCStats *stats)
+{
+	const unsigned int per_dir = mc->chunks_per_dir;
+	double merged[4];
+	bool legal[4];
+	for (unsigned int dir = 0; dir < 4; dir++)
+	{
+		BitBoard moved = bitboard_move_direction(bitboard, (Direction)dir);
+		legal[dir] = moved != bitboard;
+		if (!legal[dir])
+			continue;
+		Score score = {0, 0, 0};
+		bitboard_update_score(bitboard, (Direction)dir, &score);
+		merged[dir] = (double)score.merged;
+
+		unsigned int left = mc->config.rollouts;
+		for (unsigned int i = 0; i < per_dir; i++)
+		{
+			struct Chunk *chunk = &mc->chunks[dir * per_dir + i];
+			chunk->board = moved;
+			chunk->seed = rng_next(&mc->rng);
+			chunk->rollouts = left < mc->config.chunk ? left : mc->config.chunk;
+			chunk->total = 0;
+			chunk->moves = 0;
+			left -= chunk->rollouts;
+			//Run it here if it couldn't be queued
+			if (!threadpool_submit(mc->pool, run_chunk, chunk))
+				play_chunk(chunk);
+		}
+	}
+	threadpool_wait(mc->pool);
+
+	bool found = false;
+	double best_value = 0;
+	for (unsigned int dir = 0; dir < 4; dir++)
+	{
+		if (!legal[dir])
+			continue;
+		double total = 0;
+		for (unsigned int i = 0; i < per_dir; i++)
+		{
+			const struct Chunk *chunk = &mc->chunks[dir * per_dir + i];
+			total += chunk->total;
+			if (stats)
+			{
+				stats->rollouts += chunk->rollouts;
+				stats->moves += chunk->moves;
+			}
+		}
+		double value = merged[dir] + total / mc->config.rollouts;
+		if (!found || value > best_value)
+		{
+			found = true;
+			best_value = value;
+			*best = (Direction)dir;
+		}
+	}
+	return found;
+}
+
+bool mc_best_move(MonteCarlo *mc, const Board board, Direction *best, MCStats *stats)
+{
+	return mc_best_move_bitboard(mc, board_to_bitboard(board), best, stats);
+}
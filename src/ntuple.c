@@ -0,0 +1,436 @@
+/**
+ * @file ntuple.c
+ * @author Gnik Droy
+ * @brief File containing implementation of the n-tuple network.
+ *
+ */
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "ntuple.h"
+#include "symmetry.h"
+#include "tablefile.h"
+#include "bits.h"
+
+/** The table file section holding the version, the cells per tuple and the tuples */
+#define SECTION_META "NTUPMETA"
+
+/** The table file section holding the weights */
+#define SECTION_WEIGHTS "NTUPWGTS"
+
+/** The table file section holding the seed and the games trained, see ntuple_set_progress() */
+#define SECTION_PROGRESS "NTUPPROG"
+
+/** The size of the progress section */
+#define PROGRESS_SIZE 16
+
+/** The version of the weight sections */
+#define NTUPLE_VERSION 2
+
+/** The size of the meta section */
+#define META_SIZE 12
+
+/** The largest number of tuples in a network */
+#define MAX_TUPLES 5
+
+/** The exponent of a 2048 tile */
+#define WIN_TILE 11
+
+/** The tuples of the 4 cell network: two rows and three squares */
+static const unsigned char g_tuples4[][4] = {
+	{0, 1, 2, 3}, {4, 5, 6, 7}, {0, 1, 4, 5}, {1, 2, 5, 6}, {5, 6, 9, 10}};
+
+/** The tuples of the 6 cell network: two bent lines and two rectangles */
+static const unsigned char g_tuples6[][6] = {
+	{0, 1, 2, 3, 4, 5}, {4, 5, 6, 7, 8, 9}, {0, 1, 2, 4, 5, 6}, {4, 5, 6, 8, 9, 10}};
+
+/** @struct NTuple
+ *  @brief The tuples and their weights.
+ *
+ *  @var NTuple::cells
+ *  The number of cells per tuple
+ *  @var NTuple::tuples
+ *  The number of tuples
+ *  @var NTuple::table_size
+ *  The number of weights per tuple, 16^cells
+ *  @var NTuple::weights
+ *  The table of every tuple, one after the other
+ *  @var NTuple::file
+ *  The mapped file holding the weights, or NULL if they were allocated
+ *  @var NTuple::seed
+ *  The seed of the first game the network was trained on
+ *  @var NTuple::trained
+ *  The number of games the network was trained on
+ *  @var NTuple::shifts
+ *  The bit offset of every cell of every symmetric placement of a tuple
+ */
+struct NTuple
+{
+	unsigned int cells;
+	unsigned int tuples;
+	size_t table_size;
+	float *weights;
+	TableFile *file;
+	uint64_t seed;
+	unsigned long trained;
+	unsigned char shifts[MAX_TUPLES][SYMMETRY_COUNT][NTUPLE_MAX_CELLS];
+};
+
+/** @struct Session
+ *  @brief A call of ntuple_train() shared by its tasks.
+ *
+ *  @var Session::net
+ *  The network that is trained
+ *  @var Session::alpha
+ *  The learning rate of a single weight
+ *  @var Session::seed
+ *  The seed of the first game
+ *  @var Session::games
+ *  The number of games to play
+ *  @var Session::next
+ *  The next game to be played
+ *  @var Session::stats
+ *  The counters of every worker, on their own cache lines
+ */
+struct Session
+{
+	NTuple *net;
+	float alpha;
+	uint64_t seed;
+	unsigned long games;
+	atomic_ulong next;
+	struct WorkerStats *stats;
+};
+
+/** The counters of a worker, aligned so workers do not share lines */
+struct WorkerStats
+{
+	_Alignas(64) NTupleStats stats;
+};
+
+//The weights are shared by the training threads without locks. Relaxed
+//atomic loads and stores compile to plain moves but are not data races.
+static inline float load_weight(const float *weight)
+{
+	float value;
+	__atomic_load(weight, &value, __ATOMIC_RELAXED);
+	return value;
+}
+
+static inline void store_weight(float *weight, float value)
+{
+	__atomic_store(weight, &value, __ATOMIC_RELAXED);
+}
+
+/** Returns the table index of a tuple placement on the board. */
+static inline size_t tuple_index(BitBoard bitboard, const unsigned char *shifts, unsigned int cells)
+{
+	size_t index = 0;
+	for (unsigned int k = 0; k < cells; k++)
+		index |= (size_t)((bitboard >> shifts[k]) & 0xF) << (4 * k);
+	return index;
+}
+
+/** Sets up the tuples of a network, without its weights. */
+static NTuple *create(unsigned int cells)
+{
+	if (cells != 4 && cells != 6)
+		return NULL;
+	NTuple *net = calloc(1, sizeof(NTuple));
+	if (net == NULL)
+		return NULL;
+	net->cells = cells;
+	net->tuples = cells == 4 ? sizeof(g_tuples4) / sizeof(g_tuples4[0]) : sizeof(g_tuples6) / sizeof(g_tuples6[0]);
+	net->table_size = (size_t)1 << (4 * cells);
+
+	bitboard_init();
+	for (unsigned int t = 0; t < net->tuples; t++)
+	{
+		for (unsigned int s = 0; s < SYMMETRY_COUNT; s++)
+		{
+			for (unsigned int k = 0; k < cells; k++)
+			{
+				unsigned int cell = cells == 4 ? g_tuples4[t][k] : g_tuples6[t][k];
+				//Follow a full nibble through the symmetry to find where the cell goes
+				BitBoard moved = bitboard_symmetry((BitBoard)0xF << (4 * cell), s);
+				net->shifts[t][s][k] = (unsigned char)bits_ctz(moved);
+			}
+		}
+	}
+	return net;
+}
+
+/** Returns the size of the weights in bytes. */
+static size_t weights_size(const NTuple *net)
+{
+	return net->tuples * net->table_size * sizeof(float);
+}
+
+NTuple *ntuple_create(unsigned int cells)
+{
+	NTuple *net = create(cells);
+	if (net == NULL)
+		return NULL;
+	//Fresh pages read as 0 and are only backed once written
+	void *weights = mmap(NULL, weights_size(net), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (weights == MAP_FAILED)
+	{
+		free(net);
+		return NULL;
+	}
+#ifdef MADV_HUGEPAGE
+	//The lookups are spread over the whole table, huge pages spare TLB misses
+	madvise(weights, weights_size(net), MADV_HUGEPAGE);
+#endif
+	net->weights = weights;
+	return net;
+}
+
+void ntuple_destroy(NTuple *net)
+{
+	if (net == NULL)
+		return;
+	if (net->file)
+		tablefile_close(net->file);
+	else
+		munmap(net->weights, weights_size(net));
+	free(net);
+}
+
+unsigned int ntuple_cells(const NTuple *net)
+{
+	return net->cells;
+}
+
+float ntuple_value(const NTuple *net, BitBoard bitboard)
+{
+	float value = 0;
+	for (unsigned int t = 0; t < net->tuples; t++)
+	{
+		const float *table = net->weights + t * net->table_size;
+		for (unsigned int s = 0; s < SYMMETRY_COUNT; s++)
+			value += load_weight(&table[tuple_index(bitboard, net->shifts[t][s], net->cells)]);
+	}
+	return value;
+}
+
+/** Moves every weight the board is scored with by delta. */
+static void update(NTuple *net, BitBoard bitboard, float delta)
+{
+	for (unsigned int t = 0; t < net->tuples; t++)
+	{
+		float *table = net->weights + t * net->table_size;
+		for (unsigned int s = 0; s < SYMMETRY_COUNT; s++)
+		{
+			float *weight = &table[tuple_index(bitboard, net->shifts[t][s], net->cells)];
+			store_weight(weight, load_weight(weight) + delta);
+		}
+	}
+}
+
+/**
+ * Picks the move with the best reward plus afterstate value and returns
+ * its direction, afterstate, reward and value.
+ */
+static bool choose(const NTuple *net, BitBoard bitboard, Direction *best, BitBoard *after, Score *reward,
+				   float *value)
+{
+	bool found = false;
+	float best_value = 0;
+	for (unsigned int dir = 0; dir < 4; dir++)
+	{
+		BitBoard moved = bitboard_move_direction(bitboard, (Direction)dir);
+		if (moved == bitboard)
+			continue;
+		Score score = {0, 0, 0};
+		bitboard_update_score(bitboard, (Direction)dir, &score);
+		float afterstate = ntuple_value(net, moved);
+		if (!found || score.merged + afterstate > best_value)
+		{
+			found = true;
+			best_value = score.merged + afterstate;
+			*best = (Direction)dir;
+			*after = moved;
+			*reward = score;
+			*value = afterstate;
+		}
+	}
+	return found;
+}
+
+bool ntuple_best_move(const NTuple *net, BitBoard bitboard, Direction *best)
+{
+	BitBoard after;
+	Score reward;
+	float value;
+	return choose(net, bitboard, best, &after, &reward, &value);
+}
+
+/** Plays one game greedily and learns from every move of it. */
+static void train_game(NTuple *net, float alpha, Rng *rng, NTupleStats *stats)
+{
+	BitBoard bitboard = bitboard_add_random(0, rng);
+	BitBoard previous = 0;
+	bool started = false;
+	Score total = {0, 0, 1};
+	Direction dir;
+	BitBoard after;
+	Score reward;
+	float value;
+	while (choose(net, bitboard, &dir, &after, &reward, &value))
+	{
+		//The previous afterstate led to this one for the reward of the move
+		if (started)
+			update(net, previous, alpha * (reward.merged + value - ntuple_value(net, previous)));
+		total.merged += reward.merged;
+		if (reward.max_tile > total.max_tile)
+			total.max_tile = reward.max_tile;
+		previous = after;
+		started = true;
+		bitboard = bitboard_add_random(after, rng);
+		stats->moves++;
+	}
+	//Nothing follows the last afterstate
+	if (started)
+		update(net, previous, alpha * -ntuple_value(net, previous));
+
+	stats->games++;
+	stats->score += total.merged;
+	if (total.merged > stats->max_score)
+		stats->max_score = total.merged;
+	if (total.max_tile >= WIN_TILE)
+		stats->wins++;
+}
+
+static void run_session(void *arg, unsigned int worker)
+{
+	struct Session *session = arg;
+	NTupleStats *stats = &session->stats[worker].stats;
+	unsigned long game;
+	while ((game = atomic_fetch_add_explicit(&session->next, 1, memory_order_relaxed)) < session->games)
+	{
+		Rng rng;
+		rng_seed(&rng, session->seed + game);
+		train_game(session->net, session->alpha, &rng, stats);
+	}
+}
+
+static void add_stats(NTupleStats *stats, const NTupleStats *worker)
+{
+	stats->games += worker->games;
+	stats->moves += worker->moves;
+	stats->score += worker->score;
+	stats->wins += worker->wins;
+	if (worker->max_score > stats->max_score)
+		stats->max_score = worker->max_score;
+}
+
+void ntuple_train(NTuple *net, ThreadPool *pool, unsigned long games, float alpha, uint64_t seed,
+				  NTupleStats *stats)
+{
+	unsigned int workers = threadpool_size(pool);
+	//The checksums of mapped weights must be checked before they change
+	ntuple_verify(net);
+	struct Session session = {net, alpha / (net->tuples * SYMMETRY_COUNT), seed, games, 0, NULL};
+	session.stats = aligned_alloc(_Alignof(struct WorkerStats), workers * sizeof(struct WorkerStats));
+	if (session.stats != NULL)
+	{
+		memset(session.stats, 0, workers * sizeof(struct WorkerStats));
+		for (unsigned int i = 0; i < workers; i++)
+			if (!threadpool_submit(pool, run_session, &session))
+				break;
+		threadpool_wait(pool);
+	}
+	//Play the games that could not be handed to the pool here
+	NTupleStats local = {0, 0, 0, 0, 0};
+	unsigned long game;
+	while ((game = atomic_fetch_add_explicit(&session.next, 1, memory_order_relaxed)) < games)
+	{
+		Rng rng;
+		rng_seed(&rng, seed + game);
+		train_game(net, session.alpha, &rng, &local);
+	}
+	if (stats != NULL)
+	{
+		for (unsigned int i = 0; session.stats != NULL && i < workers; i++)
+			add_stats(stats, &session.stats[i].stats);
+		add_stats(stats, &local);
+	}
+	free(session.stats);
+}
+
+static void put_le(uint8_t *out, uint64_t value, unsigned int bytes)
+{
+	for (unsigned int i = 0; i < bytes; i++)
+		out[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint64_t get_le(const uint8_t *in, unsigned int bytes)
+{
+	uint64_t value = 0;
+	for (unsigned int i = 0; i < bytes; i++)
+		value |= (uint64_t)in[i] << (8 * i);
+	return value;
+}
+
+bool ntuple_save(const NTuple *net, const char *path)
+{
+	uint8_t meta[META_SIZE];
+	put_le(meta, NTUPLE_VERSION, 4);
+	put_le(meta + 4, net->cells, 4);
+	put_le(meta + 8, net->tuples, 4);
+	uint8_t progress[PROGRESS_SIZE];
+	put_le(progress, net->seed, 8);
+	put_le(progress + 8, net->trained, 8);
+	TableSection sections[] = {
+		{SECTION_META, meta, sizeof(meta)},
+		{SECTION_PROGRESS, progress, sizeof(progress)},
+		{SECTION_WEIGHTS, net->weights, weights_size(net)}};
+	return tablefile_write(path, sections, sizeof(sections) / sizeof(sections[0]));
+}
+
+NTuple *ntuple_load(const char *path)
+{
+	TableFile *file = tablefile_open(path, true);
+	if (file == NULL)
+		return NULL;
+	size_t meta_size = 0, size = 0;
+	const uint8_t *meta = tablefile_section(file, SECTION_META, &meta_size);
+	float *weights = tablefile_section(file, SECTION_WEIGHTS, &size);
+	NTuple *net = NULL;
+	if (meta != NULL && weights != NULL && meta_size == META_SIZE && get_le(meta, 4) == NTUPLE_VERSION)
+		net = create((unsigned int)get_le(meta + 4, 4));
+	if (net == NULL || get_le(meta + 8, 4) != net->tuples || size != weights_size(net))
+	{
+		free(net);
+		tablefile_close(file);
+		return NULL;
+	}
+	//The weights are used in place, nothing is read until it is looked up
+	net->weights = weights;
+	net->file = file;
+	//Older checkpoints have no progress, they start over at game 0
+	const uint8_t *progress = tablefile_section(file, SECTION_PROGRESS, &size);
+	if (progress != NULL && size == PROGRESS_SIZE)
+		ntuple_set_progress(net, get_le(progress, 8), (unsigned long)get_le(progress + 8, 8));
+	return net;
+}
+
+void ntuple_set_progress(NTuple *net, uint64_t seed, unsigned long games)
+{
+	net->seed = seed;
+	net->trained = games;
+}
+
+unsigned long ntuple_progress(const NTuple *net, uint64_t *seed)
+{
+	if (seed != NULL)
+		*seed = net->seed;
+	return net->trained;
+}
+
+bool ntuple_verify(NTuple *net)
+{
+	return net->file == NULL || tablefile_status(net->file, true) == TABLEFILE_VALID;
+}
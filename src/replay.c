@@ -0,0 +1,516 @@
+/**
+ * @file replay.c
+ * @author Gnik Droy
+ * @brief File containing implementation of the replay writer and reader.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "replay.h"
+
+/** The magic bytes at the start of a replay file */
+#define REPLAY_MAGIC "2048RPLY"
+
+/** The size of the file header */
+#define HEADER_SIZE 16
+
+/** The size of a chunk tag and length */
+#define CHUNK_HEADER_SIZE 8
+
+/** The size of the fixed part of a game chunk: the seed and the move count */
+#define GAME_HEADER_SIZE 12
+
+/** The tag of a game chunk */
+#define TAG_GAME "GAME"
+
+/** The tag of a keyframe chunk */
+#define TAG_KEYS "KEYS"
+
+/** The size of the fixed part of a keyframe chunk: the interval and the count */
+#define KEYS_HEADER_SIZE 8
+
+/** The size of a keyframe: a byte per cell and the merge score */
+#define KEYFRAME_SIZE (SIZE * SIZE + 8)
+
+/** The bits per new tile cell */
+#define SPAWN_BITS (SIZE * SIZE <= 16 ? 4 : 8)
+
+/** The size of the write buffer */
+#define WRITE_BUFFER_SIZE (1 << 16)
+
+/** @struct ReplayWriter
+ *  @brief The file, the write buffer and the game being recorded.
+ *
+ *  @var ReplayWriter::buffer
+ *  The chunks not yet written to the file
+ *  @var ReplayWriter::directions
+ *  The packed directions of the current game. Kept between games.
+ *  @var ReplayWriter::spawns
+ *  The packed new tile cells of the current game. Kept between games.
+ *  @var ReplayWriter::capacity
+ *  The size of ReplayWriter::directions and ReplayWriter::spawns
+ *  @var ReplayWriter::interval
+ *  The number of moves between keyframes, or 0 for none
+ *  @var ReplayWriter::board
+ *  The board of the current game, replayed to take keyframes
+ *  @var ReplayWriter::score
+ *  The score of the current game, replayed to take keyframes
+ *  @var ReplayWriter::keyframes
+ *  The keyframes of the current game. Kept between games.
+ *  @var ReplayWriter::keyframe_count
+ *  The number of keyframes of the current game
+ *  @var ReplayWriter::keyframe_capacity
+ *  The number of keyframes ReplayWriter::keyframes holds
+ *  @var ReplayWriter::keying
+ *  If keyframes are taken for the current game
+ *  @var ReplayWriter::recording
+ *  If a game was begun and not ended
+ *  @var ReplayWriter::failed
+ *  Set once a write failed
+ */
+struct ReplayWriter
+{
+	FILE *file;
+	uint8_t buffer[WRITE_BUFFER_SIZE];
+	size_t used;
+	uint8_t *directions;
+	uint8_t *spawns;
+	size_t capacity;
+	uint64_t seed;
+	uint32_t moves;
+	uint32_t interval;
+	unsigned char board[SIZE][SIZE];
+	Score score;
+	uint8_t *keyframes;
+	size_t keyframe_count;
+	size_t keyframe_capacity;
+	bool keying;
+	bool recording;
+	bool failed;
+};
+
+/** @struct ReplayReader
+ *  @brief The mapped file and the read position.
+ *
+ *  @var ReplayReader::data
+ *  The mapped file
+ *  @var ReplayReader::offset
+ *  The offset of the next chunk
+ *  @var ReplayReader::spawn_bits
+ *  The bits per new tile cell, from the file header
+ */
+struct ReplayReader
+{
+	const uint8_t *data;
+	size_t size;
+	size_t offset;
+	unsigned int spawn_bits;
+};
+
+static void put_le(uint8_t *out, uint64_t value, unsigned int bytes)
+{
+	for (unsigned int i = 0; i < bytes; i++)
+		out[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint64_t get_le(const uint8_t *in, unsigned int bytes)
+{
+	uint64_t value = 0;
+	for (unsigned int i = 0; i < bytes; i++)
+		value |= (uint64_t)in[i] << (8 * i);
+	return value;
+}
+
+static void make_header(uint8_t header[HEADER_SIZE])
+{
+	memset(header, 0, HEADER_SIZE);
+	memcpy(header, REPLAY_MAGIC, 8);
+	put_le(header + 8, REPLAY_VERSION, 2);
+	header[10] = SIZE;
+	header[11] = SPAWN_BITS;
+}
+
+/** Checks that a header was written by a compatible version for this SIZE. */
+static bool check_header(const uint8_t header[HEADER_SIZE])
+{
+	return memcmp(header, REPLAY_MAGIC, 8) == 0 &&
+		   get_le(header + 8, 2) <= REPLAY_VERSION &&
+		   header[10] == SIZE && header[11] == SPAWN_BITS;
+}
+
+/** Cuts a chunk torn by a crash off the end of the file, so new chunks 
+ *  follow the last complete one. Returns false if that failed. */
+static bool cut_torn_chunk(FILE *file)
+{
+	if (fseeko(file, 0, SEEK_END) != 0)
+		return false;
+	off_t size = ftello(file), end = HEADER_SIZE;
+	uint8_t chunk[CHUNK_HEADER_SIZE];
+	while (size - end >= CHUNK_HEADER_SIZE)
+	{
+		if (fseeko(file, end, SEEK_SET) != 0 || fread(chunk, 1, CHUNK_HEADER_SIZE, file) != CHUNK_HEADER_SIZE)
+			return false;
+		off_t length = (off_t)get_le(chunk + 4, 4);
+		if (length > size - end - CHUNK_HEADER_SIZE)
+			break;
+		end += CHUNK_HEADER_SIZE + length;
+	}
+	if (end != size && ftruncate(fileno(file), end) != 0)
+		return false;
+	return fseeko(file, 0, SEEK_END) == 0;
+}
+
+ReplayWriter *replay_writer_open(const char *path)
+{
+	ReplayWriter *writer = calloc(1, sizeof(ReplayWriter));
+	if (writer == NULL)
+		return NULL;
+	writer->file = fopen(path, "ab+");
+	if (writer->file == NULL)
+	{
+		free(writer);
+		return NULL;
+	}
+	uint8_t header[HEADER_SIZE];
+	fseek(writer->file, 0, SEEK_END);
+	if (ftell(writer->file) == 0)
+	{
+		make_header(header);
+		writer->failed = fwrite(header, 1, HEADER_SIZE, writer->file) != HEADER_SIZE;
+	}
+	else
+	{
+		//Only append to files this build can read back
+		rewind(writer->file);
+		writer->failed = fread(header, 1, HEADER_SIZE, writer->file) != HEADER_SIZE || !check_header(header) ||
+						 !cut_torn_chunk(writer->file);
+	}
+	if (writer->failed)
+	{
+		fclose(writer->file);
+		free(writer);
+		return NULL;
+	}
+	return writer;
+}
+
+bool replay_flush(ReplayWriter *writer)
+{
+	if (writer->used > 0 && fwrite(writer->buffer, 1, writer->used, writer->file) != writer->used)
+		writer->failed = true;
+	writer->used = 0;
+	if (fflush(writer->file) != 0)
+		writer->failed = true;
+	return !writer->failed;
+}
+
+bool replay_writer_close(ReplayWriter *writer)
+{
+	if (writer == NULL)
+		return true;
+	bool ok = replay_flush(writer);
+	if (fclose(writer->file) != 0)
+		ok = false;
+	free(writer->directions);
+	free(writer->spawns);
+	free(writer->keyframes);
+	free(writer);
+	return ok;
+}
+
+void replay_set_keyframes(ReplayWriter *writer, uint32_t interval)
+{
+	writer->interval = interval;
+}
+
+/** Stores the board after the current move as a keyframe. */
+static bool add_keyframe(ReplayWriter *writer)
+{
+	if (writer->keyframe_count == writer->keyframe_capacity)
+	{
+		size_t capacity = writer->keyframe_capacity ? writer->keyframe_capacity * 2 : 64;
+		uint8_t *keyframes = realloc(writer->keyframes, capacity * KEYFRAME_SIZE);
+		if (keyframes == NULL)
+			return false;
+		writer->keyframes = keyframes;
+		writer->keyframe_capacity = capacity;
+	}
+	uint8_t *keyframe = writer->keyframes + writer->keyframe_count++ * KEYFRAME_SIZE;
+	memcpy(keyframe, writer->board, SIZE * SIZE);
+	put_le(keyframe + SIZE * SIZE, writer->score.merged, 8);
+	return true;
+}
+
+/** Grows the per-game arrays so they hold the given number of moves. */
+static bool reserve_moves(ReplayWriter *writer, uint32_t moves)
+{
+	//The spawns need the most bytes per move, one more for the first tile
+	size_t needed = ((size_t)moves + 1) * SPAWN_BITS / 8 + 1;
+	if (needed <= writer->capacity)
+		return true;
+	size_t capacity = writer->capacity ? writer->capacity * 2 : 1024;
+	while (capacity < needed)
+		capacity *= 2;
+	uint8_t *directions = realloc(writer->directions, capacity);
+	if (directions == NULL)
+		return false;
+	writer->directions = directions;
+	uint8_t *spawns = realloc(writer->spawns, capacity);
+	if (spawns == NULL)
+		return false;
+	writer->spawns = spawns;
+	writer->capacity = capacity;
+	return true;
+}
+
+static void put_spawn(ReplayWriter *writer, uint32_t index, unsigned int spawn)
+{
+	if (SPAWN_BITS == 8)
+	{
+		writer->spawns[index] = (uint8_t)spawn;
+		return;
+	}
+	if (index % 2 == 0)
+		writer->spawns[index / 2] = (uint8_t)spawn;
+	else
+		writer->spawns[index / 2] |= (uint8_t)(spawn << 4);
+}
+
+void replay_begin(ReplayWriter *writer, uint64_t seed, unsigned int spawn)
+{
+	writer->seed = seed;
+	writer->moves = 0;
+	writer->keyframe_count = 0;
+	writer->recording = reserve_moves(writer, 0);
+	if (writer->recording)
+		put_spawn(writer, 0, spawn);
+	writer->keying = writer->interval > 0;
+	if (writer->keying)
+	{
+		clear_board(writer->board);
+		writer->board[spawn / SIZE][spawn % SIZE] = 1;
+		score_reset(&writer->score, writer->board);
+	}
+}
+
+bool replay_move(ReplayWriter *writer, Direction dir, unsigned int spawn)
+{
+	if (!writer->recording)
+		return false;
+	//A game with a missing move can't be replayed, so it is dropped
+	if (!reserve_moves(writer, writer->moves + 1))
+	{
+		writer->recording = false;
+		return false;
+	}
+	uint32_t move = writer->moves++;
+	if (move % 4 == 0)
+		writer->directions[move / 4] = (uint8_t)dir;
+	else
+		writer->directions[move / 4] |= (uint8_t)(dir << (2 * (move % 4)));
+	put_spawn(writer, move + 1, spawn);
+	if (writer->keying)
+	{
+		//Follow the game the same way a reader will replay it
+		move_tiles(writer->board, dir, &writer->score);
+		writer->board[spawn / SIZE][spawn % SIZE] = 1;
+		//Without memory for a keyframe the game is kept without any
+		if (writer->moves % writer->interval == 0 && !add_keyframe(writer))
+		{
+			writer->keying = false;
+			writer->keyframe_count = 0;
+		}
+	}
+	return true;
+}
+
+/** Copies bytes to the write buffer, or straight to the file if they don't fit. */
+static void append(ReplayWriter *writer, const void *data, size_t size)
+{
+	if (writer->used + size > WRITE_BUFFER_SIZE)
+		replay_flush(writer);
+	if (size > WRITE_BUFFER_SIZE)
+	{
+		if (fwrite(data, 1, size, writer->file) != size)
+			writer->failed = true;
+		return;
+	}
+	memcpy(writer->buffer + writer->used, data, size);
+	writer->used += size;
+}
+
+bool replay_end(ReplayWriter *writer)
+{
+	if (!writer->recording)
+		return false;
+	writer->recording = false;
+	size_t directions = ((size_t)writer->moves + 3) / 4;
+	size_t spawns = (((size_t)writer->moves + 1) * SPAWN_BITS + 7) / 8;
+	uint8_t header[CHUNK_HEADER_SIZE + GAME_HEADER_SIZE];
+	memcpy(header, TAG_GAME, 4);
+	put_le(header + 4, GAME_HEADER_SIZE + directions + spawns, 4);
+	put_le(header + 8, writer->seed, 8);
+	put_le(header + 16, writer->moves, 4);
+	append(writer, header, sizeof(header));
+	append(writer, writer->directions, directions);
+	append(writer, writer->spawns, spawns);
+	if (writer->keyframe_count > 0)
+	{
+		//The keyframes follow the game they belong to
+		uint8_t keys[CHUNK_HEADER_SIZE + KEYS_HEADER_SIZE];
+		memcpy(keys, TAG_KEYS, 4);
+		put_le(keys + 4, KEYS_HEADER_SIZE + writer->keyframe_count * KEYFRAME_SIZE, 4);
+		put_le(keys + 8, writer->interval, 4);
+		put_le(keys + 12, writer->keyframe_count, 4);
+		append(writer, keys, sizeof(keys));
+		append(writer, writer->keyframes, writer->keyframe_count * KEYFRAME_SIZE);
+	}
+	return !writer->failed;
+}
+
+ReplayReader *replay_reader_open(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < HEADER_SIZE)
+	{
+		close(fd);
+		return NULL;
+	}
+	void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	//The mapping keeps the file alive
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+	ReplayReader *reader = malloc(sizeof(ReplayReader));
+	if (reader == NULL || !check_header(data))
+	{
+		munmap(data, (size_t)st.st_size);
+		free(reader);
+		return NULL;
+	}
+	madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+	reader->data = data;
+	reader->size = (size_t)st.st_size;
+	reader->offset = HEADER_SIZE;
+	reader->spawn_bits = ((const uint8_t *)data)[11];
+	return reader;
+}
+
+void replay_reader_close(ReplayReader *reader)
+{
+	if (reader == NULL)
+		return;
+	munmap((void *)reader->data, reader->size);
+	free(reader);
+}
+
+bool replay_reader_next(ReplayReader *reader, ReplayGame *game)
+{
+	while (reader->size - reader->offset >= CHUNK_HEADER_SIZE)
+	{
+		const uint8_t *chunk = reader->data + reader->offset;
+		uint64_t length = get_le(chunk + 4, 4);
+		if (length > reader->size - reader->offset - CHUNK_HEADER_SIZE)
+			return false;
+		reader->offset += CHUNK_HEADER_SIZE + length;
+		if (memcmp(chunk, TAG_GAME, 4) != 0 || length < GAME_HEADER_SIZE)
+			continue;
+
+		const uint8_t *payload = chunk + CHUNK_HEADER_SIZE;
+		game->seed = get_le(payload, 8);
+		game->moves = (uint32_t)get_le(payload + 8, 4);
+		game->spawn_bits = reader->spawn_bits;
+		size_t directions = ((size_t)game->moves + 3) / 4;
+		size_t spawns = (((size_t)game->moves + 1) * game->spawn_bits + 7) / 8;
+		if (GAME_HEADER_SIZE + directions + spawns > length)
+			return false;
+		game->directions = payload + GAME_HEADER_SIZE;
+		game->spawns = game->directions + directions;
+		game->keyframes = NULL;
+		game->keyframe_count = 0;
+		game->keyframe_interval = 0;
+
+		//Attach the keyframes if they follow
+		const uint8_t *keys = reader->data + reader->offset;
+		if (reader->size - reader->offset >= CHUNK_HEADER_SIZE + KEYS_HEADER_SIZE &&
+			memcmp(keys, TAG_KEYS, 4) == 0)
+		{
+			length = get_le(keys + 4, 4);
+			if (length > reader->size - reader->offset - CHUNK_HEADER_SIZE)
+				return true;
+			reader->offset += CHUNK_HEADER_SIZE + length;
+			uint32_t interval = (uint32_t)get_le(keys + CHUNK_HEADER_SIZE, 4);
+			uint32_t count = (uint32_t)get_le(keys + CHUNK_HEADER_SIZE + 4, 4);
+			if (interval > 0 && length >= KEYS_HEADER_SIZE + (uint64_t)count * KEYFRAME_SIZE &&
+				count <= game->moves / interval)
+			{
+				game->keyframes = keys + CHUNK_HEADER_SIZE + KEYS_HEADER_SIZE;
+				game->keyframe_count = count;
+				game->keyframe_interval = interval;
+			}
+		}
+		return true;
+	}
+	return false;
+}
+
+/** Plays the moves from one index to another on the board. */
+static void play_moves(const ReplayGame *game, uint32_t from, uint32_t to, Board board, Score *score)
+{
+	for (uint32_t i = from; i < to; i++)
+	{
+		move_tiles(board, replay_direction(game, i), score);
+		unsigned int cell = replay_spawn(game, i + 1);
+		board[cell / SIZE][cell % SIZE] = 1;
+		if (score != NULL)
+		{
+			score->sum += BASE;
+			if (score->max_tile < 1)
+				score->max_tile = 1;
+		}
+	}
+}
+
+void replay_play(const ReplayGame *game, uint32_t moves, Board board, Score *score)
+{
+	if (moves > game->moves)
+		moves = game->moves;
+	clear_board(board);
+	unsigned int cell = replay_spawn(game, 0);
+	board[cell / SIZE][cell % SIZE] = 1;
+	if (score != NULL)
+		score_reset(score, board);
+	play_moves(game, 0, moves, board, score);
+}
+
+uint32_t replay_seek(const ReplayGame *game, uint32_t move, Board board, Score *score)
+{
+	if (move > game->moves)
+		move = game->moves;
+	uint32_t key = game->keyframe_interval ? move / game->keyframe_interval : 0;
+	if (key > game->keyframe_count)
+		key = game->keyframe_count;
+	if (key == 0)
+	{
+		replay_play(game, move, board, score);
+		return move;
+	}
+	const uint8_t *keyframe = game->keyframes + (size_t)(key - 1) * KEYFRAME_SIZE;
+	for (unsigned int c = 0; c < SIZE * SIZE; c++)
+		board[c / SIZE][c % SIZE] = keyframe[c];
+	if (score != NULL)
+	{
+		score_reset(score, board);
+		score->merged = get_le(keyframe + SIZE * SIZE, 8);
+	}
+	uint32_t from = key * game->keyframe_interval;
+	play_moves(game, from, move, board, score);
+	return move - from;
+}
@@ -0,0 +1,22 @@
+/**
+ * @file rng.c
+ * @author Gnik Droy
+ * @brief File containing implementation of the random number generator.
+ *
+ */
+#include "rng.h"
+
+static uint64_t splitmix64(uint64_t *x)
+{
+	uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+void rng_seed(Rng *rng, uint64_t seed)
+{
+	//splitmix64 never yields four zero words in a row
+	for (unsigned int i = 0; i < 4; i++)
+		rng->s[i] = splitmix64(&seed);
+}
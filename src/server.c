@@ -0,0 +1,649 @@
+/**
+ * @file server.c
+ * @author Gnik Droy
+ * @brief File containing the game server.
+ *
+ * Hosts one game per connection over a Unix domain or loopback TCP
+ * socket, see protocol.h for the wire format. The games live in a slab of
+ * fixed size sessions per shard. Every shard runs one epoll loop on its
+ * own thread; the shards share the listening socket and the kernel wakes
+ * one of them per new connection. A full shard stops listening until a
+ * session closes, so connections are only rejected when every shard is
+ * full. Linux only.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "bitboard.h"
+#include "protocol.h"
+
+/** @def SERVER_OUT_SIZE
+ * The size of the output buffer of a shard and of the backlog of a
+ * session. A read never takes more requests than their responses fit
+ * in it.
+ */
+#define SERVER_OUT_SIZE 1024
+
+/** @def SERVER_EVENTS
+ * The number of events taken from epoll at once.
+ */
+#define SERVER_EVENTS 256
+
+/** The epoll data of the listening socket */
+#define TAG_LISTENER UINT32_MAX
+
+/** The epoll data of the shutdown eventfd */
+#define TAG_WAKE (UINT32_MAX - 1)
+
+/** The epoll data of the eventfd written when a shard stops listening */
+#define TAG_KICK (UINT32_MAX - 2)
+
+/** @struct Session
+ *  @brief A connection and its game, one slot of the slab.
+ *
+ *  @var Session::board
+ *  The packed board
+ *  @var Session::rng
+ *  The random number generator of the game
+ *  @var Session::score
+ *  The merge score, saturated
+ *  @var Session::fd
+ *  The socket, or -1 if the slot is free
+ *  @var Session::next_free
+ *  The next free slot while this one is free
+ *  @var Session::in_len
+ *  The bytes of a partly read request in Session::in
+ *  @var Session::backlog_len
+ *  The bytes of responses in Session::backlog
+ *  @var Session::backlog
+ *  The responses the full socket didn't take, or NULL. The session then
+ *  waits for it to be writable instead of reading
+ */
+struct Session
+{
+	BitBoard board;
+	Rng rng;
+	uint32_t score;
+	int fd;
+	uint32_t next_free;
+	uint8_t in_len;
+	uint8_t in[PROTO_REQUEST_SIZE];
+	uint16_t backlog_len;
+	uint8_t *backlog;
+};
+
+/** @struct Shard
+ *  @brief An event loop and its slab of sessions.
+ *
+ *  @var Shard::epoll
+ *  The epoll instance
+ *  @var Shard::sessions
+ *  The slab
+ *  @var Shard::capacity
+ *  The number of slots of the slab
+ *  @var Shard::free_head
+ *  The first free slot, or Shard::capacity if the slab is full
+ *  @var Shard::seeds
+ *  Seeds the new games of the shard
+ *  @var Shard::open
+ *  The number of open sessions
+ *  @var Shard::accepted
+ *  The number of accepted connections
+ *  @var Shard::rejected
+ *  The number of connections closed because the slab was full
+ *  @var Shard::requests
+ *  The number of requests answered
+ *  @var Shard::listening
+ *  If the listening socket is in the epoll set
+ *  @var Shard::out
+ *  The responses of the session being served
+ */
+struct Shard
+{
+	int epoll;
+	struct Session *sessions;
+	uint32_t capacity;
+	uint32_t free_head;
+	Rng seeds;
+	uint32_t open;
+	unsigned long long accepted;
+	unsigned long long rejected;
+	unsigned long long requests;
+	bool listening;
+	pthread_t thread;
+	uint8_t out[SERVER_OUT_SIZE];
+};
+
+/** The listening socket, shared by the shards */
+static int g_listener = -1;
+
+/** Written on SIGINT or SIGTERM, which stops every shard */
+static int g_wake = -1;
+
+/** Wakes every shard to accept the connections a full shard left pending */
+static int g_kick = -1;
+
+/** The number of shards with the listening socket in their epoll set */
+static atomic_uint g_listening;
+
+/** If the listening socket is a TCP socket */
+static bool g_tcp;
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+			"Usage: %s [-u path | -p port] [-t shards] [-c sessions] [-s seed]\n"
+			"  -u path      Listen on a Unix domain socket\n"
+			"  -p port      Listen on 127.0.0.1 (default port 2048)\n"
+			"  -t shards    Number of event loops, each on its own thread (default 1)\n"
+			"  -c sessions  Number of sessions per shard (default 16384)\n"
+			"  -s seed      Seed of the games (default time)\n",
+			name);
+}
+
+static void on_signal(int signal)
+{
+	(void)signal;
+	uint64_t one = 1;
+	if (write(g_wake, &one, sizeof(one)) < 0)
+		return;
+}
+
+/** Raises the limit of open files as far as allowed, a session needs one each. */
+static void raise_file_limit(void)
+{
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+}
+
+static int listen_unix(const char *path)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+	strcpy(addr.sun_path, path);
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int listen_tcp(unsigned int port)
+{
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/** Starts a new game with one tile in a session. */
+static void new_game(struct Shard *shard, struct Session *session)
+{
+	rng_seed(&session->rng, rng_next(&shard->seeds));
+	session->board = bitboard_add_random(0, &session->rng);
+	session->score = 0;
+}
+
+/** Writes a byte per cell that differs between two boards. Returns the count. */
+static uint8_t write_delta(uint8_t *out, BitBoard before, BitBoard after)
+{
+	//Fold every changed cell into the lowest bit of its nibble
+	BitBoard diff = before ^ after;
+	diff |= diff >> 2;
+	diff |= diff >> 1;
+	diff &= 0x1111111111111111ULL;
+	uint8_t count = 0;
+	for (; diff != 0; diff &= diff - 1)
+	{
+		unsigned int cell = (unsigned int)__builtin_ctzll(diff) / 4;
+		out[count++] = (uint8_t)(cell << 4 | ((after >> (4 * cell)) & 0xF));
+	}
+	return count;
+}
+
+/** Answers a request into out. Returns the size of the response. */
+static size_t respond(struct Shard *shard, struct Session *session, const uint8_t *request, uint8_t *out)
+{
+	ProtoResponse response = {PROTO_OK, 0, (uint16_t)(request[2] | request[3] << 8), 0};
+	BitBoard before = session->board;
+	switch (request[0])
+	{
+	case PROTO_NEW:
+		new_game(shard, session);
+		before = 0;
+		break;
+	case PROTO_MOVE:
+	{
+		if (request[1] > DIRECTION_RIGHT)
+		{
+			response.status = PROTO_ERROR;
+			break;
+		}
+		Direction dir = (Direction)request[1];
+		BitBoard moved = bitboard_move_direction(before, dir);
+		if (moved == before)
+		{
+			response.status = bitboard_is_game_over(before) ? PROTO_OVER : PROTO_UNCHANGED;
+			break;
+		}
+		Score score = {0, 0, 0};
+		bitboard_update_score(before, dir, &score);
+		uint64_t total = (uint64_t)session->score + score.merged;
+		session->score = total > UINT32_MAX ? UINT32_MAX : (uint32_t)total;
+		session->board = bitboard_add_random(moved, &session->rng);
+		if (bitboard_is_game_over(session->board))
+			response.status = PROTO_OVER;
+		break;
+	}
+	case PROTO_BOARD:
+		before = 0;
+		break;
+	default:
+		response.status = PROTO_ERROR;
+		break;
+	}
+	response.count = write_delta(out + PROTO_HEADER_SIZE, before, session->board);
+	response.score = session->score;
+	proto_write_header(out, &response);
+	return PROTO_HEADER_SIZE + response.count;
+}
+
+/** Adds the listening socket to the epoll set of a shard. Returns false on failure. */
+static bool start_listening(struct Shard *shard)
+{
+	//Only one shard is woken per connection
+	struct epoll_event listener = {EPOLLIN | EPOLLEXCLUSIVE, {.u32 = TAG_LISTENER}};
+	if (epoll_ctl(shard->epoll, EPOLL_CTL_ADD, g_listener, &listener) != 0)
+		return false;
+	shard->listening = true;
+	atomic_fetch_add(&g_listening, 1);
+	return true;
+}
+
+/**
+ * Removes the listening socket from a full shard, unless it is the last
+ * shard listening, which then rejects the connections. Returns if it was
+ * removed.
+ */
+static bool stop_listening(struct Shard *shard)
+{
+	if (atomic_fetch_sub(&g_listening, 1) == 1)
+	{
+		atomic_fetch_add(&g_listening, 1);
+		return false;
+	}
+	epoll_ctl(shard->epoll, EPOLL_CTL_DEL, g_listener, NULL);
+	shard->listening = false;
+	//The kernel may have woken only this shard for a pending connection
+	uint64_t one = 1;
+	if (write(g_kick, &one, sizeof(one)) < 0)
+		perror("The other shards couldn't be woken");
+	return true;
+}
+
+static void close_session(struct Shard *shard, uint32_t index)
+{
+	struct Session *session = &shard->sessions[index];
+	//Closing the socket also removes it from the epoll set
+	close(session->fd);
+	session->fd = -1;
+	free(session->backlog);
+	session->backlog = NULL;
+	session->backlog_len = 0;
+	session->next_free = shard->free_head;
+	shard->free_head = index;
+	shard->open--;
+	if (!shard->listening)
+		start_listening(shard);
+}
+
+/** Waits for the socket to be readable or, with output pending, writable. */
+static void watch(struct Shard *shard, uint32_t index, uint32_t events)
+{
+	struct epoll_event event = {events, {.u32 = index}};
+	epoll_ctl(shard->epoll, EPOLL_CTL_MOD, shard->sessions[index].fd, &event);
+}
+
+/**
+ * Sends responses, from Shard::out or the backlog. What the socket doesn't
+ * take becomes the backlog. Returns false if the session was closed.
+ */
+static bool send_responses(struct Shard *shard, uint32_t index, const uint8_t *out, size_t len)
+{
+	struct Session *session = &shard->sessions[index];
+	size_t done = 0;
+	while (done < len)
+	{
+		ssize_t sent = send(session->fd, out + done, len - done, MSG_NOSIGNAL);
+		if (sent > 0)
+		{
+			done += (size_t)sent;
+			continue;
+		}
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			//Only sessions whose client doesn't keep up hold a buffer
+			bool blocked = session->backlog != NULL;
+			if (!blocked && (session->backlog = malloc(SERVER_OUT_SIZE)) == NULL)
+				break;
+			memmove(session->backlog, out + done, len - done);
+			session->backlog_len = (uint16_t)(len - done);
+			//Stop reading until the client reads its responses
+			if (!blocked)
+				watch(shard, index, EPOLLOUT);
+			return true;
+		}
+		break;
+	}
+	if (done < len)
+	{
+		close_session(shard, index);
+		return false;
+	}
+	if (session->backlog != NULL)
+	{
+		free(session->backlog);
+		session->backlog = NULL;
+		session->backlog_len = 0;
+		watch(shard, index, EPOLLIN | EPOLLRDHUP);
+	}
+	return true;
+}
+
+/** Sends the backlog of a session. Returns false if the session was closed. */
+static bool flush(struct Shard *shard, uint32_t index)
+{
+	struct Session *session = &shard->sessions[index];
+	return send_responses(shard, index, session->backlog, session->backlog_len);
+}
+
+/** Reads the requests that are ready and answers them. */
+static void serve(struct Shard *shard, uint32_t index)
+{
+	struct Session *session = &shard->sessions[index];
+	//A session with a backlog waits for the socket to be writable
+	if (session->backlog != NULL)
+		return;
+	//Take no more requests than the responses fit in the output buffer
+	uint8_t in[SERVER_OUT_SIZE / PROTO_MAX_RESPONSE * PROTO_REQUEST_SIZE];
+	memcpy(in, session->in, session->in_len);
+	ssize_t got = recv(session->fd, in + session->in_len, sizeof(in) - session->in_len, 0);
+	if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+	{
+		close_session(shard, index);
+		return;
+	}
+	if (got < 0)
+		return;
+
+	size_t len = session->in_len + (size_t)got, done = 0, out_len = 0;
+	for (; done + PROTO_REQUEST_SIZE <= len; done += PROTO_REQUEST_SIZE)
+		out_len += respond(shard, session, in + done, shard->out + out_len);
+	shard->requests += done / PROTO_REQUEST_SIZE;
+	session->in_len = (uint8_t)(len - done);
+	memcpy(session->in, in + done, session->in_len);
+	send_responses(shard, index, shard->out, out_len);
+}
+
+/** Takes every pending connection into a free slot. */
+static void accept_sessions(struct Shard *shard)
+{
+	for (;;)
+	{
+		if (shard->free_head == shard->capacity && stop_listening(shard))
+			return;
+		int fd = accept4(g_listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			//EAGAIN, or another shard took it
+			return;
+		}
+		if (shard->free_head == shard->capacity)
+		{
+			close(fd);
+			shard->rejected++;
+			continue;
+		}
+		if (g_tcp)
+		{
+			int one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		}
+		uint32_t index = shard->free_head;
+		struct Session *session = &shard->sessions[index];
+		struct epoll_event event = {EPOLLIN | EPOLLRDHUP, {.u32 = index}};
+		if (epoll_ctl(shard->epoll, EPOLL_CTL_ADD, fd, &event) < 0)
+		{
+			close(fd);
+			continue;
+		}
+		shard->free_head = session->next_free;
+		session->fd = fd;
+		session->in_len = 0;
+		new_game(shard, session);
+		shard->open++;
+		shard->accepted++;
+	}
+}
+
+static void *run_shard(void *arg)
+{
+	struct Shard *shard = arg;
+	struct epoll_event events[SERVER_EVENTS];
+	for (;;)
+	{
+		int count = epoll_wait(shard->epoll, events, SERVER_EVENTS, -1);
+		if (count < 0 && errno != EINTR)
+			break;
+		for (int i = 0; i < count; i++)
+		{
+			uint32_t tag = events[i].data.u32;
+			if (tag == TAG_WAKE)
+				return NULL;
+			if (tag == TAG_KICK)
+			{
+				//Never read, the edge of every write wakes each shard
+				if (shard->listening)
+					accept_sessions(shard);
+				continue;
+			}
+			if (tag == TAG_LISTENER)
+			{
+				accept_sessions(shard);
+				continue;
+			}
+			//A session closed earlier in this batch may have been reused
+			if (shard->sessions[tag].fd < 0)
+				continue;
+			if (events[i].events & EPOLLOUT)
+				flush(shard, tag);
+			else
+				serve(shard, tag);
+		}
+	}
+	return NULL;
+}
+
+/** Sets up a shard and its slab. Returns false on failure. */
+static bool shard_init(struct Shard *shard, uint32_t capacity, uint64_t seed)
+{
+	memset(shard, 0, sizeof(*shard));
+	shard->capacity = capacity;
+	shard->sessions = calloc(capacity, sizeof(struct Session));
+	shard->epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (shard->sessions == NULL || shard->epoll < 0)
+		return false;
+	for (uint32_t i = 0; i < capacity; i++)
+	{
+		shard->sessions[i].fd = -1;
+		shard->sessions[i].next_free = i + 1;
+	}
+	rng_seed(&shard->seeds, seed);
+
+	//Edge triggered, so every shard sees a kick whoever reads it
+	struct epoll_event kick = {EPOLLIN | EPOLLET, {.u32 = TAG_KICK}};
+	struct epoll_event wake = {EPOLLIN, {.u32 = TAG_WAKE}};
+	return epoll_ctl(shard->epoll, EPOLL_CTL_ADD, g_kick, &kick) == 0 &&
+		   epoll_ctl(shard->epoll, EPOLL_CTL_ADD, g_wake, &wake) == 0 && start_listening(shard);
+}
+
+static void shard_free(struct Shard *shard)
+{
+	for (uint32_t i = 0; shard->sessions && i < shard->capacity; i++)
+		if (shard->sessions[i].fd >= 0)
+		{
+			close(shard->sessions[i].fd);
+			free(shard->sessions[i].backlog);
+		}
+	free(shard->sessions);
+	if (shard->epoll >= 0)
+		close(shard->epoll);
+}
+
+/**
+ * @brief The standard main function
+ *
+ * Serves games until SIGINT or SIGTERM, then prints the counters of
+ * every shard.
+ *
+ * @param argc Number of arguments
+ * @param argv Arguments
+ */
+int main(int argc, char **argv)
+{
+	const char *path = NULL;
+	unsigned int port = 2048, shards = 1;
+	uint32_t capacity = 16384;
+	uint64_t seed = (uint64_t)time(NULL);
+	for (int i = 1; i < argc; i++)
+	{
+		if (i + 1 >= argc)
+		{
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		const char *arg = argv[i], *value = argv[++i];
+		if (strcmp(arg, "-u") == 0)
+			path = value;
+		else if (strcmp(arg, "-p") == 0)
+			port = (unsigned int)strtoul(value, NULL, 10);
+		else if (strcmp(arg, "-t") == 0)
+			shards = (unsigned int)strtoul(value, NULL, 10);
+		else if (strcmp(arg, "-c") == 0)
+			capacity = (uint32_t)strtoul(value, NULL, 10);
+		else if (strcmp(arg, "-s") == 0)
+			seed = strtoull(value, NULL, 10);
+		else
+		{
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (shards == 0 || capacity == 0 || capacity >= TAG_KICK)
+	{
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	bitboard_init();
+	raise_file_limit();
+	g_tcp = path == NULL;
+	g_listener = path ? listen_unix(path) : listen_tcp(port);
+	g_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	g_kick = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (g_listener < 0 || g_wake < 0 || g_kick < 0)
+	{
+		perror("The server couldn't listen");
+		return EXIT_FAILURE;
+	}
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	struct Shard *all = calloc(shards, sizeof(struct Shard));
+	if (all == NULL)
+	{
+		fprintf(stderr, "The shards couldn't be allocated.\n");
+		return EXIT_FAILURE;
+	}
+	unsigned int started = 0;
+	for (; started < shards; started++)
+	{
+		//Every shard seeds its games from its own stream
+		if (!shard_init(&all[started], capacity, seed + started) ||
+			pthread_create(&all[started].thread, NULL, run_shard, &all[started]) != 0)
+		{
+			fprintf(stderr, "Shard %u couldn't be started.\n", started);
+			shard_free(&all[started]);
+			on_signal(SIGTERM);
+			break;
+		}
+	}
+	if (started == shards)
+	{
+		if (path)
+			printf("Listening on %s with %u shards of %u sessions\n", path, shards, capacity);
+		else
+			printf("Listening on 127.0.0.1:%u with %u shards of %u sessions\n", port, shards, capacity);
+		fflush(stdout);
+	}
+
+	unsigned long long requests = 0;
+	for (unsigned int i = 0; i < started; i++)
+	{
+		pthread_join(all[i].thread, NULL);
+		printf("Shard %u: %llu connections, %llu rejected, %llu requests\n", i, all[i].accepted,
+			   all[i].rejected, all[i].requests);
+		requests += all[i].requests;
+		shard_free(&all[i]);
+	}
+	printf("%llu requests\n", requests);
+	free(all);
+	close(g_listener);
+	close(g_wake);
+	close(g_kick);
+	if (path)
+		unlink(path);
+	return started == shards ? EXIT_SUCCESS : EXIT_FAILURE;
+}
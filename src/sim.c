@@ -0,0 +1,614 @@
+/**
+ * @file sim.c
+ * @author Gnik Droy
+ * @brief File containing the large scale simulation runner.
+ *
+ * Plays a number of games with one policy on a thread pool and collects
+ * the distribution of the largest tile, quantiles of the merge score and
+ * a histogram of the game lengths.
+ *
+ * The games are split into chunks of consecutive seeds and played in
+ * rounds. Every worker adds its games to its own counters; after a round
+ * they are merged, the finished chunks are marked in a bitmap and, every
+ * few seconds, both are written to a checkpoint. A killed run resumes
+ * from its checkpoint with the same results as if it never stopped.
+ */
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ai.h"
+#include "ntuple.h"
+#include "sketch.h"
+#include "tablefile.h"
+
+/** @def SIM_VERSION
+ * The version of the checkpoint sections.
+ */
+#define SIM_VERSION 1
+
+/** @def SIM_TILES
+ * The number of exponents counted by the largest tile distribution.
+ */
+#define SIM_TILES 16
+
+/** @def SIM_LENGTH_BUCKETS
+ * The number of game length buckets. Bucket i counts the games of
+ * 2^(i-1) up to 2^i moves, bucket 0 the games without a move.
+ */
+#define SIM_LENGTH_BUCKETS 32
+
+/** @def SIM_CHUNKS_PER_WORKER
+ * The chunks a round hands to every worker.
+ */
+#define SIM_CHUNKS_PER_WORKER 4
+
+/** @def SIM_PATH_SIZE
+ * The longest network path stored in a checkpoint, with its terminator.
+ */
+#define SIM_PATH_SIZE 256
+
+/** The policies that pick the moves */
+enum Policy
+{
+    POLICY_RANDOM,
+    POLICY_GREEDY,
+    POLICY_EXPECTIMAX,
+    POLICY_NETWORK
+};
+
+/** @struct Config
+ *  @brief The settings of a run, stored in its checkpoint.
+ *
+ *  @var Config::version
+ *  SIM_VERSION
+ *  @var Config::policy
+ *  The Policy
+ *  @var Config::depth
+ *  The search depth of POLICY_EXPECTIMAX
+ *  @var Config::seed
+ *  The seed of the first game. Game i is seeded with seed + i.
+ *  @var Config::games
+ *  The number of games
+ *  @var Config::chunk
+ *  The number of games per chunk
+ *  @var Config::network
+ *  The weights of POLICY_NETWORK
+ */
+struct Config
+{
+	uint32_t version;
+	uint32_t policy;
+	uint32_t depth;
+	uint64_t seed;
+	uint64_t games;
+	uint64_t chunk;
+	char network[SIM_PATH_SIZE];
+};
+
+/** @struct Stats
+ *  @brief The counters of a set of games.
+ *
+ *  @var Stats::games
+ *  The number of games
+ *  @var Stats::moves
+ *  The number of moves
+ *  @var Stats::tiles
+ *  The number of games by their largest exponent
+ *  @var Stats::lengths
+ *  The number of games by their moves, see SIM_LENGTH_BUCKETS
+ *  @var Stats::scores
+ *  The merge scores
+ */
+struct Stats
+{
+	uint64_t games;
+	uint64_t moves;
+	uint64_t tiles[SIM_TILES];
+	uint64_t lengths[SIM_LENGTH_BUCKETS];
+	Sketch scores;
+};
+
+/** The counters of a worker, aligned so workers do not share lines */
+struct WorkerStats
+{
+	_Alignas(64) struct Stats stats;
+};
+
+/** @struct Round
+ *  @brief The chunks of a round, shared by its tasks.
+ *
+ *  @var Round::config
+ *  The settings of the run
+ *  @var Round::chunks
+ *  The chunks to play
+ *  @var Round::count
+ *  The number of chunks
+ *  @var Round::next
+ *  The next chunk to be played
+ *  @var Round::stats
+ *  The counters of every worker
+ *  @var Round::ais
+ *  The solver of every worker for POLICY_EXPECTIMAX
+ *  @var Round::net
+ *  The network for POLICY_NETWORK
+ */
+struct Round
+{
+	const struct Config *config;
+	const uint64_t *chunks;
+	size_t count;
+	atomic_size_t next;
+	struct WorkerStats *stats;
+	AI **ais;
+	const NTuple *net;
+};
+
+/** Set by SIGINT or SIGTERM, the run stops after the current round */
+static volatile sig_atomic_t g_stop;
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+			"Usage: %s [-n games] [-g | -a depth | -e file] [-t threads] [-s seed] [-c games] [-o file [-i seconds]] [-j file]\n"
+			"       %s -r file [-t threads] [-i seconds] [-j file]\n"
+			"  -n games    Number of games to play (default 1000000)\n"
+			"  -g          Play the move with the largest merge score, random moves by default\n"
+			"  -a depth    Let the expectimax solver play with the search depth\n"
+			"  -e file     Let the n-tuple network with the weights from 2048-train play\n"
+			"  -t threads  Number of worker threads (default one per core)\n"
+			"  -s seed     Seed of the first game, game n uses seed + n (default 2048)\n"
+			"  -c games    Games per chunk, the unit of work and of checkpoints (default 10000)\n"
+			"  -o file     Write a checkpoint to the file\n"
+			"  -i seconds  Time between checkpoints (default 10)\n"
+			"  -r file     Resume the run of a checkpoint, and keep writing to it\n"
+			"  -j file     Write the statistics as JSON, '-' for stdout\n",
+			name, name);
+}
+
+static void on_signal(int signal)
+{
+	(void)signal;
+	g_stop = 1;
+}
+
+static double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void clear_stats(struct Stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	sketch_clear(&stats->scores);
+}
+
+static void merge_stats(struct Stats *stats, const struct Stats *other)
+{
+	stats->games += other->games;
+	stats->moves += other->moves;
+	for (unsigned int i = 0; i < SIM_TILES; i++)
+		stats->tiles[i] += other->tiles[i];
+	for (unsigned int i = 0; i < SIM_LENGTH_BUCKETS; i++)
+		stats->lengths[i] += other->lengths[i];
+	sketch_merge(&stats->scores, &other->scores);
+}
+
+/** Returns the largest exponent on the board. */
+static unsigned int max_tile(BitBoard bitboard)
+{
+	unsigned int max = 0;
+	for (; bitboard != 0; bitboard >>= 4)
+		if ((bitboard & 0xF) > max)
+			max = bitboard & 0xF;
+	return max;
+}
+
+/** Picks a move with the policy. Returns false if no move changes the board. */
+static bool pick_move(const struct Round *round, unsigned int worker, BitBoard bitboard, Rng *rng,
+					  Direction *dir)
+{
+	switch (round->config->policy)
+	{
+	case POLICY_EXPECTIMAX:
+		return ai_best_move_bitboard(round->ais[worker], bitboard, dir, NULL);
+	case POLICY_NETWORK:
+		return ntuple_best_move(round->net, bitboard, dir);
+	default:
+		break;
+	}
+	Direction legal[4];
+	unsigned int count = 0;
+	unsigned long best = 0;
+	for (unsigned int d = 0; d < 4; d++)
+	{
+		if (bitboard_move_direction(bitboard, (Direction)d) == bitboard)
+			continue;
+		if (round->config->policy == POLICY_GREEDY)
+		{
+			Score score = {0, 0, 0};
+			bitboard_update_score(bitboard, (Direction)d, &score);
+			//Keep only the moves with the largest merge score
+			if (count > 0 && score.merged < best)
+				continue;
+			if (count == 0 || score.merged > best)
+				count = 0;
+			best = score.merged;
+		}
+		legal[count++] = (Direction)d;
+	}
+	if (count == 0)
+		return false;
+	*dir = legal[count == 1 ? 0 : rng_bounded(rng, count)];
+	return true;
+}
+
+/** Plays one game and adds it to the counters. */
+static void play_game(const struct Round *round, unsigned int worker, uint64_t seed, struct Stats *stats)
+{
+	Rng rng;
+	rng_seed(&rng, seed);
+	//The policy has its own stream, so the spawns only depend on the seed
+	Rng input;
+	rng_seed(&input, ~seed);
+	BitBoard bitboard = bitboard_add_random(0, &rng);
+	Score score = {0, 0, 0};
+	uint64_t moves = 0;
+	Direction dir;
+	while (pick_move(round, worker, bitboard, &input, &dir))
+	{
+		bitboard_update_score(bitboard, dir, &score);
+		bitboard = bitboard_add_random(bitboard_move_direction(bitboard, dir), &rng);
+		moves++;
+	}
+
+	unsigned int length = 0;
+	while (length + 1 < SIM_LENGTH_BUCKETS && moves >= (uint64_t)1 << length)
+		length++;
+	stats->games++;
+	stats->moves += moves;
+	stats->tiles[max_tile(bitboard)]++;
+	stats->lengths[length]++;
+	sketch_add(&stats->scores, (double)score.merged);
+}
+
+static void run_round(void *arg, unsigned int worker)
+{
+	struct Round *round = arg;
+	const struct Config *config = round->config;
+	struct Stats *stats = &round->stats[worker].stats;
+	size_t next;
+	while ((next = atomic_fetch_add_explicit(&round->next, 1, memory_order_relaxed)) < round->count)
+	{
+		uint64_t first = round->chunks[next] * config->chunk;
+		uint64_t last = first + config->chunk < config->games ? first + config->chunk : config->games;
+		for (uint64_t game = first; game < last; game++)
+			play_game(round, worker, config->seed + game, stats);
+	}
+}
+
+/** Writes the settings, the bitmap of finished chunks and the counters. */
+static bool save_checkpoint(const char *path, const struct Config *config, const uint64_t *done, size_t words,
+							const struct Stats *stats)
+{
+	TableSection sections[] = {
+		{"SIMCONF", config, sizeof(*config)},
+		{"SIMDONE", done, words * sizeof(uint64_t)},
+		{"SIMSTATS", stats, sizeof(*stats)}};
+	return tablefile_write(path, sections, 3);
+}
+
+/** Reads a checkpoint. The bitmap is allocated. Returns false on failure. */
+static bool load_checkpoint(const char *path, struct Config *config, uint64_t **done, size_t *words,
+							struct Stats *stats)
+{
+	TableFile *file = tablefile_open(path, false);
+	if (file == NULL)
+		return false;
+	size_t config_size, done_size, stats_size;
+	const void *config_data = tablefile_section(file, "SIMCONF", &config_size);
+	const void *done_data = tablefile_section(file, "SIMDONE", &done_size);
+	const void *stats_data = tablefile_section(file, "SIMSTATS", &stats_size);
+	bool valid = tablefile_status(file, true) == TABLEFILE_VALID && config_data && done_data && stats_data &&
+				 config_size == sizeof(*config) && stats_size == sizeof(*stats) &&
+				 done_size % sizeof(uint64_t) == 0;
+	if (valid)
+	{
+		memcpy(config, config_data, sizeof(*config));
+		memcpy(stats, stats_data, sizeof(*stats));
+		*words = done_size / sizeof(uint64_t);
+		*done = malloc(done_size ? done_size : 1);
+		valid = *done != NULL && config->version == SIM_VERSION && config->chunk > 0 &&
+				*words == (config->games / config->chunk + 1 + 63) / 64;
+		if (*done)
+			memcpy(*done, done_data, done_size);
+	}
+	tablefile_close(file);
+	return valid;
+}
+
+/** Prints the statistics. */
+static void print_stats(const struct Stats *stats)
+{
+	if (stats->games == 0)
+		return;
+	printf("%llu games, %llu moves, %.1f moves per game\n", (unsigned long long)stats->games,
+		   (unsigned long long)stats->moves, (double)stats->moves / stats->games);
+	printf("Merge score: min %.0f, p50 %.0f, p90 %.0f, p99 %.0f, p99.9 %.0f, max %.0f\n", stats->scores.min,
+		   sketch_quantile(&stats->scores, 0.5), sketch_quantile(&stats->scores, 0.9),
+		   sketch_quantile(&stats->scores, 0.99), sketch_quantile(&stats->scores, 0.999), stats->scores.max);
+	printf("Largest tile:\n");
+	uint64_t reached = stats->games;
+	for (unsigned int i = 0; i < SIM_TILES; i++)
+	{
+		if (stats->tiles[i] != 0)
+			printf("  %6lu  %6.2f%%  reached by %6.2f%%\n", pow_int(BASE, i),
+				   100.0 * stats->tiles[i] / stats->games, 100.0 * reached / stats->games);
+		reached -= stats->tiles[i];
+	}
+	printf("Moves per game:\n");
+	for (unsigned int i = 0; i < SIM_LENGTH_BUCKETS; i++)
+		if (stats->lengths[i] != 0)
+			printf("  < %-8llu %6.2f%%\n", (unsigned long long)1 << i, 100.0 * stats->lengths[i] / stats->games);
+}
+
+static void write_json(FILE *stream, const struct Config *config, const struct Stats *stats)
+{
+	static const char *policies[] = {"random", "greedy", "expectimax", "network"};
+	fprintf(stream, "{\n  \"policy\": \"%s\",\n  \"seed\": %llu,\n  \"games\": %llu,\n  \"moves\": %llu,\n",
+			policies[config->policy], (unsigned long long)config->seed, (unsigned long long)stats->games,
+			(unsigned long long)stats->moves);
+	fprintf(stream, "  \"score\": {\"min\": %.0f, \"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, \"p999\": %.0f, \"max\": %.0f},\n",
+			stats->scores.min, sketch_quantile(&stats->scores, 0.5), sketch_quantile(&stats->scores, 0.9),
+			sketch_quantile(&stats->scores, 0.99), sketch_quantile(&stats->scores, 0.999), stats->scores.max);
+	fprintf(stream, "  \"max_tile\": {");
+	bool first = true;
+	for (unsigned int i = 0; i < SIM_TILES; i++)
+	{
+		if (stats->tiles[i] == 0)
+			continue;
+		fprintf(stream, "%s\"%lu\": %llu", first ? "" : ", ", pow_int(BASE, i), (unsigned long long)stats->tiles[i]);
+		first = false;
+	}
+	fprintf(stream, "},\n  \"moves_below\": {");
+	first = true;
+	for (unsigned int i = 0; i < SIM_LENGTH_BUCKETS; i++)
+	{
+		if (stats->lengths[i] == 0)
+			continue;
+		fprintf(stream, "%s\"%llu\": %llu", first ? "" : ", ", (unsigned long long)1 << i,
+				(unsigned long long)stats->lengths[i]);
+		first = false;
+	}
+	fprintf(stream, "}\n}\n");
+}
+
+/**
+ * @brief The standard main function
+ *
+ * Plays the games round by round, writes the checkpoints and prints the
+ * statistics.
+ *
+ * @param argc Number of arguments
+ * @param argv Arguments
+ */
+int main(int argc, char **argv)
+{
+	struct Config config;
+	memset(&config, 0, sizeof(config));
+	config.version = SIM_VERSION;
+	config.policy = POLICY_RANDOM;
+	config.seed = 2048;
+	config.games = 1000000;
+	config.chunk = 10000;
+	unsigned int threads = 0;
+	double interval = 10;
+	const char *output = NULL, *resume = NULL, *json = NULL;
+	for (int i = 1; i < argc; i++)
+	{
+		const char *arg = argv[i];
+		if (strcmp(arg, "-g") == 0)
+		{
+			config.policy = POLICY_GREEDY;
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		const char *value = argv[++i];
+		if (strcmp(arg, "-n") == 0)
+			config.games = strtoull(value, NULL, 10);
+		else if (strcmp(arg, "-a") == 0)
+		{
+			config.policy = POLICY_EXPECTIMAX;
+			config.depth = (uint32_t)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(arg, "-e") == 0)
+		{
+			config.policy = POLICY_NETWORK;
+			if (strlen(value) >= SIM_PATH_SIZE)
+			{
+				fprintf(stderr, "The path %s is too long.\n", value);
+				return EXIT_FAILURE;
+			}
+			strcpy(config.network, value);
+		}
+		else if (strcmp(arg, "-t") == 0)
+			threads = (unsigned int)strtoul(value, NULL, 10);
+		else if (strcmp(arg, "-s") == 0)
+			config.seed = strtoull(value, NULL, 10);
+		else if (strcmp(arg, "-c") == 0)
+			config.chunk = strtoull(value, NULL, 10);
+		else if (strcmp(arg, "-o") == 0)
+			output = value;
+		else if (strcmp(arg, "-i") == 0)
+			interval = strtod(value, NULL);
+		else if (strcmp(arg, "-r") == 0)
+			resume = output = value;
+		else if (strcmp(arg, "-j") == 0)
+			json = value;
+		else
+		{
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (config.chunk == 0)
+	{
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	//One bit per chunk, with a spare word so an empty run has a bitmap
+	struct Stats *total = malloc(sizeof(struct Stats));
+	uint64_t *done = NULL;
+	size_t words = (config.games / config.chunk + 1 + 63) / 64;
+	if (total == NULL)
+	{
+		fprintf(stderr, "The statistics couldn't be allocated.\n");
+		return EXIT_FAILURE;
+	}
+	clear_stats(total);
+	if (resume)
+	{
+		if (!load_checkpoint(resume, &config, &done, &words, total))
+		{
+			fprintf(stderr, "The checkpoint %s couldn't be read or is corrupt.\n", resume);
+			return EXIT_FAILURE;
+		}
+		printf("Resuming after %llu of %llu games\n", (unsigned long long)total->games,
+			   (unsigned long long)config.games);
+	}
+	else
+	{
+		done = calloc(words, sizeof(uint64_t));
+		if (done == NULL)
+		{
+			fprintf(stderr, "The bitmap couldn't be allocated.\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	ThreadPool *pool = threadpool_create(threads);
+	unsigned int workers = pool ? threadpool_size(pool) : 0;
+	struct Round round = {&config, NULL, 0, 0, NULL, NULL, NULL};
+	uint64_t chunks = (config.games + config.chunk - 1) / config.chunk;
+	size_t per_round = (size_t)workers * SIM_CHUNKS_PER_WORKER;
+	uint64_t *list = malloc(per_round * sizeof(uint64_t));
+	round.chunks = list;
+	round.stats = aligned_alloc(_Alignof(struct WorkerStats), workers * sizeof(struct WorkerStats));
+	round.ais = calloc(workers, sizeof(AI *));
+	if (pool == NULL || list == NULL || round.stats == NULL || round.ais == NULL)
+	{
+		fprintf(stderr, "The workers couldn't be created.\n");
+		return EXIT_FAILURE;
+	}
+	NTuple *net = NULL;
+	if (config.policy == POLICY_NETWORK)
+	{
+		net = ntuple_load(config.network);
+		if (net == NULL || !ntuple_verify(net))
+		{
+			fprintf(stderr, "The network %s couldn't be read or is corrupt.\n", config.network);
+			return EXIT_FAILURE;
+		}
+		round.net = net;
+	}
+	for (unsigned int i = 0; config.policy == POLICY_EXPECTIMAX && i < workers; i++)
+	{
+		AIConfig ai_config;
+		ai_default_config(&ai_config);
+		ai_config.depth = config.depth;
+		round.ais[i] = ai_create(&ai_config);
+		if (round.ais[i] == NULL)
+		{
+			fprintf(stderr, "The solver couldn't be created.\n");
+			return EXIT_FAILURE;
+		}
+	}
+	bitboard_init();
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	printf("Playing %llu games on %u threads\n", (unsigned long long)config.games, workers);
+	fflush(stdout);
+
+	double start = now_seconds(), last_save = start;
+	uint64_t start_games = total->games, next_chunk = 0;
+	bool saved = true;
+	while (!g_stop)
+	{
+		//The next chunks that are not done yet
+		round.count = 0;
+		for (; next_chunk < chunks && round.count < per_round; next_chunk++)
+			if (!(done[next_chunk / 64] >> (next_chunk % 64) & 1))
+				list[round.count++] = next_chunk;
+		if (round.count == 0)
+			break;
+
+		atomic_store_explicit(&round.next, 0, memory_order_relaxed);
+		for (unsigned int i = 0; i < workers; i++)
+			clear_stats(&round.stats[i].stats);
+		for (unsigned int i = 0; i < workers; i++)
+			if (!threadpool_submit(pool, run_round, &round))
+				break;
+		threadpool_wait(pool);
+		//Play the chunks that could not be handed to the pool here
+		run_round(&round, 0);
+
+		for (unsigned int i = 0; i < workers; i++)
+			merge_stats(total, &round.stats[i].stats);
+		for (size_t i = 0; i < round.count; i++)
+			done[list[i] / 64] |= (uint64_t)1 << (list[i] % 64);
+		saved = false;
+
+		double now = now_seconds();
+		if (now - last_save >= interval)
+		{
+			printf("%llu of %llu games, %.0f games/sec\n", (unsigned long long)total->games,
+				   (unsigned long long)config.games, (total->games - start_games) / (now - start));
+			fflush(stdout);
+			if (output && !save_checkpoint(output, &config, done, words, total))
+				fprintf(stderr, "The checkpoint %s couldn't be written.\n", output);
+			last_save = now;
+			saved = true;
+		}
+	}
+	if (output && !saved && !save_checkpoint(output, &config, done, words, total))
+		fprintf(stderr, "The checkpoint %s couldn't be written.\n", output);
+	double seconds = now_seconds() - start;
+
+	if (g_stop)
+		printf("Stopped after %llu of %llu games%s\n", (unsigned long long)total->games,
+			   (unsigned long long)config.games, output ? ", resume with -r" : "");
+	print_stats(total);
+	if (seconds > 0)
+		printf("%.3f s, %.0f games/sec\n", seconds, (total->games - start_games) / seconds);
+	if (json != NULL)
+	{
+		FILE *stream = strcmp(json, "-") == 0 ? stdout : fopen(json, "w");
+		if (stream == NULL)
+			fprintf(stderr, "The file %s couldn't be opened.\n", json);
+		else
+		{
+			write_json(stream, &config, total);
+			if (stream != stdout)
+				fclose(stream);
+		}
+	}
+
+	threadpool_destroy(pool);
+	for (unsigned int i = 0; i < workers; i++)
+		ai_destroy(round.ais[i]);
+	ntuple_destroy(net);
+	free(round.ais);
+	free(round.stats);
+	free(list);
+	free(done);
+	free(total);
+	return g_stop ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,232 @@
+/**
+ * @file sized.c
+ * @author Gnik Droy
+ * @brief File containing implementation of the kernels for every board size.
+ *
+ * Every kernel is written once as an always inlined body taking the size
+ * as a parameter. SIZED_KERNELS() instantiates the bodies with a constant
+ * size, the generic kernels pass the size through.
+ */
+#include <string.h>
+#include "sized.h"
+#include "bits.h"
+
+/** Inlines a kernel body into the kernel, so the size is a constant there */
+#define BODY static inline __attribute__((always_inline))
+
+/**
+ * Slides and merges one line of n cells, step apart, towards its first
+ * cell. Every tile merges at most once, the same as merge_x().
+ */
+BODY bool slide_line(unsigned int n, unsigned char *line, int step, Score *score)
+{
+	unsigned char out[SIZED_MAX];
+	unsigned int count = 0;
+	unsigned char last = 0;
+	for (unsigned int k = 0; k < n; k++)
+	{
+		unsigned char tile = line[(int)k * step];
+		if (tile == 0)
+			continue;
+		if (tile == last)
+		{
+			out[count - 1] = tile + 1;
+			score_add_merges(score, pow_int(BASE, tile + 1), tile + 1);
+			last = 0;
+		}
+		else
+		{
+			out[count++] = tile;
+			last = tile;
+		}
+	}
+	bool moved = false;
+	for (unsigned int k = 0; k < n; k++)
+	{
+		unsigned char tile = k < count ? out[k] : 0;
+		moved |= line[(int)k * step] != tile;
+		line[(int)k * step] = tile;
+	}
+	return moved;
+}
+
+BODY bool move_body(unsigned int n, unsigned char *cells, Direction dir, Score *score)
+{
+	//The first cell of the first line, the step within a line and between lines
+	int first, step, next;
+	switch (dir)
+	{
+	case DIRECTION_UP:
+		first = 0, step = (int)n, next = 1;
+		break;
+	case DIRECTION_DOWN:
+		first = (int)((n - 1) * n), step = -(int)n, next = 1;
+		break;
+	case DIRECTION_LEFT:
+		first = 0, step = 1, next = (int)n;
+		break;
+	default:
+		first = (int)n - 1, step = -1, next = (int)n;
+		break;
+	}
+	bool moved = false;
+	for (unsigned int i = 0; i < n; i++)
+		moved |= slide_line(n, cells + first + (int)i * next, step, score);
+	return moved;
+}
+
+BODY unsigned int add_random_body(unsigned int n, unsigned char *cells, Rng *rng)
+{
+	if (n <= SIZED_UNROLLED)
+	{
+		uint64_t mask = 0;
+		for (unsigned int i = 0; i < n * n; i++)
+			mask |= (uint64_t)(cells[i] == 0) << i;
+		if (mask == 0)
+			return n * n;
+		unsigned int cell = bits_select(mask, rng_bounded(rng, bits_popcount(mask)));
+		cells[cell] = 1;
+		return cell;
+	}
+	//Too many cells for a mask, count them and walk to the picked one
+	unsigned int empty = 0;
+	for (unsigned int i = 0; i < n * n; i++)
+		empty += cells[i] == 0;
+	if (empty == 0)
+		return n * n;
+	unsigned int pick = rng_bounded(rng, empty);
+	for (unsigned int i = 0;; i++)
+	{
+		if (cells[i] == 0 && pick-- == 0)
+		{
+			cells[i] = 1;
+			return i;
+		}
+	}
+}
+
+BODY bool is_game_over_body(unsigned int n, const unsigned char *cells)
+{
+	for (unsigned int x = 0; x < n; x++)
+	{
+		for (unsigned int y = 0; y < n; y++)
+		{
+			unsigned char tile = cells[x * n + y];
+			if (tile == 0 ||
+				(y + 1 < n && tile == cells[x * n + y + 1]) ||
+				(x + 1 < n && tile == cells[(x + 1) * n + y]))
+				return false;
+		}
+	}
+	return true;
+}
+
+/** Instantiates the kernels of a size and their entry of the table */
+#define SIZED_KERNELS(N)                                                                    \
+	static bool move_##N(unsigned int size, unsigned char *cells, Direction dir, Score *score) \
+	{                                                                                       \
+		(void)size;                                                                         \
+		return move_body(N, cells, dir, score);                                             \
+	}                                                                                       \
+	static unsigned int add_random_##N(unsigned int size, unsigned char *cells, Rng *rng)   \
+	{                                                                                       \
+		(void)size;                                                                         \
+		return add_random_body(N, cells, rng);                                              \
+	}                                                                                       \
+	static bool is_game_over_##N(unsigned int size, const unsigned char *cells)             \
+	{                                                                                       \
+		(void)size;                                                                         \
+		return is_game_over_body(N, cells);                                                 \
+	}
+
+SIZED_KERNELS(3)
+SIZED_KERNELS(4)
+SIZED_KERNELS(5)
+SIZED_KERNELS(6)
+SIZED_KERNELS(7)
+SIZED_KERNELS(8)
+
+static bool move_generic(unsigned int size, unsigned char *cells, Direction dir, Score *score)
+{
+	return move_body(size, cells, dir, score);
+}
+
+static unsigned int add_random_generic(unsigned int size, unsigned char *cells, Rng *rng)
+{
+	return add_random_body(size, cells, rng);
+}
+
+static bool is_game_over_generic(unsigned int size, const unsigned char *cells)
+{
+	return is_game_over_body(size, cells);
+}
+
+#define UNROLLED(N) {N, "unrolled", move_##N, add_random_##N, is_game_over_##N}
+#define GENERIC(N) {N, "generic", move_generic, add_random_generic, is_game_over_generic}
+
+/** The kernels of every size, from SIZED_MIN on */
+static const SizedOps g_ops[] = {
+	UNROLLED(3), UNROLLED(4), UNROLLED(5), UNROLLED(6), UNROLLED(7), UNROLLED(8),
+	GENERIC(9), GENERIC(10), GENERIC(11), GENERIC(12), GENERIC(13), GENERIC(14),
+	GENERIC(15), GENERIC(16)};
+
+_Static_assert(sizeof(g_ops) / sizeof(g_ops[0]) == SIZED_MAX - SIZED_MIN + 1,
+			   "Every size needs an entry");
+
+const SizedOps *sized_ops(unsigned int size)
+{
+	if (size < SIZED_MIN || size > SIZED_MAX)
+		return NULL;
+	return &g_ops[size - SIZED_MIN];
+}
+
+int sized_move_with_spawn(const SizedOps *ops, unsigned char *cells, Direction dir, Rng *rng, Score *score)
+{
+	if (!sized_move(ops, cells, dir, score))
+		return -1;
+	unsigned int cell = sized_add_random(ops, cells, rng);
+	if (score != NULL && cell < ops->size * ops->size)
+	{
+		score->sum += BASE;
+		if (score->max_tile < 1)
+			score->max_tile = 1;
+	}
+	return (int)cell;
+}
+
+void sized_clear(const SizedOps *ops, unsigned char *cells)
+{
+	memset(cells, 0, ops->size * ops->size);
+}
+
+void sized_score_reset(const SizedOps *ops, const unsigned char *cells, Score *score)
+{
+	score->sum = 0;
+	score->merged = 0;
+	score->max_tile = 0;
+	for (unsigned int i = 0; i < ops->size * ops->size; i++)
+	{
+		if (cells[i] == 0)
+			continue;
+		score->sum += pow_int(BASE, cells[i]);
+		if (cells[i] > score->max_tile)
+			score->max_tile = cells[i];
+	}
+}
+
+void sized_print(const SizedOps *ops, const unsigned char *cells, FILE *stream)
+{
+	for (unsigned int x = 0; x < ops->size; x++)
+	{
+		for (unsigned int y = 0; y < ops->size; y++)
+		{
+			unsigned char tile = cells[x * ops->size + y];
+			if (tile)
+				fprintf(stream, "%d,", tile);
+			else
+				fprintf(stream, "-,");
+		}
+		fprintf(stream, "\n");
+	}
+	fprintf(stream, "\n");
+}
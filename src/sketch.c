@@ -0,0 +1,60 @@
+/**
+ * @file sketch.c
+ * @author Gnik Droy
+ * @brief File containing implementation of the mergeable quantile sketch.
+ *
+ */
+#include <math.h>
+#include <string.h>
+#include "sketch.h"
+
+/** The base of the buckets, see sketch.h */
+#define GAMMA ((1 + SKETCH_ACCURACY) / (1 - SKETCH_ACCURACY))
+
+void sketch_clear(Sketch *sketch)
+{
+	memset(sketch, 0, sizeof(Sketch));
+}
+
+void sketch_add(Sketch *sketch, double value)
+{
+	if (sketch->count == 0 || value < sketch->min)
+		sketch->min = value;
+	if (sketch->count == 0 || value > sketch->max)
+		sketch->max = value;
+	sketch->count++;
+	double index = value > 1 ? ceil(log(value) / log(GAMMA)) : 0;
+	sketch->buckets[index < SKETCH_BUCKETS - 1 ? (unsigned int)index : SKETCH_BUCKETS - 1]++;
+}
+
+void sketch_merge(Sketch *sketch, const Sketch *other)
+{
+	if (other->count == 0)
+		return;
+	if (sketch->count == 0 || other->min < sketch->min)
+		sketch->min = other->min;
+	if (sketch->count == 0 || other->max > sketch->max)
+		sketch->max = other->max;
+	sketch->count += other->count;
+	for (unsigned int i = 0; i < SKETCH_BUCKETS; i++)
+		sketch->buckets[i] += other->buckets[i];
+}
+
+double sketch_quantile(const Sketch *sketch, double q)
+{
+	if (sketch->count == 0)
+		return 0;
+	//The rank of the quantile, counted from 0
+	uint64_t rank = (uint64_t)(q * (sketch->count - 1)), seen = 0;
+	for (unsigned int i = 0; i < SKETCH_BUCKETS; i++)
+	{
+		seen += sketch->buckets[i];
+		if (seen > rank)
+		{
+			//The value of a bucket that is closest to all of its values
+			double value = i == 0 ? 1 : 2 * pow(GAMMA, i) / (GAMMA + 1);
+			return value < sketch->min ? sketch->min : value > sketch->max ? sketch->max : value;
+		}
+	}
+	return sketch->max;
+}
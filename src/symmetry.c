@@ -0,0 +1,77 @@
+/**
+ * @file symmetry.c
+ * @author Gnik Droy
+ * @brief File containing implementation of the board symmetries.
+ *
+ */
+#include "symmetry.h"
+
+BitBoard bitboard_mirror_rows(BitBoard x)
+{
+	//Swap the nibbles of every byte, then the bytes of every row
+	x = ((x & 0x0F0F0F0F0F0F0F0FULL) << 4) | ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL);
+	return ((x & 0x00FF00FF00FF00FFULL) << 8) | ((x >> 8) & 0x00FF00FF00FF00FFULL);
+}
+
+BitBoard bitboard_flip_rows(BitBoard x)
+{
+	//Swap the rows of every half, then the halves
+	x = ((x & 0x0000FFFF0000FFFFULL) << 16) | ((x >> 16) & 0x0000FFFF0000FFFFULL);
+	return (x << 32) | (x >> 32);
+}
+
+BitBoard bitboard_symmetry(BitBoard bitboard, unsigned int symmetry)
+{
+	if (symmetry & 1)
+		bitboard = bitboard_mirror_rows(bitboard);
+	if (symmetry & 2)
+		bitboard = bitboard_flip_rows(bitboard);
+	if (symmetry & 4)
+		bitboard = bitboard_transpose(bitboard);
+	return bitboard;
+}
+
+unsigned int symmetry_inverse(unsigned int symmetry)
+{
+	//The mirrors and the transpose are their own inverses. Undoing a
+	//transpose first turns mirroring rows into flipping them.
+	if (symmetry & 4)
+		return 4 | (symmetry & 1) << 1 | (symmetry & 2) >> 1;
+	return symmetry;
+}
+
+Direction symmetry_direction(unsigned int symmetry, Direction dir)
+{
+	unsigned int d = dir;
+	if ((symmetry & 1) && (d == DIRECTION_LEFT || d == DIRECTION_RIGHT))
+		d ^= 1;
+	if ((symmetry & 2) && (d == DIRECTION_UP || d == DIRECTION_DOWN))
+		d ^= 1;
+	//Transposing swaps up with left and down with right
+	if (symmetry & 4)
+		d ^= 2;
+	return (Direction)d;
+}
+
+BitBoard bitboard_canonical(BitBoard bitboard, unsigned int *symmetry)
+{
+	BitBoard boards[SYMMETRY_COUNT];
+	boards[0] = bitboard;
+	boards[1] = bitboard_mirror_rows(bitboard);
+	boards[2] = bitboard_flip_rows(bitboard);
+	boards[3] = bitboard_flip_rows(boards[1]);
+	for (unsigned int i = 0; i < 4; i++)
+		boards[4 + i] = bitboard_transpose(boards[i]);
+
+	BitBoard best = boards[0];
+	unsigned int best_symmetry = 0;
+	for (unsigned int i = 1; i < SYMMETRY_COUNT; i++)
+	{
+		bool smaller = boards[i] < best;
+		best = smaller ? boards[i] : best;
+		best_symmetry = smaller ? i : best_symmetry;
+	}
+	if (symmetry)
+		*symmetry = best_symmetry;
+	return best;
+}
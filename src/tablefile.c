@@ -0,0 +1,288 @@
+/**
+ * @file tablefile.c
+ * @author Gnik Droy
+ * @brief File containing implementation of the memory mapped table files.
+ *
+ */
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tablefile.h"
+
+/** The magic bytes at the start of a table file */
+#define TABLEFILE_MAGIC "2048TBLS"
+
+/** The size of the file header */
+#define HEADER_SIZE 64
+
+/** The size of a section entry */
+#define ENTRY_SIZE 40
+
+/** Written in the byte order of the writer to detect a different one */
+#define BYTE_ORDER_MARK 0x01020304u
+
+/** @struct TableFile
+ *  @brief The mapping, the section entries and the checksum thread.
+ *
+ *  @var TableFile::data
+ *  The mapped file
+ *  @var TableFile::size
+ *  The size of the file
+ *  @var TableFile::count
+ *  The number of sections
+ *  @var TableFile::verifier
+ *  The thread checking the checksums
+ *  @var TableFile::verifying
+ *  If the thread was started and not joined yet
+ *  @var TableFile::checked
+ *  If the check was started, on the thread or by the caller
+ *  @var TableFile::status
+ *  The result of the check, a TableFileStatus
+ */
+struct TableFile
+{
+	uint8_t *data;
+	size_t size;
+	unsigned int count;
+	pthread_t verifier;
+	bool verifying;
+	bool checked;
+	atomic_int status;
+};
+
+static void put_le(uint8_t *out, uint64_t value, unsigned int bytes)
+{
+	for (unsigned int i = 0; i < bytes; i++)
+		out[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint64_t get_le(const uint8_t *in, unsigned int bytes)
+{
+	uint64_t value = 0;
+	for (unsigned int i = 0; i < bytes; i++)
+		value |= (uint64_t)in[i] << (8 * i);
+	return value;
+}
+
+static inline uint64_t rotate(uint64_t x, unsigned int bits)
+{
+	return (x << bits) | (x >> (64 - bits));
+}
+
+/**
+ * Hashes the data eight bytes at a time in four independent lanes, so
+ * it runs at memory speed rather than at the latency of a multiply.
+ */
+static uint64_t checksum(const uint8_t *data, size_t size)
+{
+	const uint64_t prime1 = 0x9E3779B185EBCA87ULL, prime2 = 0xC2B2AE3D27D4EB4FULL;
+	uint64_t lanes[4] = {prime1, prime2, 0, (uint64_t)0 - prime1};
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32)
+	{
+		for (unsigned int lane = 0; lane < 4; lane++)
+		{
+			uint64_t word;
+			memcpy(&word, data + i + 8 * lane, sizeof(word));
+			lanes[lane] = rotate(lanes[lane] + word * prime2, 31) * prime1;
+		}
+	}
+	uint64_t hash = size;
+	for (unsigned int lane = 0; lane < 4; lane++)
+		hash = rotate(hash ^ lanes[lane], 27) * prime1 + prime2;
+	for (; i < size; i++)
+		hash = rotate(hash ^ data[i] * prime1, 11) * prime2;
+	hash ^= hash >> 33;
+	hash *= prime2;
+	return hash ^ (hash >> 29);
+}
+
+/** Returns the alignment of a section of the given size. */
+static size_t section_align(size_t size)
+{
+	return size >= TABLEFILE_HUGE_ALIGN ? TABLEFILE_HUGE_ALIGN : TABLEFILE_ALIGN;
+}
+
+bool tablefile_write(const char *path, const TableSection *sections, unsigned int count)
+{
+	size_t header_size = HEADER_SIZE + (size_t)count * ENTRY_SIZE;
+	uint8_t *header = calloc(1, header_size);
+	size_t length = strlen(path);
+	char *temporary = malloc(length + 5);
+	if (header == NULL || temporary == NULL)
+	{
+		free(header);
+		free(temporary);
+		return false;
+	}
+	memcpy(temporary, path, length);
+	memcpy(temporary + length, ".tmp", 5);
+
+	size_t offset = header_size;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		size_t align = section_align(sections[i].size);
+		offset = (offset + align - 1) / align * align;
+		uint8_t *entry = header + HEADER_SIZE + (size_t)i * ENTRY_SIZE;
+		memcpy(entry, sections[i].tag, TABLEFILE_TAG_SIZE);
+		put_le(entry + 8, offset, 8);
+		put_le(entry + 16, sections[i].size, 8);
+		put_le(entry + 24, checksum(sections[i].data, sections[i].size), 8);
+		offset += sections[i].size;
+	}
+	memcpy(header, TABLEFILE_MAGIC, 8);
+	put_le(header + 8, TABLEFILE_VERSION, 4);
+	put_le(header + 12, count, 4);
+	put_le(header + 16, offset, 8);
+	uint32_t mark = BYTE_ORDER_MARK;
+	memcpy(header + 24, &mark, sizeof(mark));
+
+	FILE *file = fopen(temporary, "wb");
+	bool ok = file != NULL && fwrite(header, 1, header_size, file) == header_size;
+	for (unsigned int i = 0; ok && i < count; i++)
+	{
+		//Seeking over the padding leaves holes that take no space
+		const uint8_t *entry = header + HEADER_SIZE + (size_t)i * ENTRY_SIZE;
+		ok = fseek(file, (long)get_le(entry + 8, 8), SEEK_SET) == 0 &&
+			 fwrite(sections[i].data, 1, sections[i].size, file) == sections[i].size;
+	}
+	if (file != NULL)
+		ok = fclose(file) == 0 && ok;
+	ok = ok && rename(temporary, path) == 0;
+	if (!ok)
+		remove(temporary);
+	free(header);
+	free(temporary);
+	return ok;
+}
+
+static void *verify(void *arg)
+{
+	TableFile *file = arg;
+	TableFileStatus status = TABLEFILE_VALID;
+	for (unsigned int i = 0; i < file->count && status == TABLEFILE_VALID; i++)
+	{
+		const uint8_t *entry = file->data + HEADER_SIZE + (size_t)i * ENTRY_SIZE;
+		if (checksum(file->data + get_le(entry + 8, 8), get_le(entry + 16, 8)) != get_le(entry + 24, 8))
+			status = TABLEFILE_CORRUPT;
+	}
+	atomic_store_explicit(&file->status, status, memory_order_release);
+	return NULL;
+}
+
+/** Checks that the header is complete and every section lies in the file. */
+static bool check_header(const uint8_t *data, size_t size)
+{
+	if (size < HEADER_SIZE || memcmp(data, TABLEFILE_MAGIC, 8) != 0)
+		return false;
+	uint32_t mark;
+	memcpy(&mark, data + 24, sizeof(mark));
+	uint64_t count = get_le(data + 12, 4);
+	if (get_le(data + 8, 4) > TABLEFILE_VERSION || mark != BYTE_ORDER_MARK ||
+		get_le(data + 16, 8) != size || count > (size - HEADER_SIZE) / ENTRY_SIZE)
+		return false;
+	for (uint64_t i = 0; i < count; i++)
+	{
+		const uint8_t *entry = data + HEADER_SIZE + i * ENTRY_SIZE;
+		uint64_t offset = get_le(entry + 8, 8), length = get_le(entry + 16, 8);
+		if (offset % TABLEFILE_ALIGN != 0 || offset > size || length > size - offset)
+			return false;
+	}
+	return true;
+}
+
+TableFile *tablefile_open(const char *path, bool huge_pages)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < HEADER_SIZE)
+	{
+		close(fd);
+		return NULL;
+	}
+	//Private and writable, so the sections can be changed in memory
+	void *data = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+	TableFile *file = calloc(1, sizeof(TableFile));
+	if (file == NULL || !check_header(data, (size_t)st.st_size))
+	{
+		munmap(data, (size_t)st.st_size);
+		free(file);
+		return NULL;
+	}
+	file->data = data;
+	file->size = (size_t)st.st_size;
+	file->count = (unsigned int)get_le(file->data + 12, 4);
+#ifdef MADV_HUGEPAGE
+	if (huge_pages)
+	{
+		for (unsigned int i = 0; i < file->count; i++)
+		{
+			const uint8_t *entry = file->data + HEADER_SIZE + (size_t)i * ENTRY_SIZE;
+			size_t length = get_le(entry + 16, 8);
+			if (length >= TABLEFILE_HUGE_ALIGN)
+				madvise(file->data + get_le(entry + 8, 8), length, MADV_HUGEPAGE);
+		}
+	}
+#else
+	(void)huge_pages;
+#endif
+
+	//The check starts with the first tablefile_status() call
+	atomic_init(&file->status, TABLEFILE_PENDING);
+	return file;
+}
+
+void tablefile_close(TableFile *file)
+{
+	if (file == NULL)
+		return;
+	if (file->verifying)
+		pthread_join(file->verifier, NULL);
+	munmap(file->data, file->size);
+	free(file);
+}
+
+void *tablefile_section(TableFile *file, const char *tag, size_t *size)
+{
+	char name[TABLEFILE_TAG_SIZE] = {0};
+	memcpy(name, tag, strnlen(tag, TABLEFILE_TAG_SIZE));
+	for (unsigned int i = 0; i < file->count; i++)
+	{
+		uint8_t *entry = file->data + HEADER_SIZE + (size_t)i * ENTRY_SIZE;
+		if (memcmp(entry, name, TABLEFILE_TAG_SIZE) != 0)
+			continue;
+		if (size)
+			*size = get_le(entry + 16, 8);
+		return file->data + get_le(entry + 8, 8);
+	}
+	return NULL;
+}
+
+TableFileStatus tablefile_status(TableFile *file, bool wait)
+{
+	if (!file->checked)
+	{
+		file->checked = true;
+		//A waiting caller has nothing else to do, so it checks the file itself
+		file->verifying = !wait && pthread_create(&file->verifier, NULL, verify, file) == 0;
+		if (!file->verifying)
+			verify(file);
+	}
+	if (wait && file->verifying)
+	{
+		pthread_join(file->verifier, NULL);
+		file->verifying = false;
+	}
+	return (TableFileStatus)atomic_load_explicit(&file->status, memory_order_acquire);
+}
@@ -0,0 +1,307 @@
+/**
+ * @file threadpool.c
+ * @author Gnik Droy
+ * @brief File containing implementation of the work-stealing thread pool.
+ *
+ */
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "threadpool.h"
+#include "rng.h"
+
+/** The initial capacity of a deque */
+#define DEQUE_CAPACITY 64
+
+/** @struct Job
+ *  @brief A queued task and its argument.
+ */
+struct Job
+{
+	Task task;
+	void *arg;
+};
+
+/** @struct Deque
+ *  @brief The tasks of one worker, as a growable ring buffer.
+ *
+ *  @var Deque::lock
+ *  Taken by the owner and by thieves. It is only held for a push or a pop.
+ *  @var Deque::jobs
+ *  The ring buffer
+ *  @var Deque::capacity
+ *  The size of the ring buffer, a power of two
+ *  @var Deque::top
+ *  The oldest job, stolen by other workers
+ *  @var Deque::bottom
+ *  One past the newest job, run by the owner
+ */
+struct Deque
+{
+	pthread_mutex_t lock;
+	struct Job *jobs;
+	size_t capacity;
+	size_t top;
+	size_t bottom;
+};
+
+/** @struct Worker
+ *  @brief A worker thread and its deque.
+ *
+ *  Aligned to a cache line so workers do not share lines.
+ */
+struct Worker
+{
+	_Alignas(64) struct Deque deque;
+	ThreadPool *pool;
+	pthread_t thread;
+	unsigned int index;
+	Rng rng;
+};
+
+/** @struct ThreadPool
+ *  @brief The workers and the bookkeeping of queued tasks.
+ *
+ *  @var ThreadPool::size
+ *  The number of workers
+ *  @var ThreadPool::started
+ *  The number of worker threads that were started
+ *  @var ThreadPool::lock
+ *  Protects the counters below and is used with the condition variables
+ *  @var ThreadPool::work
+ *  Signalled when a task is queued or the pool stops
+ *  @var ThreadPool::done
+ *  Signalled when the last unfinished task finishes
+ *  @var ThreadPool::queued
+ *  The number of tasks in the deques
+ *  @var ThreadPool::unfinished
+ *  The number of tasks queued or running
+ *  @var ThreadPool::next
+ *  The worker the next task from outside the pool goes to
+ */
+struct ThreadPool
+{
+	struct Worker *workers;
+	unsigned int size;
+	unsigned int started;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	size_t queued;
+	size_t unfinished;
+	unsigned int next;
+	bool stop;
+};
+
+/** The worker running on the current thread, or NULL outside of a pool */
+static _Thread_local struct Worker *t_worker;
+
+static bool deque_push(struct Deque *deque, struct Job job)
+{
+	pthread_mutex_lock(&deque->lock);
+	if (deque->bottom - deque->top == deque->capacity)
+	{
+		size_t capacity = deque->capacity * 2;
+		struct Job *jobs = malloc(capacity * sizeof(struct Job));
+		if (jobs == NULL)
+		{
+			pthread_mutex_unlock(&deque->lock);
+			return false;
+		}
+		for (size_t i = deque->top; i != deque->bottom; i++)
+			jobs[i & (capacity - 1)] = deque->jobs[i & (deque->capacity - 1)];
+		free(deque->jobs);
+		deque->jobs = jobs;
+		deque->capacity = capacity;
+	}
+	deque->jobs[deque->bottom++ & (deque->capacity - 1)] = job;
+	pthread_mutex_unlock(&deque->lock);
+	return true;
+}
+
+/** Takes the newest job, used by the owner of the deque. */
+static bool deque_pop(struct Deque *deque, struct Job *job)
+{
+	pthread_mutex_lock(&deque->lock);
+	bool found = deque->bottom != deque->top;
+	if (found)
+		*job = deque->jobs[--deque->bottom & (deque->capacity - 1)];
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+
+/** Takes the oldest job, used by the other workers. */
+static bool deque_steal(struct Deque *deque, struct Job *job)
+{
+	pthread_mutex_lock(&deque->lock);
+	bool found = deque->bottom != deque->top;
+	if (found)
+		*job = deque->jobs[deque->top++ & (deque->capacity - 1)];
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+
+/** Finds a job for the worker, its own first. */
+static bool find_job(struct Worker *worker, struct Job *job)
+{
+	if (deque_pop(&worker->deque, job))
+		return true;
+	ThreadPool *pool = worker->pool;
+	//Start at a random victim so thieves spread out
+	unsigned int start = rng_bounded(&worker->rng, pool->size);
+	for (unsigned int i = 0; i < pool->size; i++)
+	{
+		unsigned int victim = (start + i) % pool->size;
+		if (victim != worker->index && deque_steal(&pool->workers[victim].deque, job))
+			return true;
+	}
+	return false;
+}
+
+static void *worker_main(void *data)
+{
+	struct Worker *worker = data;
+	ThreadPool *pool = worker->pool;
+	t_worker = worker;
+	for (;;)
+	{
+		struct Job job;
+		if (find_job(worker, &job))
+		{
+			pthread_mutex_lock(&pool->lock);
+			pool->queued--;
+			pthread_mutex_unlock(&pool->lock);
+
+			job.task(job.arg, worker->index);
+
+			pthread_mutex_lock(&pool->lock);
+			if (--pool->unfinished == 0)
+				pthread_cond_broadcast(&pool->done);
+			pthread_mutex_unlock(&pool->lock);
+			continue;
+		}
+		pthread_mutex_lock(&pool->lock);
+		//A job counted as queued may still be on its way into a deque
+		while (pool->queued == 0 && !pool->stop)
+			pthread_cond_wait(&pool->work, &pool->lock);
+		bool stop = pool->stop && pool->queued == 0;
+		pthread_mutex_unlock(&pool->lock);
+		if (stop)
+			break;
+	}
+	return NULL;
+}
+
+ThreadPool *threadpool_create(unsigned int workers)
+{
+	if (workers == 0)
+	{
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		workers = cores > 0 ? (unsigned int)cores : 1;
+	}
+	ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+	if (pool == NULL)
+		return NULL;
+	pool->workers = aligned_alloc(_Alignof(struct Worker), workers * sizeof(struct Worker));
+	if (pool->workers == NULL)
+	{
+		free(pool);
+		return NULL;
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	for (unsigned int i = 0; i < workers; i++)
+	{
+		struct Worker *worker = &pool->workers[i];
+		worker->deque.jobs = malloc(DEQUE_CAPACITY * sizeof(struct Job));
+		if (worker->deque.jobs == NULL)
+		{
+			pool->size = i;
+			threadpool_destroy(pool);
+			return NULL;
+		}
+		pthread_mutex_init(&worker->deque.lock, NULL);
+		worker->deque.capacity = DEQUE_CAPACITY;
+		worker->deque.top = worker->deque.bottom = 0;
+		worker->pool = pool;
+		worker->index = i;
+		rng_seed(&worker->rng, i);
+	}
+	//Every deque exists before the first worker looks for a victim
+	pool->size = workers;
+	for (; pool->started < workers; pool->started++)
+	{
+		struct Worker *worker = &pool->workers[pool->started];
+		if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0)
+		{
+			threadpool_destroy(pool);
+			return NULL;
+		}
+	}
+	return pool;
+}
+
+void threadpool_destroy(ThreadPool *pool)
+{
+	if (pool == NULL)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+	for (unsigned int i = 0; i < pool->started; i++)
+		pthread_join(pool->workers[i].thread, NULL);
+	for (unsigned int i = 0; i < pool->size; i++)
+	{
+		free(pool->workers[i].deque.jobs);
+		pthread_mutex_destroy(&pool->workers[i].deque.lock);
+	}
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->workers);
+	free(pool);
+}
+
+unsigned int threadpool_size(const ThreadPool *pool)
+{
+	return pool->size;
+}
+
+bool threadpool_submit(ThreadPool *pool, Task task, void *arg)
+{
+	struct Job job = {task, arg};
+	struct Worker *worker = t_worker;
+	if (worker == NULL || worker->pool != pool)
+	{
+		pthread_mutex_lock(&pool->lock);
+		worker = &pool->workers[pool->next];
+		pool->next = (pool->next + 1) % pool->size;
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	//Count the job first, so neither threadpool_wait() nor the workers miss it
+	pthread_mutex_lock(&pool->lock);
+	pool->unfinished++;
+	pool->queued++;
+	pthread_cond_signal(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+	if (deque_push(&worker->deque, job))
+		return true;
+	pthread_mutex_lock(&pool->lock);
+	pool->queued--;
+	if (--pool->unfinished == 0)
+		pthread_cond_broadcast(&pool->done);
+	pthread_mutex_unlock(&pool->lock);
+	return false;
+}
+
+void threadpool_wait(ThreadPool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	while (pool->unfinished != 0)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,145 @@
+/**
+ * @file train.c
+ * @author Gnik Droy
+ * @brief File containing the n-tuple network trainer.
+ *
+ * Trains a network with temporal difference learning on games of self
+ * play, in rounds. After every round the statistics of its games are
+ * printed and the weights are written to the checkpoint file, along with
+ * the seed and the number of games done. An interrupted run resumed from
+ * it goes on with the next game, as if it had never stopped.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ntuple.h"
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+			"Usage: %s [-k cells] [-n games] [-c games] [-a alpha] [-t threads] [-s seed] [-r file] [-o file]\n"
+			"  -k cells    Cells per tuple, 4 or 6 (default 6)\n"
+			"  -n games    Number of games to train on in total, with the resumed ones (default 100000)\n"
+			"  -c games    Games per round, a checkpoint is written after every round (default 10000)\n"
+			"  -a alpha    Learning rate (default 0.1)\n"
+			"  -t threads  Number of worker threads (default one per core)\n"
+			"  -s seed     Seed of the first game (default 2048), a resumed run keeps its own\n"
+			"  -r file     Resume from a checkpoint instead of starting with all weights 0\n"
+			"  -o file     The checkpoint file (default ntuple.bin)\n",
+			name);
+}
+
+static double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief The standard main function
+ *
+ * Trains the network round by round and writes the checkpoints.
+ *
+ * @param argc Number of arguments
+ * @param argv Arguments
+ */
+int main(int argc, char **argv)
+{
+	unsigned int cells = 6, threads = 0;
+	unsigned long games = 100000, round = 10000;
+	float alpha = 0.1f;
+	uint64_t seed = 2048;
+	const char *resume = NULL, *output = "ntuple.bin";
+	for (int i = 1; i < argc; i++)
+	{
+		if (i + 1 >= argc)
+		{
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		const char *arg = argv[i], *value = argv[++i];
+		if (strcmp(arg, "-k") == 0)
+			cells = (unsigned int)strtoul(value, NULL, 10);
+		else if (strcmp(arg, "-n") == 0)
+			games = strtoul(value, NULL, 10);
+		else if (strcmp(arg, "-c") == 0)
+			round = strtoul(value, NULL, 10);
+		else if (strcmp(arg, "-a") == 0)
+			alpha = strtof(value, NULL);
+		else if (strcmp(arg, "-t") == 0)
+			threads = (unsigned int)strtoul(value, NULL, 10);
+		else if (strcmp(arg, "-s") == 0)
+			seed = strtoull(value, NULL, 10);
+		else if (strcmp(arg, "-r") == 0)
+			resume = value;
+		else if (strcmp(arg, "-o") == 0)
+			output = value;
+		else
+		{
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (round == 0)
+		round = games;
+
+	NTuple *net = resume ? ntuple_load(resume) : ntuple_create(cells);
+	if (net == NULL)
+	{
+		if (resume)
+			fprintf(stderr, "The checkpoint %s couldn't be read.\n", resume);
+		else
+			fprintf(stderr, "The network couldn't be created, cells must be 4 or 6.\n");
+		return EXIT_FAILURE;
+	}
+	if (!ntuple_verify(net))
+	{
+		fprintf(stderr, "The checkpoint %s is corrupt.\n", resume);
+		ntuple_destroy(net);
+		return EXIT_FAILURE;
+	}
+	ThreadPool *pool = threadpool_create(threads);
+	if (pool == NULL)
+	{
+		fprintf(stderr, "The thread pool couldn't be created.\n");
+		ntuple_destroy(net);
+		return EXIT_FAILURE;
+	}
+	printf("Training a %u cell network on %u threads\n", ntuple_cells(net), threadpool_size(pool));
+
+	//A resumed run continues with the seed of the game after the last one
+	uint64_t resumed_seed;
+	unsigned long done = ntuple_progress(net, &resumed_seed);
+	if (done > 0)
+	{
+		seed = resumed_seed;
+		printf("Resuming after %lu games, seed %llu\n", done, (unsigned long long)seed);
+	}
+	while (done < games)
+	{
+		unsigned long count = games - done < round ? games - done : round;
+		NTupleStats stats = {0, 0, 0, 0, 0};
+		double start = now_seconds();
+		ntuple_train(net, pool, count, alpha, seed + done, &stats);
+		double seconds = now_seconds() - start;
+		done += count;
+		ntuple_set_progress(net, seed, done);
+
+		printf("%lu games: mean score %.0f, max score %lu, 2048 rate %.1f%%, %.0f moves/sec\n", done,
+			   (double)stats.score / stats.games, stats.max_score, 100.0 * stats.wins / stats.games,
+			   seconds > 0 ? stats.moves / seconds : 0);
+		fflush(stdout);
+		if (!ntuple_save(net, output))
+		{
+			fprintf(stderr, "The checkpoint %s couldn't be written.\n", output);
+			threadpool_destroy(pool);
+			ntuple_destroy(net);
+			return EXIT_FAILURE;
+		}
+	}
+
+	threadpool_destroy(pool);
+	ntuple_destroy(net);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,72 @@
+/**
+ * @file zobrist.c
+ * @author Gnik Droy
+ * @brief File containing implementation of Zobrist hashing.
+ *
+ */
+#include <pthread.h>
+#include "zobrist.h"
+#include "bits.h"
+
+/** The seed the keys are drawn from */
+#define ZOBRIST_SEED 0x2048
+
+/** The key of every tile in every cell, 2 KiB so it stays in the L1 cache */
+static uint64_t g_keys[SIZE * SIZE][ZOBRIST_TILES];
+
+/** Draws the keys exactly once, see zobrist_init() */
+static pthread_once_t g_keys_once = PTHREAD_ONCE_INIT;
+
+static void draw_keys(void)
+{
+	Rng rng;
+	rng_seed(&rng, ZOBRIST_SEED);
+	for (unsigned int cell = 0; cell < SIZE * SIZE; cell++)
+	{
+		//An empty cell does not change the hash
+		g_keys[cell][0] = 0;
+		for (unsigned int tile = 1; tile < ZOBRIST_TILES; tile++)
+			g_keys[cell][tile] = rng_next(&rng);
+	}
+}
+
+void zobrist_init(void)
+{
+	//Threads calling it at the same time wait for the first to finish
+	pthread_once(&g_keys_once, draw_keys);
+}
+
+uint64_t zobrist_key(unsigned int cell, unsigned int tile)
+{
+	return g_keys[cell][tile];
+}
+
+uint64_t zobrist_hash(BitBoard bitboard)
+{
+	uint64_t hash = 0;
+	for (unsigned int cell = 0; cell < SIZE * SIZE; cell++)
+		hash ^= g_keys[cell][(bitboard >> (4 * cell)) & 0xF];
+	return hash;
+}
+
+uint64_t zobrist_update(uint64_t hash, BitBoard before, BitBoard after)
+{
+	//Keep the lowest bit of every nibble that differs
+	BitBoard changed = before ^ after;
+	changed |= changed >> 2;
+	changed |= changed >> 1;
+	changed &= 0x1111111111111111ULL;
+	while (changed)
+	{
+		unsigned int shift = bits_ctz(changed);
+		unsigned int cell = shift / 4;
+		hash ^= g_keys[cell][(before >> shift) & 0xF] ^ g_keys[cell][(after >> shift) & 0xF];
+		changed &= changed - 1;
+	}
+	return hash;
+}
+
+uint64_t zobrist_add_tile(uint64_t hash, unsigned int cell, unsigned int tile)
+{
+	return hash ^ g_keys[cell][tile];
+}